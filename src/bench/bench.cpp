@@ -0,0 +1,194 @@
+#include "../calc/cas.h"
+#include "../calc/roots.h"
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <new>
+
+/* ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ Engine Benchmarks ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ */
+
+/*
+ * bench: microbenchmarks of the native engine. Each benchmark prints its timings and the heap
+ * allocations it made (every global operator new in the process is counted, including the
+ * engine's).
+ *
+ * usage: bench [benchmark ...]   (all of them by default)
+ */
+
+using namespace std::chrono;
+
+/* ~ ~ ~ ~ ~ Allocation Counting ~ ~ ~ ~ ~ */
+
+atomic<size_t> num_allocations{0};
+
+void *operator new(size_t size) {
+    num_allocations.fetch_add(1, memory_order_relaxed);
+    void *ptr = malloc(size ? size : 1);
+    if(ptr == nullptr) throw bad_alloc();
+    return ptr;
+}
+
+void operator delete(void *ptr) noexcept { free(ptr); }
+void operator delete(void *ptr, size_t) noexcept { free(ptr); }
+
+/* ~ ~ ~ ~ ~ Benchmarks ~ ~ ~ ~ ~ */
+
+constexpr int EVAL_ITERATIONS = 2000000;
+
+// evaluates a tree of built-in calls over a range of x (see NDoubleFunction)
+void bench_eval() {
+    const char *text = "sin(x) + cos(x) * pow(x, 2) + abs(x)";
+    unique_ptr<TreeNode> tree = parse_command(text).tree;
+
+    double sum = 0;
+    size_t allocations = num_allocations;
+    steady_clock::time_point start = steady_clock::now();
+
+    for(int i = 0; i < EVAL_ITERATIONS; i++) {
+        set_id_value("x", i * 1e-6);
+        sum += tree->eval();
+    }
+
+    double seconds = duration<double>(steady_clock::now() - start).count();
+    allocations = num_allocations - allocations;
+
+    printf("%s, %d evals: %.1f ns/eval, %.2f allocations/eval (checksum %g)\n", text,
+           EVAL_ITERATIONS, seconds * 1e9 / EVAL_ITERATIONS, (double) allocations / EVAL_ITERATIONS, sum);
+}
+
+// the terms of expand((x + y + z + w)^k), or of expand((x - y + z - w)^k) if alternating, each
+// simplified on its own
+vector<unique_ptr<TreeNode>> power_terms(int k, bool alternating) {
+    auto factorial = [](int n) { long f = 1; while(n > 1) f *= n--; return f; };
+    vector<unique_ptr<TreeNode>> terms;
+
+    for(int a = 0; a <= k; a++) for(int b = 0; a + b <= k; b++) for(int c = 0; a + b + c <= k; c++) {
+        int d = k - a - b - c;
+        long coef = factorial(k) / (factorial(a) * factorial(b) * factorial(c) * factorial(d));
+        if(alternating && (b + d) % 2) coef = -coef;
+
+        string text = to_string(coef) + " * x^" + to_string(a) + " * y^" + to_string(b) +
+                      " * z^" + to_string(c) + " * w^" + to_string(d);
+        terms.push_back(symb_simp(parse_command(text).tree));
+    }
+    return terms;
+}
+
+// simplifies the sum of expand((x + y + z + w)^k) and expand((x - y + z - w)^k), whose terms all
+// combine (into one term, or cancelling): the terms of large sums are collected in one pass (see
+// collect_sum), so the time should grow about as n log n in the number of terms n
+void bench_simp() {
+    double last_terms = 0, last_us = 0;
+    printf("\n");
+
+    for(int k = 4; k <= 16; k += 2) {
+        BinaryOpNode sum(make_unique<NaryOpNode>(power_terms(k, false), "+"),
+                         make_unique<NaryOpNode>(power_terms(k, true), "+"), "+");
+        int num_terms = ((NaryOpNode&) *sum.left).args.size() * 2;
+
+        int reps = 0;
+        double seconds = 0;
+        string result;
+
+        do {
+            ctx->cas_cache->clear(); // (so the memo tables don't answer it)
+            unique_ptr<TreeNode> input = sum.copy();
+
+            steady_clock::time_point start = steady_clock::now();
+            unique_ptr<TreeNode> simplified = symb_simp(std::move(input));
+            seconds += duration<double>(steady_clock::now() - start).count();
+
+            if(reps++ == 0) result = pretty_tree(binarize(std::move(simplified)))->to_string();
+        } while(seconds < 0.2);
+
+        string power = to_string(k), both = "(x + y + z + w)^" + power + " + (x - y + z - w)^" + power;
+        string expanded = pretty_tree(binarize(symb_expand(parse_command(both).tree)))->to_string();
+        double us = seconds * 1e6 / reps;
+
+        printf("  k = %d: %d terms, %.1f us/simp", k, num_terms, us);
+        if(last_us) printf(", growth n^%.2f", log(us / last_us) / log(num_terms / last_terms));
+        printf("%s\n", result == expanded ? "" : " (differs from expand!)");
+        last_terms = num_terms, last_us = us;
+    }
+}
+
+struct RootsCase {
+    const char *text;
+    double a, b;
+    int intervals;
+    vector<double> expected; // (to within 1e-9)
+};
+
+const RootsCase ROOTS_CASES[] = {
+    {"sin(x)", -10, 10, ROOT_SCAN_INTERVALS, {-3 * M_PI, -2 * M_PI, -M_PI, 0, M_PI, 2 * M_PI, 3 * M_PI}},
+    {"tan(x)", -3, 3, ROOT_SCAN_INTERVALS, {0}},        // (poles between samples)
+    {"1/x", -1, 1, ROOT_SCAN_INTERVALS, {}},            // (the pole is a sample)
+    {"1/(x - 0.5) + 1", 0, 1, 4, {}},                   // (so is this one, next to a sign change)
+    {"(x - 0.25) / (x - 0.5)", 0, 1, 4, {0.25}},
+};
+
+// finds the roots of expressions whose roots and poles are known, some with poles on scan samples
+// (see find_roots)
+void bench_roots() {
+    printf("\n");
+
+    for(const RootsCase& c : ROOTS_CASES) {
+        unique_ptr<TreeNode> expr = parse_command(c.text).tree;
+        vector<double> roots;
+
+        int reps = 0;
+        double seconds = 0;
+        do {
+            steady_clock::time_point start = steady_clock::now();
+            roots = expression_roots(*expr, "x", c.a, c.b, c.intervals);
+            seconds += duration<double>(steady_clock::now() - start).count();
+            reps++;
+        } while(seconds < 0.1);
+
+        bool as_expected = roots.size() == c.expected.size();
+        for(int i = 0; i < c.expected.size() && as_expected; i++)
+            as_expected = abs(roots[i] - c.expected[i]) < 1e-9;
+
+        printf("  %s on [%g, %g], %d intervals: %.1f us, %zu roots%s\n", c.text, c.a, c.b, c.intervals,
+               seconds * 1e6 / reps, roots.size(), as_expected ? "" : " (wrong roots!)");
+    }
+}
+
+struct Benchmark {
+    const char *name;
+    void (*run)();
+};
+
+const Benchmark BENCHMARKS[] = {
+    {"eval", bench_eval},
+    {"simp", bench_simp},
+    {"roots", bench_roots},
+};
+
+int main(int argc, char **argv) {
+    CalcContext& c = default_context();
+    init(c);
+    ContextScope scope(c);
+
+    vector<const Benchmark *> selected;
+    for(int i = 1; i < argc; i++) {
+        const Benchmark *found = nullptr;
+        for(const Benchmark& b : BENCHMARKS) if(b.name == string(argv[i])) found = &b;
+
+        if(found == nullptr) {
+            fprintf(stderr, "usage: %s [benchmark ...]\nbenchmarks:", argv[0]);
+            for(const Benchmark& b : BENCHMARKS) fprintf(stderr, " %s", b.name);
+            fprintf(stderr, "\n");
+            return 1;
+        }
+        selected.push_back(found);
+    }
+    if(selected.empty()) for(const Benchmark& b : BENCHMARKS) selected.push_back(&b);
+
+    for(const Benchmark *b : selected) {
+        printf("%s: ", b->name);
+        fflush(stdout);
+        b->run();
+    }
+    return 0;
+}
@@ -0,0 +1,199 @@
+#include "../calculator.h"
+#include <atomic>
+#include <mutex>
+
+/* ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ Tree Node Allocation ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ */
+
+/*
+ * Tree nodes are bump-allocated out of 64 KiB arena blocks owned by the allocating thread,
+ * instead of each being a separate malloc. Parsing, macro expansion and the CAS create and
+ * destroy nodes in bulk, so a block is typically filled by one command and released as a whole
+ * once all of its nodes have been deleted.
+ *
+ * Each allocation is preceded by a header pointing at its block (nullptr for nodes allocated on
+ * the heap). A block's live count is atomic, so nodes can be deleted by any thread (e.g. trees
+ * parsed on one thread and evaluated on another). While a block is its thread's current block,
+ * the count carries a large bias so it can't reach 0; when the block is retired the bias is
+ * removed (minus the nodes handed out), and whoever brings the count to 0 recycles the block.
+ *
+ * Trees that outlive the command that built them (user functions, graphed functions) would pin
+ * whole blocks, so they are copied onto the heap instead: see PersistentAllocScope and
+ * persistent_copy.
+ */
+
+constexpr size_t ARENA_BLOCK_SIZE = 64 * 1024;
+constexpr size_t ARENA_ALIGN = alignof(max_align_t);
+constexpr size_t ARENA_MAX_NODE = ARENA_BLOCK_SIZE / 8; // larger allocations go to the heap
+constexpr int ARENA_MAX_SPARE_BLOCKS = 16; // empty blocks each thread keeps for reuse
+constexpr int ARENA_MAX_SHARED_BLOCKS = 64; // empty blocks kept for any thread (e.g. when one
+                                            // thread frees the nodes another one allocates)
+constexpr long ARENA_LIVE_BIAS = 1L << 40;
+
+constexpr size_t align_up(size_t n) { return (n + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1); }
+
+struct ArenaBlock {
+    atomic<long> live;     // allocated nodes not yet deleted (+ ARENA_LIVE_BIAS while current)
+    size_t used;           // bytes handed out, including this header (owning thread only)
+    long allocated;        // nodes handed out (owning thread only)
+    ArenaBlock *next_spare;
+};
+
+struct NodeHeader {
+    ArenaBlock *block; // nullptr if the node is on the heap
+};
+
+constexpr size_t BLOCK_HEADER_SIZE = align_up(sizeof(ArenaBlock));
+constexpr size_t NODE_HEADER_SIZE = align_up(sizeof(NodeHeader));
+
+// statistics (relaxed: they're only reported)
+atomic<long> arena_nodes_allocated{0}, heap_nodes_allocated{0};
+atomic<long> blocks_allocated{0}, blocks_live{0}, blocks_peak{0};
+
+// per-thread state: trivially destructible, so it stays usable while the thread is exiting
+thread_local ArenaBlock *current_block = nullptr;
+thread_local ArenaBlock *spare_blocks = nullptr;
+thread_local int num_spare_blocks = 0;
+thread_local bool arena_thread_exited = false;
+thread_local int persistent_depth = 0;
+
+mutex shared_blocks_lock;
+ArenaBlock *shared_blocks = nullptr;
+int num_shared_blocks = 0;
+
+void release_block(ArenaBlock *block) {
+    if(!arena_thread_exited && num_spare_blocks < ARENA_MAX_SPARE_BLOCKS) {
+        block->next_spare = spare_blocks;
+        spare_blocks = block;
+        num_spare_blocks++;
+        return;
+    }
+
+    {
+        lock_guard<mutex> guard(shared_blocks_lock);
+        if(num_shared_blocks < ARENA_MAX_SHARED_BLOCKS) {
+            block->next_spare = shared_blocks;
+            shared_blocks = block;
+            num_shared_blocks++;
+            return;
+        }
+    }
+
+    blocks_live.fetch_sub(1, memory_order_relaxed);
+    free(block);
+}
+
+// takes an empty block from this thread's spares, or else from the shared ones
+ArenaBlock *reuse_block() {
+    if(spare_blocks) {
+        ArenaBlock *block = spare_blocks;
+        spare_blocks = block->next_spare;
+        num_spare_blocks--;
+        return block;
+    }
+
+    lock_guard<mutex> guard(shared_blocks_lock);
+    ArenaBlock *block = shared_blocks;
+    if(block) {
+        shared_blocks = block->next_spare;
+        num_shared_blocks--;
+    }
+    return block;
+}
+
+// drops the current block's bias; the block is recycled now if none of its nodes are alive
+void retire_current_block() {
+    ArenaBlock *block = current_block;
+    current_block = nullptr;
+
+    arena_nodes_allocated.fetch_add(block->allocated, memory_order_relaxed);
+    long bias = ARENA_LIVE_BIAS - block->allocated;
+    if(block->live.fetch_sub(bias, memory_order_acq_rel) == bias) release_block(block);
+}
+
+// releases this thread's blocks when it exits
+struct ArenaThreadGuard {
+    ~ArenaThreadGuard() {
+        if(current_block) retire_current_block();
+        arena_thread_exited = true;
+
+        while(spare_blocks) {
+            ArenaBlock *block = spare_blocks;
+            spare_blocks = block->next_spare;
+            blocks_live.fetch_sub(1, memory_order_relaxed);
+            free(block);
+        }
+        num_spare_blocks = 0;
+    }
+};
+
+thread_local ArenaThreadGuard arena_thread_guard;
+
+void start_new_block() {
+    if(current_block) retire_current_block();
+    (void) &arena_thread_guard; // constructs the guard on this thread's first block
+
+    ArenaBlock *block = reuse_block();
+    if(block == nullptr) {
+        block = (ArenaBlock *) malloc(ARENA_BLOCK_SIZE);
+        if(block == nullptr) throw bad_alloc();
+
+        blocks_allocated.fetch_add(1, memory_order_relaxed);
+        long live = blocks_live.fetch_add(1, memory_order_relaxed) + 1;
+        long peak = blocks_peak.load(memory_order_relaxed);
+        while(live > peak && !blocks_peak.compare_exchange_weak(peak, live, memory_order_relaxed));
+    }
+
+    block->live.store(ARENA_LIVE_BIAS, memory_order_relaxed);
+    block->used = BLOCK_HEADER_SIZE;
+    block->allocated = 0;
+    current_block = block;
+}
+
+void *TreeNode::operator new(size_t size) {
+    size_t needed = NODE_HEADER_SIZE + align_up(size);
+    NodeHeader *header;
+
+    if(persistent_depth > 0 || arena_thread_exited || needed > ARENA_MAX_NODE) {
+        header = (NodeHeader *) malloc(needed);
+        if(header == nullptr) throw bad_alloc();
+        header->block = nullptr;
+        heap_nodes_allocated.fetch_add(1, memory_order_relaxed);
+    } else {
+        if(current_block == nullptr || current_block->used + needed > ARENA_BLOCK_SIZE)
+            start_new_block();
+
+        header = (NodeHeader *) ((char *) current_block + current_block->used);
+        header->block = current_block;
+        current_block->used += needed;
+        current_block->allocated++;
+    }
+
+    return (char *) header + NODE_HEADER_SIZE;
+}
+
+void TreeNode::operator delete(void *ptr) {
+    if(ptr == nullptr) return;
+    NodeHeader *header = (NodeHeader *) ((char *) ptr - NODE_HEADER_SIZE);
+    ArenaBlock *block = header->block;
+
+    if(block == nullptr) free(header);
+    else if(block->live.fetch_sub(1, memory_order_acq_rel) == 1) release_block(block);
+}
+
+PersistentAllocScope::PersistentAllocScope() { persistent_depth++; }
+PersistentAllocScope::~PersistentAllocScope() { persistent_depth--; }
+
+unique_ptr<TreeNode> persistent_copy(TreeNode& node) {
+    PersistentAllocScope scope;
+    return node.copy();
+}
+
+TreeAllocStats tree_alloc_stats() {
+    TreeAllocStats stats;
+    stats.arena_nodes = arena_nodes_allocated.load(memory_order_relaxed) +
+                        (current_block ? current_block->allocated : 0);
+    stats.heap_nodes = heap_nodes_allocated.load(memory_order_relaxed);
+    stats.blocks_allocated = blocks_allocated.load(memory_order_relaxed);
+    stats.peak_bytes = blocks_peak.load(memory_order_relaxed) * ARENA_BLOCK_SIZE;
+    return stats;
+}
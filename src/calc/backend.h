@@ -8,18 +8,14 @@
 // Function base-class
 struct Function {
     virtual double eval(vector<unique_ptr<TreeNode>>& args) = 0;
+    // evaluates the function element-wise over n points: arg_cols[k][j] is the k'th argument
+    // of the j'th point. Returns false if the function has no batch kernel.
+    virtual bool eval_batch(const double *const *arg_cols, double *out, int n) { return false; }
+    virtual int num_args() { return -1; } // the number of arguments it takes (-1 if it varies)
     virtual bool is_user_fn() { return false; }
     virtual ~Function() { }
 };
 
-extern unordered_map<string, double> identifier_table; // stores values of all variables
-extern bool param_override; // set to true during function calls for name substitution
-extern unordered_map<string, double> param_id; // names to substitute w/ (index to substitute + 1)
-extern vector<double> params; // values to substitute
-extern unordered_map<string, unique_ptr<Function>> fn_table; // stores all functions
-
-extern unordered_map<string, unique_ptr<macro_fn>> macro_table;
-
 void init_math_functions();
 void init_macro_functions();
 
@@ -43,14 +39,14 @@ struct UserFunction : Function {
                                           "arguments (" + to_string(args.size()) + " given, " +
                                                           to_string(arg_ids.size()) + " expected)");
 
-        params.clear();
-        for(unique_ptr<TreeNode>& a : args) params.push_back(a->eval());
+        ctx->params.clear();
+        for(unique_ptr<TreeNode>& a : args) ctx->params.push_back(a->eval());
 
-        param_override = true;
-        for(int i = 0; i < arg_ids.size(); i++) param_id[arg_ids[i]] = i + 1;
+        ctx->param_override = true;
+        for(int i = 0; i < arg_ids.size(); i++) ctx->param_id[arg_ids[i]] = i + 1;
         double return_val = tree->eval();
-        for(int i = 0; i < arg_ids.size(); i++) param_id[arg_ids[i]] = 0;
-        param_override = false;
+        for(int i = 0; i < arg_ids.size(); i++) ctx->param_id[arg_ids[i]] = 0;
+        ctx->param_override = false;
 
         return return_val;
     }
@@ -85,23 +81,34 @@ struct RawFunction : Function {
 
 /*
  * NDoubleFunction: a library function that accepts exacly N floating-point arguments.
+ * The kernel F is a plain function of N doubles bound at compile-time, so eval() gathers
+ * the arguments into a stack array and calls F directly (no heap allocation, no indirect
+ * call), and eval_batch() applies F element-wise over columns of arguments.
  */
-template<unsigned int N>
+template<unsigned int N, auto F>
 struct NDoubleFunction : Function {
-    function<double(vector<double>&)> fn;
-
     double eval(vector<unique_ptr<TreeNode>>& args) override {
         if(args.size() != N) throw invalid_function_call_error("wrong number of "
                                           "arguments (" + to_string(args.size()) + " given, " +
                                                           to_string(N) + " expected)");
 
-        vector<double> arg_vals;
-        for(auto& arg : args) arg_vals.push_back(arg->eval());
+        array<double, N> arg_vals;
+        for(int i = 0; i < N; i++) arg_vals[i] = args[i]->eval();
 
-        return fn(arg_vals);
+        return apply(F, arg_vals);
     }
 
-    NDoubleFunction(function<double(vector<double>&)> f) : fn(f) { }
+    bool eval_batch(const double *const *arg_cols, double *out, int n) override {
+        for(int j = 0; j < n; j++) out[j] = apply_at(arg_cols, j, make_index_sequence<N>());
+        return true;
+    }
+
+    int num_args() override { return N; }
+
+    template<size_t... I>
+    static inline double apply_at(const double *const *arg_cols, int j, index_sequence<I...>) {
+        return F(arg_cols[I][j]...);
+    }
 };
 
 #endif // BACKEND
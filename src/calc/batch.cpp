@@ -0,0 +1,445 @@
+#include "batch.h"
+#include "interval.h"
+#include "jet.h"
+#include "numdiff.h"
+#include "poly.h"
+
+/* ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ Batch Evaluation ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ */
+
+/* ~ ~ ~ ~ ~ Compilation ~ ~ ~ ~ ~ */
+
+struct no_batch_form { }; // (thrown while compiling, caught by compile)
+
+// the variable of a polynomial (see collect_poly) isn't known yet, or is the program's variable
+// (which may not be emitted yet)
+constexpr int NO_POLY_VAR = -2, PROGRAM_VAR = -1;
+
+struct BatchCompiler {
+    BatchProgram& program;
+    const string& var_id;
+    const string *outer_var_id; // the variable of the program this one is nested in, if any
+    bool fast_math;
+    int var_reg = -1; // (emitted once)
+
+    int emit(BatchInstr instr) {
+        program.code.push_back(instr);
+        return program.code.size() - 1;
+    }
+
+    int emit_const(double val) { return emit({bo_const, 0, 0, val, nullptr, 0, 0}); }
+
+    // the register of node's value; frame holds the parameters of the inlined user function
+    int compile(TreeNode& node, vector<pair<const string *, int>> *frame, int depth);
+    int compile_id(const string& id, vector<pair<const string *, int>> *frame);
+    int compile_call(FunctionCallNode& call, vector<pair<const string *, int>> *frame, int depth);
+    int compile_nderiv(FunctionCallNode& call, vector<pair<const string *, int>> *frame, int depth);
+
+    int id_source(const string& id, vector<pair<const string *, int>> *frame, double& val);
+    bool collect_poly(TreeNode& node, vector<pair<const string *, int>> *frame, Poly& p, int& poly_var);
+    int compile_poly(TreeNode& node, vector<pair<const string *, int>> *frame);
+};
+
+unique_ptr<BatchProgram> compile_program(TreeNode& tree, const string& var_id, const string *outer_var_id,
+                                         bool fast_math, int depth);
+
+int BatchCompiler::compile_id(const string& id, vector<pair<const string *, int>> *frame) {
+    if(frame) {
+        for(auto& param : *frame) if(*param.first == id) return param.second;
+    } else if(ctx->param_override && ctx->param_id[id]) { // (the caller's parameters)
+        return emit_const(ctx->params[ctx->param_id[id] - 1]);
+    }
+
+    if(id == var_id) {
+        if(var_reg == -1) var_reg = emit({bo_var, 0, 0, 0, nullptr, 0, 0});
+        return var_reg;
+    }
+    if(outer_var_id && id == *outer_var_id) throw no_batch_form(); // (varies, but isn't ours)
+    return emit_const(ctx->identifier_table[id]);
+}
+
+int BatchCompiler::compile_call(FunctionCallNode& call, vector<pair<const string *, int>> *frame,
+                                int depth) {
+    Function *fn = ctx->fn_table[call.fn_id].get();
+    if(fn == nullptr) throw no_batch_form();
+    if(call.fn_id == "nderiv" && !fn->is_user_fn()) return compile_nderiv(call, frame, depth);
+
+    vector<int> args;
+    for(auto& arg : call.args) args.push_back(compile(*arg, frame, depth));
+
+    // (user functions with a batch kernel, i.e. tabulated ones, are called)
+    if(fn->is_user_fn() && !fn->eval_batch(nullptr, nullptr, 0)) {
+        UserFunction *user_fn = (UserFunction *) fn;
+        if(user_fn->arg_ids.size() != args.size() || depth >= BATCH_MAX_INLINE_DEPTH) throw no_batch_form();
+
+        vector<pair<const string *, int>> params;
+        for(int i = 0; i < args.size(); i++) params.emplace_back(&user_fn->arg_ids[i], args[i]);
+        return compile(*user_fn->tree, &params, depth + 1);
+    }
+
+    // (functions of no arguments, i.e. rand, aren't pure)
+    if(fn->num_args() != args.size() || args.empty() || args.size() > BATCH_MAX_CALL_ARGS ||
+       !fn->eval_batch(nullptr, nullptr, 0))
+        throw no_batch_form();
+
+    int first_arg = program.call_args.size();
+    program.call_args.insert(program.call_args.end(), args.begin(), args.end());
+    jet_fn jet = find_jet_kernel(call.fn_id, args.size());
+    fast_fn fast = fast_math ? find_fast_kernel(call.fn_id) : nullptr;
+    interval_fn interval = find_interval_kernel(call.fn_id, args.size());
+    return emit({bo_call, 0, 0, 0, fn, first_arg, (int) args.size(), 0, jet, fast, interval});
+}
+
+int BatchCompiler::compile_nderiv(FunctionCallNode& call, vector<pair<const string *, int>> *frame,
+                                  int depth) {
+    // (in a user function, f could depend on its parameters, which vary)
+    if(call.args.size() != 3 || call.args[1]->type() != nt_id || frame) throw no_batch_form();
+
+    const string& diff_id = ((VariableNode&) *call.args[1]).id;
+    const string *outer_var_id = diff_id == var_id ? nullptr : &var_id;
+    // (never fast math: differences would amplify its error)
+    unique_ptr<BatchProgram> nested = compile_program(*call.args[0], diff_id, outer_var_id, false, depth + 1);
+    if(!nested) throw no_batch_form();
+
+    int at = compile(*call.args[2], frame, depth);
+    program.programs.push_back(std::move(nested));
+    return emit({bo_nderiv, at, 0, 0, nullptr, 0, 0, (int) program.programs.size() - 1});
+}
+
+/* ~ ~ ~ ~ ~ Polynomials ~ ~ ~ ~ ~ */
+
+// the register of id's value, PROGRAM_VAR for the program's variable, or NO_POLY_VAR (with val
+// set to its value) if it's constant while the program runs; like compile_id, but emits nothing
+int BatchCompiler::id_source(const string& id, vector<pair<const string *, int>> *frame, double& val) {
+    if(frame) {
+        for(auto& param : *frame) {
+            if(*param.first != id) continue;
+            const BatchInstr& arg = program.code[param.second];
+            if(arg.op == bo_const) {
+                val = arg.val;
+                return NO_POLY_VAR;
+            }
+            return arg.op == bo_var ? PROGRAM_VAR : param.second;
+        }
+    } else if(ctx->param_override && ctx->param_id[id]) {
+        val = ctx->params[ctx->param_id[id] - 1];
+        return NO_POLY_VAR;
+    }
+
+    if(id == var_id) return PROGRAM_VAR;
+    if(outer_var_id && id == *outer_var_id) throw no_batch_form();
+    val = ctx->identifier_table[id];
+    return NO_POLY_VAR;
+}
+
+// the value of p, if it's a constant
+bool poly_constant(const Poly& p, double& val) {
+    val = 0;
+    for(int t = 0; t < p.num_terms(); t++) {
+        if(p.coefs[t] == 0) continue;
+        if(p.exponent(t, 0) != 0) return false;
+        val += p.coefs[t];
+    }
+    return true;
+}
+
+// false if node isn't a sum of monomials in one identifier (and of constants): sums, differences
+// and negations of polynomials, products with at most one factor that is a sum, quotients by
+// constants and non-negative integer powers of monomials. poly_var is the register of the
+// polynomial's variable (see id_source), which is generator 0 of p.
+bool BatchCompiler::collect_poly(TreeNode& node, vector<pair<const string *, int>> *frame, Poly& p,
+                                 int& poly_var) {
+    enum node_type type = node.type();
+    switch(type) {
+        case nt_num:
+            p = Poly::constant(((NumberNode&) node).val, 1);
+            return true;
+        case nt_id: {
+            double val;
+            int source = id_source(((VariableNode&) node).id, frame, val);
+            if(source == NO_POLY_VAR) {
+                p = Poly::constant(val, 1);
+                return true;
+            }
+            if(poly_var != NO_POLY_VAR && poly_var != source) return false; // (a second variable)
+            poly_var = source;
+            p = Poly::generator(0, 1);
+            return true;
+        }
+        case nt_negation:
+            if(!collect_poly(*((UnaryOpNode&) node).arg, frame, p, poly_var)) return false;
+            p = p * Poly::constant(-1, 1);
+            return true;
+        case nt_nary_sum:
+        case nt_nary_product:
+        case nt_sum:
+        case nt_difference:
+        case nt_product: {
+            vector<TreeNode *> args;
+            if(type == nt_nary_sum || type == nt_nary_product) {
+                for(auto& arg : ((NaryOpNode&) node).args) args.push_back(arg.get());
+            } else {
+                args = {((BinaryOpNode&) node).left.get(), ((BinaryOpNode&) node).right.get()};
+            }
+            bool is_sum = type == nt_nary_sum || type == nt_sum || type == nt_difference;
+
+            p = Poly::constant(is_sum ? 0 : 1, 1);
+            bool has_sum_factor = false;
+            for(int i = 0; i < args.size(); i++) {
+                Poly q;
+                if(!collect_poly(*args[i], frame, q, poly_var)) return false;
+                if(type == nt_difference && i == 1) q = q * Poly::constant(-1, 1);
+
+                if(is_sum) {
+                    p += q;
+                    continue;
+                }
+                if(q.num_nonzero_terms() > 1) {
+                    if(has_sum_factor) return false;
+                    has_sum_factor = true;
+                }
+                if(p.max_degree + q.max_degree > BATCH_MAX_POLY_DEGREE) return false;
+                p = p * q;
+            }
+            return true;
+        }
+        case nt_quotient: {
+            BinaryOpNode& quotient = (BinaryOpNode&) node;
+            Poly divisor;
+            double val;
+            if(!collect_poly(*quotient.left, frame, p, poly_var) ||
+               !collect_poly(*quotient.right, frame, divisor, poly_var) || !poly_constant(divisor, val))
+                return false;
+            p = p * Poly::constant(1 / val, 1);
+            return true;
+        }
+        case nt_exponentiation: {
+            BinaryOpNode& power = (BinaryOpNode&) node;
+            Poly exponent;
+            double n;
+            if(!collect_poly(*power.left, frame, p, poly_var) ||
+               !collect_poly(*power.right, frame, exponent, poly_var) || !poly_constant(exponent, n) ||
+               !(n >= 0 && n == floor(n)) || p.num_nonzero_terms() > 1 || p.max_degree * n > BATCH_MAX_POLY_DEGREE)
+                return false;
+            p = p.pow(n);
+            return true;
+        }
+        default: return false;
+    }
+}
+
+// the register of node's polynomial, or -1 if it isn't one of degree 2 or more (lower degrees
+// take no more instructions than they would as a polynomial)
+int BatchCompiler::compile_poly(TreeNode& node, vector<pair<const string *, int>> *frame) {
+    Poly p;
+    int poly_var = NO_POLY_VAR;
+    if(!collect_poly(node, frame, p, poly_var)) return -1;
+
+    vector<double> coefs;
+    for(int t = 0; t < p.num_terms(); t++) {
+        if(p.coefs[t] == 0) continue;
+        int n = p.exponent(t, 0);
+        if(n >= coefs.size()) coefs.resize(n + 1, 0);
+        coefs[n] += p.coefs[t];
+    }
+    if(coefs.size() < 3) return -1;
+    for(double c : coefs) if(!isfinite(c)) return -1; // (an infinite coefficient times 0 isn't 0)
+
+    if(poly_var == PROGRAM_VAR) {
+        if(var_reg == -1) var_reg = emit({bo_var, 0, 0, 0, nullptr, 0, 0});
+        poly_var = var_reg;
+    }
+    int first_coef = program.poly_coefs.size();
+    program.poly_coefs.insert(program.poly_coefs.end(), coefs.begin(), coefs.end());
+    return emit({bo_poly, poly_var, 0, 0, nullptr, first_coef, (int) coefs.size()});
+}
+
+int BatchCompiler::compile(TreeNode& node, vector<pair<const string *, int>> *frame, int depth) {
+    enum node_type type = node.type();
+    switch(type) {
+        case nt_negation:
+        case nt_nary_sum:
+        case nt_nary_product:
+        case nt_sum:
+        case nt_difference:
+        case nt_product:
+        case nt_quotient:
+        case nt_exponentiation: {
+            int poly = compile_poly(node, frame);
+            if(poly != -1) return poly;
+            break;
+        }
+        default: break;
+    }
+
+    switch(type) {
+        case nt_num: return emit_const(((NumberNode&) node).val);
+        case nt_id: return compile_id(((VariableNode&) node).id, frame);
+        case nt_negation: {
+            int a = compile(*((UnaryOpNode&) node).arg, frame, depth);
+            return emit({bo_neg, a, 0, 0, nullptr, 0, 0});
+        }
+        case nt_fn_call: return compile_call((FunctionCallNode&) node, frame, depth);
+        case nt_nary_sum:
+        case nt_nary_product: {
+            NaryOpNode& nary = (NaryOpNode&) node;
+            int acc = emit_const(type == nt_nary_sum ? 0 : 1);
+            for(auto& arg : nary.args) {
+                int b = compile(*arg, frame, depth);
+                acc = emit({type == nt_nary_sum ? bo_add : bo_mul, acc, b, 0, nullptr, 0, 0});
+            }
+            return acc;
+        }
+        default: break;
+    }
+
+    enum batch_op op;
+    switch(type) {
+        case nt_sum: op = bo_add; break;
+        case nt_difference: op = bo_sub; break;
+        case nt_product: op = bo_mul; break;
+        case nt_quotient: op = bo_div; break;
+        case nt_exponentiation: op = bo_pow; break;
+        case nt_int_quotient: op = bo_int_quotient; break;
+        case nt_modulus: op = bo_mod; break;
+        case nt_eq: op = bo_eq; break;
+        case nt_ne: op = bo_ne; break;
+        case nt_lt: op = bo_lt; break;
+        case nt_gt: op = bo_gt; break;
+        case nt_le: op = bo_le; break;
+        case nt_ge: op = bo_ge; break;
+        default: throw no_batch_form(); // (assignments, derivatives)
+    }
+
+    BinaryOpNode& binary = (BinaryOpNode&) node;
+    int a = compile(*binary.left, frame, depth);
+    int b = compile(*binary.right, frame, depth);
+    if(op == bo_pow && fast_math) return emit({op, a, b, 0, nullptr, 0, 0, 0, nullptr, fast_pow});
+    return emit({op, a, b, 0, nullptr, 0, 0});
+}
+
+unique_ptr<BatchProgram> compile_program(TreeNode& tree, const string& var_id, const string *outer_var_id,
+                                         bool fast_math, int depth) {
+    auto program = make_unique<BatchProgram>();
+    BatchCompiler compiler {*program, var_id, outer_var_id, fast_math};
+
+    try {
+        program->result = compiler.compile(tree, nullptr, depth);
+    } catch(no_batch_form&) {
+        return nullptr;
+    }
+    return program;
+}
+
+unique_ptr<BatchProgram> BatchProgram::compile(TreeNode& tree, const string& var_id, bool fast_math) {
+    return compile_program(tree, var_id, nullptr, fast_math, 0);
+}
+
+/* ~ ~ ~ ~ ~ Execution ~ ~ ~ ~ ~ */
+
+double apply_op(enum batch_op op, double a, double b) {
+    long long numerator = a, denominator = b;
+    switch(op) {
+        case bo_int_quotient: return denominator == 0 ? NAN : numerator / denominator;
+        case bo_mod: return denominator == 0 ? NAN : numerator % denominator;
+        case bo_eq: return a == b;
+        case bo_ne: return a != b;
+        case bo_lt: return a < b;
+        case bo_gt: return a > b;
+        case bo_le: return a <= b;
+        case bo_ge: return a >= b;
+        default: return NAN;
+    }
+}
+
+// out[j] = the derivative of nested at at[j], like numeric_derivative: on jets, falling back to
+// Ridders' method (with the fallback points differentiated together)
+void batch_nderiv(const BatchProgram& nested, const double *at, double *out, int n) {
+    double retry_at[BATCH_SIZE];
+    int retry[BATCH_SIZE], num_retries = 0;
+
+    for(int j = 0; j < n; j++) {
+        try {
+            out[j] = jet_derivative(nested, 1, at[j]);
+        } catch(jet_unsupported_error& e) {
+            retry_at[num_retries] = at[j];
+            retry[num_retries++] = j;
+        }
+    }
+    if(num_retries == 0) return;
+
+    vector<double> regs = nested.new_registers();
+    double derivative[BATCH_SIZE], error[BATCH_SIZE];
+    ridders_derivatives([&](const double *xs, double *ys, int m) {
+        for(int j = 0; j < m; j += BATCH_SIZE) nested.run(xs + j, ys + j, min(BATCH_SIZE, m - j), regs.data());
+    }, 1, retry_at, derivative, error, num_retries);
+
+    for(int k = 0; k < num_retries; k++) out[retry[k]] = derivative[k];
+}
+
+void eval_poly(const double *c, int degree, const double *u, double *out, int n) {
+    double u2[BATCH_SIZE];
+    for(int j = 0; j < n; j++) u2[j] = u[j] * u[j];
+
+    // (the pair of the top coefficient first, then the lower pairs from c_k on)
+    int k = degree % 2 == 0 ? degree - 2 : degree - 3;
+    if(degree % 2 == 0) fill_n(out, n, c[degree]);
+    else for(int j = 0; j < n; j++) out[j] = c[degree - 1] + c[degree] * u[j];
+    for(; k >= 0; k -= 2) {
+        for(int j = 0; j < n; j++) out[j] = out[j] * u2[j] + (c[k] + c[k + 1] * u[j]);
+    }
+}
+
+vector<double> BatchProgram::new_registers() const {
+    vector<double> regs(code.size() * BATCH_SIZE);
+    for(int i = 0; i < code.size(); i++) {
+        if(code[i].op == bo_const) fill_n(&regs[i * BATCH_SIZE], BATCH_SIZE, code[i].val);
+    }
+    return regs;
+}
+
+void BatchProgram::run(const double *x, double *out, int n, double *regs) const {
+    const double *arg_cols[BATCH_MAX_CALL_ARGS];
+
+    for(int i = 0; i < code.size(); i++) {
+        const BatchInstr& instr = code[i];
+        double *r = regs + i * BATCH_SIZE;
+        const double *a = regs + instr.a * BATCH_SIZE, *b = regs + instr.b * BATCH_SIZE;
+
+        // (integer division and modulus are on long longs, like BinaryOpNode::eval)
+        switch(instr.op) {
+            case bo_const: break;
+            case bo_var: copy(x, x + n, r); break;
+            case bo_neg: for(int j = 0; j < n; j++) r[j] = -1 * a[j]; break;
+            case bo_add: for(int j = 0; j < n; j++) r[j] = a[j] + b[j]; break;
+            case bo_sub: for(int j = 0; j < n; j++) r[j] = a[j] - b[j]; break;
+            case bo_mul: for(int j = 0; j < n; j++) r[j] = a[j] * b[j]; break;
+            case bo_div: for(int j = 0; j < n; j++) r[j] = a[j] / b[j]; break;
+            case bo_pow:
+                if(instr.fast) {
+                    const double *cols[2] = {a, b};
+                    instr.fast(cols, r, n);
+                } else for(int j = 0; j < n; j++) r[j] = pow(a[j], b[j]);
+                break;
+            case bo_int_quotient:
+            case bo_mod: for(int j = 0; j < n; j++) r[j] = apply_op(instr.op, a[j], b[j]); break;
+            case bo_eq: for(int j = 0; j < n; j++) r[j] = a[j] == b[j]; break;
+            case bo_ne: for(int j = 0; j < n; j++) r[j] = a[j] != b[j]; break;
+            case bo_lt: for(int j = 0; j < n; j++) r[j] = a[j] < b[j]; break;
+            case bo_gt: for(int j = 0; j < n; j++) r[j] = a[j] > b[j]; break;
+            case bo_le: for(int j = 0; j < n; j++) r[j] = a[j] <= b[j]; break;
+            case bo_ge: for(int j = 0; j < n; j++) r[j] = a[j] >= b[j]; break;
+            case bo_call: {
+                for(int k = 0; k < instr.num_args; k++) {
+                    arg_cols[k] = regs + call_args[instr.first_arg + k] * BATCH_SIZE;
+                }
+                if(instr.fast) instr.fast(arg_cols, r, n);
+                else instr.fn->eval_batch(arg_cols, r, n);
+                break;
+            }
+            case bo_nderiv: batch_nderiv(*programs[instr.program], a, r, n); break;
+            case bo_poly: eval_poly(&poly_coefs[instr.first_arg], instr.num_args - 1, a, r, n); break;
+        }
+    }
+
+    copy(regs + result * BATCH_SIZE, regs + result * BATCH_SIZE + n, out);
+}
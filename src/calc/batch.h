@@ -0,0 +1,83 @@
+#ifndef BATCH
+#define BATCH
+
+#include "cas.h"
+#include "fastmath.h"
+
+/* ~ ~ ~ ~ ~ Batch Evaluation ~ ~ ~ ~ ~ */
+
+/*
+ * BatchProgram: a tree compiled for evaluation at many values of one variable at once. The tree is
+ * flattened into instructions in evaluation order, each of which computes a column of BATCH_SIZE
+ * values (a "register") from earlier columns: so every node is dispatched once per batch rather
+ * than once per point, and built-ins run their eval_batch kernels. Calls to user functions are
+ * inlined, with their parameters bound to the argument registers (except tabulated ones, which run
+ * their kernels too, see cheb.h), and every other identifier is read when the program is compiled.
+ * nderiv(f, d, x) compiles f into a nested program in d, which is differentiated at each of the
+ * batch's values of x on Taylor jets (see jet.h), and by Ridders' method at the points jets fail
+ * at, all of those together (see numdiff.h). A program doesn't touch the context while it runs, so
+ * it can run on any thread, each with its own registers (its own variable frame). Trees with nodes
+ * that have no batch form (assignments, derivatives, raw functions like nintegral, rand) don't
+ * compile; callers evaluate those point by point. Programs compiled with fast_math call the fast
+ * kernels of fastmath.h for the built-ins (and powers) that have them, which only graphs do.
+ *
+ * A subtree that is a sum of monomials c u^n in one identifier u (and of constants), like
+ * 3x^4 - x^2 / 2 + 1, is collected into a polynomial (a Poly, see poly.h) and compiled to one
+ * instruction over its coefficients, evaluated by Estrin's scheme: pairs c_k + c_k+1 u combined
+ * by Horner's scheme in u^2, which halves the chain of dependent multiply-adds. Each step runs
+ * over the whole column, so it vectorizes. Products and powers of sums aren't expanded, as their
+ * expansions can cancel catastrophically (like (x - 1)^10's near 1).
+ */
+
+constexpr int BATCH_SIZE = 256; // points per run
+constexpr int BATCH_MAX_INLINE_DEPTH = 64; // (of nested user function calls)
+constexpr int BATCH_MAX_CALL_ARGS = 8; // (of built-ins)
+constexpr int BATCH_MAX_POLY_DEGREE = 64; // (of polynomial instructions)
+
+struct Jet;
+typedef Jet (*jet_fn)(vector<Jet>& args); // (series of a built-in, see jet.cpp)
+struct Interval;
+typedef Interval (*interval_fn)(vector<Interval>& args); // (enclosure of a built-in, see interval.cpp)
+
+enum batch_op {
+    bo_const, bo_var, bo_neg, bo_call, bo_nderiv, bo_poly,
+    bo_add, bo_sub, bo_mul, bo_div, bo_pow, bo_int_quotient, bo_mod,
+    bo_eq, bo_ne, bo_lt, bo_gt, bo_le, bo_ge,
+};
+
+struct BatchInstr {
+    enum batch_op op;
+    int a, b;           // operand registers
+    double val;         // value of a constant
+    Function *fn;       // called built-in, with its arguments' registers in BatchProgram::call_args
+    int first_arg, num_args; // (of a polynomial, its coefficients in BatchProgram::poly_coefs, from c_0)
+    int program = 0;    // nested program (the expression nderiv differentiates)
+    jet_fn jet = nullptr; // the built-in's series, if it has one
+    fast_fn fast = nullptr; // the built-in's (or power's) fast kernel, with fast_math
+    interval_fn interval = nullptr; // the built-in's enclosure, if it has one
+};
+
+struct BatchProgram {
+    vector<BatchInstr> code; // instruction i writes register i
+    vector<int> call_args;
+    vector<double> poly_coefs;
+    vector<unique_ptr<BatchProgram>> programs;
+    int result; // the register of the tree's value
+
+    // nullptr if some node of tree has no batch form
+    static unique_ptr<BatchProgram> compile(TreeNode& tree, const string& var_id, bool fast_math = false);
+
+    // registers for run(), with the constants' columns filled in
+    vector<double> new_registers() const;
+
+    // out[j] = the tree's value with the variable = x[j], for n <= BATCH_SIZE
+    void run(const double *x, double *out, int n, double *regs) const;
+};
+
+// a comparison, integer division or modulus of a and b, like those instructions
+double apply_op(enum batch_op op, double a, double b);
+
+// out[j] = c[0] + c[1] u[j] + ... + c[degree] u[j]^degree, by Estrin's scheme
+void eval_poly(const double *c, int degree, const double *u, double *out, int n);
+
+#endif // BATCH
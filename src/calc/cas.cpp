@@ -1,295 +1,302 @@
-#include "cas.h"
+#include "rules.h"
+#include "poly.h"
 
 /* ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ Symbolic Differentiation ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ */
 
-// replaces VariableNode leaves according to the given (id -> node) mapping
+// Differentiation works on the expression DAG (see expr.h): the rules reuse their operands
+// instead of copying them, and each distinct subexpression is only differentiated once (inputs
+// from nested derivatives or user function calls repeat the same subexpressions many times).
+// The rules for operators and built-in functions are rewrite rules (see rules.h): in a
+// replacement, `_du` stands for the derivative of whatever `_u` matched.
+struct Differentiator {
+    ExprTable& table;
+    unordered_map<string, const Expr *> user_fns; // user function trees, converted on first use
+
+    Differentiator(ExprTable& t) : table(t) { }
+
+    const Expr *deriv(const Expr *e);
+    const Expr *deriv_fn_call(const Expr *e);
+    const Expr *apply_user_fn(const Expr *e, UserFunction& usr_fn);
+    const Expr *instantiate(const Expr *replacement, const ExprBindings& bindings);
+    const Expr *inline_call(const Expr *e);
+    invalid_expression_error no_derivative_error(const Expr *e);
+
+    // reverse mode (see gradient)
+    const string *partial_var = nullptr; // while set, instantiate takes partials instead of derivatives
+    const Expr *fold_units(const Expr *e, const Expr *const *args);
+    const Expr *inline_user_fns(const Expr *e, unordered_map<const Expr *, const Expr *>& done);
+    vector<const Expr *> gradient(const Expr *e, const vector<string>& ids);
+};
+
+// replaces the user function's parameters in its tree with the call's arguments
 // (used for manually applying function calls to trees to calculate the derivative)
-unique_ptr<TreeNode> tree_var_sub(unique_ptr<TreeNode>&& tree, vector<string>& sub_ids,
-                                  vector<unique_ptr<TreeNode>>& sub_vals) {
+const Expr *Differentiator::apply_user_fn(const Expr *e, UserFunction& usr_fn) {
+    auto body = user_fns.find(e->name);
+    if(body == user_fns.end()) body = user_fns.emplace(e->name, table.from_tree(*usr_fn.tree)).first;
+
+    unordered_map<const Expr *, const Expr *> subs;
+    for(int i = 0; i < usr_fn.arg_ids.size(); i++) subs[table.var(usr_fn.arg_ids[i])] = e->arg(i);
+
+    function<const Expr *(const Expr *)> sub = [&](const Expr *node) {
+        auto found = subs.find(node);
+        if(found != subs.end()) return found->second;
+        if(node->num_args == 0) return node;
+
+        vector<const Expr *> args;
+        for(int i = 0; i < node->num_args; i++) args.push_back(sub(node->arg(i)));
+        const Expr *result = table.intern(node->type, node->name, node->val, args.data(), args.size());
+        subs[node] = result;
+        return result;
+    };
 
-    return tree->exe_on_children(std::move(tree), [&](auto node) {
-            if(node->type() != nt_id) return node;
+    return sub(body->second);
+}
 
-            unique_ptr<VariableNode> vn = unique_ptr<VariableNode>((VariableNode*)tree.release());
-            string id = vn->id;
-            for(int i = 0; i < sub_ids.size(); i++) {
-                if(id == sub_ids[i]) return sub_vals[i]->copy();
+// builds a derivative rule's replacement from the subexpressions its pattern matched
+const Expr *Differentiator::instantiate(const Expr *e, const ExprBindings& bindings) {
+    if(is_pattern_var(e)) {
+        const Expr *bound = find_binding(bindings, e->name);
+        if(bound != nullptr) return bound;
+
+        const string& id = e->name;
+        if(id.size() > 2 && id[1] == 'd') { // _du => d(u)
+            for(auto& binding : bindings) {
+                const string& var = *binding.first;
+                if(var.size() + 1 != id.size() || id.compare(2, string::npos, var, 1) != 0) continue;
+                if(partial_var != nullptr) return table.num(binding.first == partial_var ? 1 : 0);
+                return deriv(binding.second);
             }
-            return unique_ptr<TreeNode>((TreeNode*)vn.release());
-        });
-}
+        }
+    }
+    if(e->num_args == 0) return table.intern(e->type, e->name, e->val, nullptr, 0);
 
-string diff_id;
-bool is_partial;
+    const Expr *few_args[4];
+    vector<const Expr *> many_args(e->num_args > 4 ? e->num_args : 0);
+    const Expr **args = e->num_args > 4 ? many_args.data() : few_args;
 
-unique_ptr<TreeNode> symb_deriv(unique_ptr<TreeNode>&& tree) {
+    for(int i = 0; i < e->num_args; i++) args[i] = instantiate(e->arg(i), bindings);
+    if(partial_var != nullptr) return fold_units(e, args);
+    return table.intern(e->type, e->name, e->val, args, e->num_args);
+}
 
-    unique_ptr<TreeNode> result, left, right, arg, resl, resr, reslr, resll, resrl, resrr;
+const Expr *Differentiator::deriv(const Expr *e) {
+    if(e->deriv != nullptr) return e->deriv;
 
-    if(is_binary_op(tree->type())) {
-        left = std::move(((BinaryOpNode *)tree.get())->left);
-        right = std::move(((BinaryOpNode *)tree.get())->right);
-    } else if(is_unary_op(tree->type())) {
-        arg = std::move(((UnaryOpNode *)tree.get())->arg);
-    }
+    ExprTable& t = table;
+    const Expr *result;
+
+    ExprBindings bindings;
+    const Rule *rule = ctx->deriv_rules->match(e, bindings);
 
-    switch(tree->type()) {
-        case nt_sum: { // d(u + v) => d(u) + d(v)
-            return make_unique<BinaryOpNode>(symb_deriv(std::move(left)),
-                                             symb_deriv(std::move(right)),
-                                             "+");
+    if(rule != nullptr) {
+        result = instantiate(rule->replacement, bindings);
+    } else switch(e->type) {
+        case nt_fn_call: {
+            result = deriv_fn_call(e);
+            break;
+        }
+        case nt_num: {
+            result = t.num(0);
+            break;
         }
-        case nt_difference: { // d(u - v) = d(u) + d(-v)
-            right = make_unique<UnaryOpNode>(std::move(right), "-"); // negate right
-            return make_unique<BinaryOpNode>(symb_deriv(std::move(left)),
-                                             symb_deriv(std::move(right)),
-                                             "+");
+        case nt_id: {
+            if(e->name == ctx->diff_id) result = t.num(1);
+            else if(ctx->is_partial) result = t.num(0);
+            else throw invalid_expression_error("can't take non-partial derivative of `" + e->name +
+                    "` with respect to " + ctx->diff_id);
+            break;
         }
-        case nt_negation: { // d(-u) = -d(u)
-            return make_unique<UnaryOpNode>(symb_deriv(std::move(arg)), "-");
+        default: {
+            throw no_derivative_error(e);
         }
-        case nt_product: { // d(u * v) => d(u) * v + d(v) * u
-            resl = make_unique<BinaryOpNode>(symb_deriv(left->copy()),
-                                             right->copy(),
-                                             "*");
+    }
+
+    e->deriv = result;
+    return result;
+}
 
-            resr = make_unique<BinaryOpNode>(symb_deriv(std::move(right)),
-                                             std::move(left),
-                                             "*");
+// the call's user function body, with the arguments substituted (nullptr for built-in functions)
+const Expr *Differentiator::inline_call(const Expr *e) {
+    const string& fn_id = e->name;
+
+    auto fn = ctx->fn_table.find(fn_id);
+    if(fn == ctx->fn_table.end() || fn->second == nullptr) {
+        throw invalid_expression_error("no such function: `" + fn_id + "`");
+    } else if(fn->second->is_user_fn()) {
+        UserFunction& usr_fn = (UserFunction&) *fn->second;
+        if(usr_fn.arg_ids.size() != e->num_args)
+            throw invalid_expression_error("expected " + to_string(usr_fn.arg_ids.size()) +
+                    " argument(s) for `" + fn_id + "`; "
+                    "got " + to_string(e->num_args));
+        return apply_user_fn(e, usr_fn);
+    }
 
-            return make_unique<BinaryOpNode>(std::move(resl), std::move(resr), "+");
-        }
-        case nt_quotient: { // d(u / v) => d(u * v^-1)
-            resrr = make_unique<NumberNode>(-1);
-            resr = make_unique<BinaryOpNode>(std::move(right), std::move(resrr), "^");
-            result = make_unique<BinaryOpNode>(std::move(left), std::move(resr), "*");
-            return symb_deriv(std::move(result));
-        }
-        case nt_exponentiation: {// d(u ^ v) => u^v * (d(v) * ln(u) + (d(u) / u) * v)
-            resl = make_unique<BinaryOpNode>(left->copy(), right->copy(), "^");
+    return nullptr;
+}
 
-            vector<unique_ptr<TreeNode>> ln_args;
-            ln_args.push_back(left->copy());
+// function calls without a derivative rule: user functions are differentiated inline
+const Expr *Differentiator::deriv_fn_call(const Expr *e) {
+    const Expr *body = inline_call(e);
+    if(body != nullptr) return deriv(body);
+    throw no_derivative_error(e);
+}
 
-            resrl = make_unique<BinaryOpNode>(symb_deriv(right->copy()),
-                    make_unique<FunctionCallNode>("ln", std::move(ln_args)),
-                    "*");
+invalid_expression_error Differentiator::no_derivative_error(const Expr *e) {
+    if(e->type != nt_fn_call) {
+        return invalid_expression_error("cannot differentiate expression: `" +
+                                        to_tree(e)->to_string() + "`");
+    }
 
-            resrr = make_unique<BinaryOpNode>(make_unique<BinaryOpNode>(symb_deriv(left->copy()), std::move(left), "/"),
-                    std::move(right),
-                    "*");
+    // built-in function: the ones with derivative rules are all unary
+    if(e->num_args != 1) return invalid_expression_error("expected 1 argument for `" +
+            e->name + "`; got " +
+            to_string(e->num_args));
 
-            resr = make_unique<BinaryOpNode>(std::move(resrl), std::move(resrr), "+");
+    return invalid_expression_error("can't differentiate function `" + e->name + "`");
+}
 
-            return make_unique<BinaryOpNode>(std::move(resl), std::move(resr), "*");
-        }
-        case nt_fn_call: {
-            unique_ptr<FunctionCallNode> fn = unique_ptr<FunctionCallNode>((FunctionCallNode *)tree.release());
-
-            if(fn_table[fn->fn_id] == nullptr) {
-                throw invalid_expression_error("no such function: `" + fn->fn_id + "`");
-            } else if(fn_table[fn->fn_id]->is_user_fn()) {
-                // careful using raw pointer! (I can't figure out how cast&borrow with unique_ptr)
-                UserFunction *usr_fn = (UserFunction *)fn_table[fn->fn_id].get();
-                if(usr_fn->arg_ids.size() != fn->args.size())
-                    throw invalid_expression_error("expected " + to_string(usr_fn->arg_ids.size()) +
-                            " argument(s) for `" + fn->fn_id + "`; "
-                            "got " + to_string(fn->args.size()));
-                return symb_deriv(std::move(tree_var_sub(usr_fn->tree->copy(),
-                                  usr_fn->arg_ids, fn->args)));
-            }
+unique_ptr<TreeNode> deriv_tree(unique_ptr<TreeNode>&& tree) {
+    ExprTable table;
+    Differentiator differentiator(table);
+    return to_tree(differentiator.deriv(table.from_tree(*tree)));
+}
 
-            // built-in function
-            // all of the following functions are unary: ensure that only one arg is supplied
-            if(fn->args.size() != 1) throw invalid_expression_error("expected 1 argument for `" +
-                    fn->fn_id + "`; got " +
-                    to_string(fn->args.size()));
-
-            unique_ptr<TreeNode> arg = std::move(fn->args[0]);
-
-            if(fn->fn_id == "ln") { // d(ln(u)) = d(u)/u
-                return make_unique<BinaryOpNode>(symb_deriv(arg->copy()), std::move(arg), "/");
-            } else if(fn->fn_id == "sin") { // d(sin(u)) = cos(u) * d(u)
-                vector<unique_ptr<TreeNode>> cos_args;
-                cos_args.push_back(arg->copy());
-
-                resl = make_unique<FunctionCallNode>("cos", std::move(cos_args));
-                resr = symb_deriv(std::move(arg));
-                return make_unique<BinaryOpNode>(std::move(resl), std::move(resr), "*");
-            } else if(fn->fn_id == "cos") { // d(cos(u)) = -(sin(u) * d(u))
-                vector<unique_ptr<TreeNode>> sin_args;
-                sin_args.push_back(arg->copy());
-
-                resl = make_unique<FunctionCallNode>("sin", std::move(sin_args));
-                resr = symb_deriv(std::move(arg));
-                result = make_unique<BinaryOpNode>(std::move(resl), std::move(resr), "*");
-                return make_unique<UnaryOpNode>(std::move(result), "-");
-            } else if(fn->fn_id == "tan") { // d(tan(u)) = sec(u)^2 * d(u)
-                vector<unique_ptr<TreeNode>> sec_args;
-                sec_args.push_back(arg->copy());
-
-                resll = make_unique<FunctionCallNode>("sec", std::move(sec_args));
-                reslr = make_unique<NumberNode>(2);
-
-                resl = make_unique<BinaryOpNode>(std::move(resll), std::move(reslr), "^");
-                resr = symb_deriv(std::move(arg));
-
-                return make_unique<BinaryOpNode>(std::move(resl), std::move(resr), "*");
-            } else if(fn->fn_id == "csc") { // d(csc(u) = -(csc(u) * cot(u) * d(u))
-                vector<unique_ptr<TreeNode>> csc_args, cot_args;
-                csc_args.push_back(arg->copy());
-                cot_args.push_back(arg->copy());
-
-                resll = make_unique<FunctionCallNode>("csc", std::move(csc_args));
-                reslr = make_unique<FunctionCallNode>("cot", std::move(cot_args));
-
-                resl = make_unique<BinaryOpNode>(std::move(resll), std::move(reslr), "*");
-                resr = symb_deriv(std::move(arg));
-
-                result = make_unique<BinaryOpNode>(std::move(resl), std::move(resr), "*");
-                return make_unique<UnaryOpNode>(std::move(result), "-");
-            } else if(fn->fn_id == "sec") { // d(sec(u)) = sec(u) * tan(u) * d(u)
-                vector<unique_ptr<TreeNode>> sec_args, tan_args;
-                sec_args.push_back(arg->copy());
-                tan_args.push_back(arg->copy());
-
-                resll = make_unique<FunctionCallNode>("sec", std::move(sec_args));
-                reslr = make_unique<FunctionCallNode>("tan", std::move(tan_args));
-
-                resl = make_unique<BinaryOpNode>(std::move(resll), std::move(reslr), "*");
-                resr = symb_deriv(std::move(arg));
-
-                return make_unique<BinaryOpNode>(std::move(resl), std::move(resr), "*");
-            } else if(fn->fn_id == "cot") { // d(cot(u)) = -(csc(u)^2 * d(u))
-                vector<unique_ptr<TreeNode>> csc_args;
-                csc_args.push_back(arg->copy());
-
-                resll = make_unique<FunctionCallNode>("csc", std::move(csc_args));
-                reslr = make_unique<NumberNode>(2);
-
-                resl = make_unique<BinaryOpNode>(std::move(resll), std::move(reslr), "^");
-                resr = symb_deriv(std::move(arg));
-
-                result = make_unique<BinaryOpNode>(std::move(resl), std::move(resr), "*");
-                return make_unique<UnaryOpNode>(std::move(result), "-");
-            } else if(fn->fn_id == "asin") { // d(asin(u)) = (1 - u^2)^(-1/2) * d(u)
-                unique_ptr<TreeNode> two = make_unique<NumberNode>(2);
-                resll = make_unique<BinaryOpNode>(make_unique<NumberNode>(1),
-                        make_unique<BinaryOpNode>(arg->copy(),
-                            std::move(two),
-                            "^"),
-                        "-");
-                reslr = make_unique<NumberNode>(-1.0/2.0);
-
-                resl = make_unique<BinaryOpNode>(std::move(resll), std::move(reslr), "^");
-
-                resr = symb_deriv(std::move(arg));
-
-                return make_unique<BinaryOpNode>(std::move(resl), std::move(resr), "*");
-            } else if(fn->fn_id == "acos") { // d(acos(u)) = -((1 - u^2)^(-1/2) * d(u))
-                unique_ptr<TreeNode> two = make_unique<NumberNode>(2);
-                resll = make_unique<BinaryOpNode>(make_unique<NumberNode>(1),
-                        make_unique<BinaryOpNode>(arg->copy(),
-                            std::move(two),
-                            "^"),
-                        "-");
-                reslr = make_unique<NumberNode>(-1/2);
-
-                resl = make_unique<BinaryOpNode>(std::move(resll), std::move(reslr), "^");
-
-                resr = symb_deriv(std::move(arg));
-
-                result = make_unique<BinaryOpNode>(std::move(resl), std::move(resr), "*");
-                return make_unique<UnaryOpNode>(std::move(result), "-");
-            } else if(fn->fn_id == "atan") { // d(atan(u)) = d(u) / (1 + u^2)
-                resl = symb_deriv(arg->copy());
-
-                resrl = make_unique<NumberNode>(1);
-                resrr = make_unique<BinaryOpNode>(std::move(arg),
-                        make_unique<NumberNode>(2),
-                        "^");
-
-                resr = make_unique<BinaryOpNode>(std::move(resrl), std::move(resrr), "+");
-
-                return make_unique<BinaryOpNode>(std::move(resl), std::move(resr), "/");
-            } else {
-                throw invalid_expression_error("can't differentiate function `" +
-                        fn->fn_id + "`");
-            }
+/* ~ ~ ~ ~ ~ Reverse Mode ~ ~ ~ ~ ~ */
+
+// Gradients are accumulated in reverse mode: the DAG is walked once, from the output towards
+// the leaves (in reverse topological order), and each node passes its adjoint (the derivative
+// of the output with respect to the node) on to the subexpressions its derivative rule matched,
+// times the rule's partial derivative with respect to each of them. As the rules are linear in
+// the derivatives of their variables, the partial with respect to `_u` is the replacement with
+// `_du` = 1 and every other derivative = 0. The partials of the output are then the adjoints of
+// the variables: all of them come out of one pass, and they share the DAG's subexpressions.
+// Identifiers other than the variables are constants.
+
+// e with the given operands, where an operand of 0 or 1 (as most are in a partial derivative,
+// which sets all but one derivative to 0) makes the operation trivial
+const Expr *Differentiator::fold_units(const Expr *e, const Expr *const *args) {
+    auto is_num = [](const Expr *arg, double val) { return arg->type == nt_num && arg->val == val; };
+    const Expr *u = args[0], *v = e->num_args > 1 ? args[1] : nullptr;
+
+    switch(e->type) {
+        case nt_negation: {
+            if(u->type == nt_num) return table.num(-u->val);
+            break;
         }
-        case nt_num: {
-            return make_unique<NumberNode>(0);
+        case nt_sum: {
+            if(is_num(u, 0)) return v;
+            if(is_num(v, 0)) return u;
+            break;
         }
-        case nt_id: {
-            string id = ((VariableNode *)tree.get())->id;
-            if(id == diff_id) return make_unique<NumberNode>(1);
-            else if(is_partial) return make_unique<NumberNode>(0);
-            else throw invalid_expression_error("can't take non-partial derivative of `" + id + "` "
-                    "with respect to " + diff_id);
+        case nt_difference: {
+            if(is_num(v, 0)) return u;
+            if(is_num(u, 0)) return fold_units(table.unary(v, "-"), &v);
+            break;
         }
-        default: {
-            throw invalid_expression_error("cannot differentiate expression: `" +
-                    tree->to_string() + "`");
+        case nt_product: {
+            if(is_num(u, 0) || is_num(v, 0)) return table.num(0);
+            if(is_num(u, 1)) return v;
+            if(is_num(v, 1)) return u;
+            break;
+        }
+        case nt_quotient: {
+            if(is_num(u, 0)) return table.num(0);
+            if(is_num(v, 1)) return u;
+            break;
         }
+        case nt_exponentiation: {
+            if(is_num(v, 0)) return table.num(1);
+            if(is_num(v, 1)) return u;
+            break;
+        }
+        default: break;
     }
+
+    return table.intern(e->type, e->name, e->val, args, e->num_args);
 }
 
-/* ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ Simplification ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ */
+// replaces user function calls (recursively) with their bodies
+const Expr *Differentiator::inline_user_fns(const Expr *e, unordered_map<const Expr *, const Expr *>& done) {
+    if(e->num_args == 0) return e;
 
-// This structure is only used during symbolic simplification;
-// binarize(tree) should be called to convert this back to binary
-// operations on a simplified tree before further operations
-struct NaryOpNode : TreeNode {
-    vector<unique_ptr<TreeNode>> args;
-    string op;
+    auto found = done.find(e);
+    if(found != done.end()) return found->second;
 
-    NaryOpNode(vector<unique_ptr<TreeNode>>&& a, string o):
-        args(std::move(a)),
-        op(o) {
-            assert(o == "+" || o == "*"); // only addition or multiplication
-        }
+    vector<const Expr *> args;
+    for(int i = 0; i < e->num_args; i++) args.push_back(inline_user_fns(e->arg(i), done));
+    const Expr *result = table.intern(e->type, e->name, e->val, args.data(), args.size());
 
-    enum node_type type() override {
-        if(op == "+") return nt_nary_sum;
-        else if(op == "*") return nt_nary_product;
-        else throw calculator_error("internal error: invalid operator for nary operator");
+    if(result->type == nt_fn_call) {
+        const Expr *body = inline_call(result);
+        if(body != nullptr) result = inline_user_fns(body, done);
     }
 
-    unique_ptr<TreeNode> exe_on_children(unique_ptr<TreeNode>&& self, macro_fn fn) override {
-        for(auto& arg : args) arg = arg->exe_on_children(std::move(arg), fn);
-        return fn(std::move(self));
-    }
+    done[e] = result;
+    return result;
+}
 
-    unique_ptr<TreeNode> copy() override {
-        vector<unique_ptr<TreeNode>> args_copy;
-        for(auto& arg : args) {
-            args_copy.push_back(arg->copy());
-        }
+vector<const Expr *> Differentiator::gradient(const Expr *e, const vector<string>& ids) {
+    ExprTable& t = table;
+    unordered_map<const Expr *, const Expr *> inlined;
+    e = inline_user_fns(e, inlined);
+
+    // the nodes, each after all of its subexpressions
+    vector<const Expr *> order;
+    unordered_map<const Expr *, bool> active; // (the node depends on a variable)
+    vector<pair<const Expr *, int>> stack = {{e, 0}};
+
+    while(!stack.empty()) {
+        auto& [node, next_arg] = stack.back();
+        if(next_arg == 0 && active.count(node)) {
+            stack.pop_back();
+        } else if(next_arg < node->num_args) {
+            const Expr *arg = node->arg(next_arg++);
+            if(!active.count(arg)) stack.emplace_back(arg, 0);
+        } else {
+            bool is_active = node->type == nt_id && find(ids.begin(), ids.end(), node->name) != ids.end();
+            for(int i = 0; i < node->num_args; i++) is_active = is_active || active[node->arg(i)];
 
-        return make_unique<NaryOpNode>(std::move(args_copy), op);
+            active[node] = is_active;
+            order.push_back(node);
+            stack.pop_back();
+        }
     }
 
-    string to_string(enum node_type parent_type = nt_none) override {
-        if(args.size() == 0) return "[empty n-ary " + op + "]";
-        string result = "";
-        result += "(";
-        for(int i = 0; i < args.size(); i++) {
-            result += "(" + args[i]->to_string() + ")";
-            if(i + 1 != args.size()) result += " " + op + " ";
+    unordered_map<const Expr *, const Expr *> adjoints = {{e, t.num(1)}};
+
+    for(auto it = order.rbegin(); it != order.rend(); it++) {
+        const Expr *node = *it;
+        auto adjoint = adjoints.find(node);
+        if(!active[node] || adjoint == adjoints.end() || node->type == nt_id) continue;
+
+        ExprBindings bindings;
+        const Rule *rule = ctx->deriv_rules->match(node, bindings);
+        if(rule == nullptr) throw no_derivative_error(node);
+
+        for(auto& binding : bindings) {
+            if(!active[binding.second]) continue;
+
+            partial_var = binding.first;
+            const Expr *partial = instantiate(rule->replacement, bindings);
+            partial_var = nullptr;
+
+            const Expr *product[] = {adjoint->second, partial};
+            const Expr *contribution = fold_units(t.binary(adjoint->second, partial, "*"), product);
+
+            auto& sum = adjoints[binding.second];
+            sum = sum == nullptr ? contribution : t.binary(sum, contribution, "+");
         }
-        result += ")";
-        return result;
     }
 
-    double eval() override {
-        double result = op == "+" ? 0 : 1;
-        for(int i = 0; i < args.size(); i++) {
-            if(op == "+") result += args[i]->eval();
-            else result *= args[i]->eval();
-        }
-        return result;
+    vector<const Expr *> partials;
+    for(const string& id : ids) {
+        auto adjoint = adjoints.find(t.var(id));
+        partials.push_back(adjoint != adjoints.end() ? adjoint->second : t.num(0));
     }
-};
+    return partials;
+}
+
+/* ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ Simplification ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ */
 
 // converts any NaryOpNode subtrees back to BinaryOpNode
 unique_ptr<TreeNode> binarize(unique_ptr<TreeNode>&& tree) {
@@ -309,99 +316,127 @@ unique_ptr<TreeNode> binarize(unique_ptr<TreeNode>&& tree) {
         });
 }
 
-// performs a "lexicographical" comparison of two trees: this is used hevily to
+// Simplification and expansion work on the expression DAG (see expr.h), like differentiation:
+// identical subexpressions are one node, so each is simplified once (the result is memoized on
+// the node), and rewrites share their operands instead of copying them.
+struct Simplifier {
+    ExprTable& table;
+
+    Simplifier(ExprTable& t) : table(t) { }
+
+    const Expr *key(const Expr *e);
+    const Expr *simp(const Expr *e);
+    const Expr *simp_node(const Expr *e);
+    const Expr *collect_sum(vector<const Expr *>&& terms);
+    const Expr *collect_product(vector<const Expr *>&& factors);
+    const Expr *rewrite(const Expr *e);
+    const Expr *instantiate(const Expr *replacement, const ExprBindings& bindings);
+    const Expr *expand(const Expr *e);
+};
+
+/* ~ ~ ~ ~ ~ Structural Keys ~ ~ ~ ~ ~ */
+
+// Nodes are hash-consed, so equal subexpressions are the same node; lex_cmp also considers a few
+// distinct nodes equal, though: numbers are compared by value (so -0 == 0), and unary sums and
+// products, and u^1, are compared like u. A node's key is the node with those rewritten, so
+// nodes are equal under lex_cmp exactly when their keys are the same node.
+const Expr *Simplifier::key(const Expr *e) {
+    if(e->key != nullptr) return e->key;
+
+    const Expr *result = e;
+    if(e->type == nt_num) {
+        if(e->val == 0) result = table.num(0);
+    } else if(is_nary_op(e->type) && e->num_args == 1) {
+        result = key(e->arg(0));
+    } else if(e->num_args) {
+        vector<const Expr *> args;
+        for(int i = 0; i < e->num_args; i++) args.push_back(key(e->arg(i)));
+
+        if(e->type == nt_exponentiation && args[1] == table.num(1)) result = args[0];
+        else result = table.intern(e->type, e->name, e->val, args.data(), args.size());
+    }
+
+    e->key = result;
+    return result;
+}
+
+/* ~ ~ ~ ~ ~ Ordering ~ ~ ~ ~ ~ */
+
+// lex_cmp of two argument lists: shorter lists come first, then the first differing argument
+int lex_cmp_args(const Expr *a, const Expr *b) {
+    if(a->num_args != b->num_args) return a->num_args > b->num_args ? 1 : -1;
+
+    for(int i = 0; i < a->num_args; i++) {
+        int cmp = lex_cmp(a->arg(i), b->arg(i));
+        if(cmp != 0) return cmp;
+    }
+
+    return 0;
+}
+
+// performs a "lexicographical" comparison of two expressions: this is used hevily to
 // establish a well-defined order for nodes during simplification in order to
 // accurately identify matching node-lists. The return-value is 0 for a match,
 // 1 for >, and -1 for <.
-int lex_cmp(unique_ptr<TreeNode>& a, unique_ptr<TreeNode>& b) {
-    enum node_type at = a->type(), bt = b->type();
+int lex_cmp(const Expr *a, const Expr *b) {
+    if(a == b) return 0; // (hash-consed)
+
+    enum node_type at = a->type, bt = b->type;
 
     // the following is mostly taken from Joel S. Cohen's book
 
     if(at == nt_num && bt == nt_num) {
-        return a->eval() == b->eval() ? 0 : a->eval() > b->eval() ? 1 : -1;
+        return a->val == b->val ? 0 : a->val > b->val ? 1 : -1;
     } else if(at == nt_num) {
         return -1;
     } else if(bt == nt_num) {
         return 1;
-    } else if(at == nt_id & bt == nt_id) {
-        string aid = a->to_string(), bid = b->to_string();
-        return aid == bid ? 0 : aid > bid ? 1 : -1;
-    } else if(at == bt && at == nt_nary_sum || at == nt_nary_product) {
-        unique_ptr<NaryOpNode> an = unique_ptr<NaryOpNode>((NaryOpNode *)a->copy().release());
-        unique_ptr<NaryOpNode> bn = unique_ptr<NaryOpNode>((NaryOpNode *)b->copy().release());
-
-        if(an->args.size() != bn->args.size()) return an->args.size() > bn->args.size() ? 1 : -1;
-
-        for(int i = 0; i < an->args.size(); i++) {
-            int cmp = lex_cmp(an->args[i], bn->args[i]);
-            if(cmp != 0) return cmp;
-        }
-
-        return 0;
+    } else if(at == nt_id && bt == nt_id) {
+        int cmp = a->name.compare(b->name);
+        return cmp == 0 ? 0 : cmp > 0 ? 1 : -1;
+    } else if(at == bt && (at == nt_nary_sum || at == nt_nary_product)) {
+        return lex_cmp_args(a, b);
     } else if(at == bt && at == nt_exponentiation) {
-        auto [ba, ea] = base_and_exp(a);
-        auto [bb, eb] = base_and_exp(b);
-
-        int cmp = lex_cmp(ba, bb);
+        int cmp = lex_cmp(a->arg(0), b->arg(0));
         if(cmp != 0) return cmp;
-        else return lex_cmp(ea, eb);
+        else return lex_cmp(a->arg(1), b->arg(1));
     } else if(at == bt && at == nt_fn_call) {
-        unique_ptr<FunctionCallNode> an = unique_ptr<FunctionCallNode>((FunctionCallNode *)a->copy().release());
-        unique_ptr<FunctionCallNode> bn = unique_ptr<FunctionCallNode>((FunctionCallNode *)b->copy().release());
+        if(a->name != b->name) return a->name > b->name ? 1 : -1;
+        return lex_cmp_args(a, b);
+    } else if(at == bt && at == nt_deriv) {
+        if(a->name != b->name) return a->name > b->name ? 1 : -1;
+        else if(a->val != b->val) return a->val > b->val ? 1 : -1;
+        return lex_cmp_args(a, b);
+    }
 
-        if(an->fn_id != bn->fn_id) return an->fn_id > bn->fn_id ? 1 : -1;
-        else if(an->args.size() != bn->args.size()) return an->args.size() > bn->args.size() ? 1 : -1;
-        for(int i = 0; i < an->args.size(); i++) {
-            int cmp = lex_cmp(an->args[i], bn->args[i]) ;
-            if(cmp != 0) return cmp;
-        }
+    // different kinds: a product is compared as if the other tree were a unary product; failing
+    // that, a power as if the other were raised to 1; failing that, a sum as if the other were a
+    // unary sum. Either operand can be the product/power/sum, so the order stays antisymmetric.
+    if(bt == nt_nary_product && at != nt_nary_product ||
+       bt == nt_exponentiation && at != nt_nary_product && at != nt_exponentiation ||
+       bt == nt_nary_sum && at != nt_nary_product && at != nt_exponentiation && at != nt_nary_sum) {
+        return -lex_cmp(b, a);
+    }
 
-        return 0;
-    } else if(at == bt && at == nt_deriv) {
-        unique_ptr<DerivativeNode> an = unique_ptr<DerivativeNode>((DerivativeNode *)a->copy().release());
-        unique_ptr<DerivativeNode> bn = unique_ptr<DerivativeNode>((DerivativeNode *)b->copy().release());
-
-        if(an->fn_id != bn->fn_id) return an->fn_id > bn->fn_id ? 1 : -1;
-        else if(an->args.size() != bn->args.size()) return an->args.size() > bn->args.size() ? 1 : -1;
-        for(int i = 0; i < an->args.size(); i++) {
-            int cmp = lex_cmp(an->args[i], bn->args[i]);
-            if(cmp != 0) return cmp;
-        }
-
-        return 0;
-    } else if(at == nt_nary_product) {
-        // cast b into a unary product, and compare from there
-        vector<unique_ptr<TreeNode>> uprod;
-        uprod.push_back(b->copy());
-        unique_ptr<TreeNode> bprod = make_unique<NaryOpNode>(std::move(uprod), "*");
-        return lex_cmp(a, bprod);
+    if(at == nt_nary_product || at == nt_nary_sum) {
+        if(a->num_args != 1) return a->num_args > 1 ? 1 : -1;
+        return lex_cmp(a->arg(0), b);
     } else if(at == nt_exponentiation) {
-        // cast b into an exponentiation, compare from there
-        unique_ptr<TreeNode> bexp = make_unique<BinaryOpNode>(b->copy(),
-                                                                  make_unique<NumberNode>(1),
-                                                                  "^");
-        return lex_cmp(a, bexp);
-    } else if(at == nt_nary_sum) {
-        // cast b into a unary sum, and compare from there
-        vector<unique_ptr<TreeNode>> usum;
-        usum.push_back(b->copy());
-        unique_ptr<TreeNode> bsum = make_unique<NaryOpNode>(std::move(usum), "+");
-        return lex_cmp(a, bsum);
+        static const Expr one {nt_num, "", 1, nullptr, 0, 0};
+
+        int cmp = lex_cmp(a->arg(0), b);
+        if(cmp != 0) return cmp;
+        else return lex_cmp(a->arg(1), &one);
     }
 
     if(at != bt) return at > bt ? 1 : -1;
 
-    switch(a->type()) {
+    switch(at) {
         // unary operators
         case nt_negation: {
-            unique_ptr<TreeNode>& arga = ((UnaryOpNode *)a.get())->arg;
-            unique_ptr<TreeNode>& argb = ((UnaryOpNode *)b.get())->arg;
-
-            return lex_cmp(arga, argb);
+            return lex_cmp(a->arg(0), b->arg(0));
         }
         // binary operators
-        case nt_exponentiation:
         case nt_sum:
         case nt_product:
         case nt_difference:
@@ -415,16 +450,10 @@ int lex_cmp(unique_ptr<TreeNode>& a, unique_ptr<TreeNode>& b) {
         case nt_gt:
         case nt_ge:
         case nt_assignment: {
-            unique_ptr<TreeNode>& lefta = ((BinaryOpNode *)a.get())->left;
-            unique_ptr<TreeNode>& leftb = ((BinaryOpNode *)b.get())->left;
-
-            unique_ptr<TreeNode>& righta = ((BinaryOpNode *)a.get())->right;
-            unique_ptr<TreeNode>& rightb = ((BinaryOpNode *)b.get())->right;
-
             int cmp;
 
-            if((cmp = lex_cmp(lefta, leftb))) return cmp;
-            else return lex_cmp(righta, rightb);
+            if((cmp = lex_cmp(a->arg(0), b->arg(0)))) return cmp;
+            else return lex_cmp(a->arg(1), b->arg(1));
         }
         default: {
             // other types should have been handled by now
@@ -434,81 +463,250 @@ int lex_cmp(unique_ptr<TreeNode>& a, unique_ptr<TreeNode>& b) {
     }
 }
 
-unique_ptr<TreeNode> symb_simp(unique_ptr<TreeNode>&& tree) {
-    unique_ptr<TreeNode> left, right, arg;
+/* ~ ~ ~ ~ ~ Like-Term Collection ~ ~ ~ ~ ~ */
+
+// Sums and products are simplified by collecting like terms in a single pass: every term is split
+// into a constant coefficient and a base (every factor into a base and an exponent), and bucketed
+// by the key of its base, so like terms meet in O(1) rather than through pairwise merges. The
+// combined terms are then sorted once (sums by descending base, products by ascending base).
+
+// groups nodes by equality under lex_cmp (that is, by key)
+struct ExprBuckets {
+    Simplifier& simplifier;
+    unordered_map<const Expr *, int> index; // key -> bucket
+    vector<const Expr *> keys; // the first node put in each bucket
+
+    ExprBuckets(Simplifier& s) : simplifier(s) { }
+
+    // returns the node's bucket, or -1 if there is none
+    int find(const Expr *e) {
+        auto found = index.find(simplifier.key(e));
+        return found != index.end() ? found->second : -1;
+    }
+
+    // returns the node's bucket, which is keys.size() - 1 if it's a new one
+    int find_or_add(const Expr *e) {
+        auto added = index.emplace(simplifier.key(e), keys.size());
+        if(added.second) keys.push_back(e);
+        return added.first->second;
+    }
+
+    // bucket indices, sorted by their keys (in descending order if descending)
+    vector<int> sorted(bool descending) {
+        vector<int> order(keys.size());
+        iota(order.begin(), order.end(), 0);
+        stable_sort(order.begin(), order.end(), [&](int a, int b) {
+            return lex_cmp(keys[a], keys[b]) == (descending ? 1 : -1);
+        });
+        return order;
+    }
+};
+
+// a simplified, non-numeric term of a sum, split into its constant coefficient and the rest
+struct SplitTerm {
+    const Expr *coef = nullptr; // nullptr for 1
+    const Expr *base;
+
+    SplitTerm(ExprTable& table, const Expr *term) : base(term) {
+        if(term->type == nt_nary_product && term->num_args >= 2 && term->arg(0)->type == nt_num) {
+            coef = term->arg(0); // (the first factor is the constant)
+            base = term->num_args == 2 ? term->arg(1) :
+                table.intern(nt_nary_product, "*", 0, term->args + 1, term->num_args - 1);
+        }
+    }
+
+    double coef_val() { return coef ? coef->val : 1; }
+
+    // the term this was split from
+    const Expr *join(ExprTable& table) {
+        if(coef == nullptr) return base;
+
+        vector<const Expr *> factors = {coef};
+        if(base->type == nt_nary_product) factors.insert(factors.end(), base->args, base->args + base->num_args);
+        else factors.push_back(base);
+        return table.nary(factors, "*");
+    }
+};
+
+// replaces any nested n-ary op_type nodes in list with their operands
+void flatten_nary(vector<const Expr *>& list, enum node_type op_type) {
+    for(int i = 0; i < list.size(); i++) {
+        if(list[i]->type != op_type) continue;
+
+        const Expr *nested = list[i];
+        list[i] = nested->arg(nested->num_args - 1);
+        list.insert(list.end(), nested->args, nested->args + nested->num_args - 1);
+        i--; // the moved-in operand may be nested too
+    }
+}
+
+// simplifies the sum of the given (simplified) terms
+const Expr *Simplifier::collect_sum(vector<const Expr *>&& terms) {
+    flatten_nary(terms, nt_nary_sum);
+
+    double constant = 0;
+    bool has_constant = false;
+    ExprBuckets buckets(*this);
+    vector<vector<SplitTerm>> like_terms;
+
+    for(const Expr *term : terms) {
+        if(term->type == nt_num) {
+            constant += term->val;
+            has_constant = true;
+            continue;
+        }
+
+        SplitTerm split(table, term);
+        int i = buckets.find_or_add(split.base);
+        if(i == like_terms.size()) like_terms.emplace_back();
+        like_terms[i].push_back(split);
+    }
+
+    vector<const Expr *> out_list;
+    bool has_nested = false;
+
+    for(int i : buckets.sorted(true)) {
+        const Expr *term;
+
+        if(like_terms[i].size() == 1) {
+            term = like_terms[i][0].join(table);
+        } else { // c1 * u + c2 * u + ... => (c1 + c2 + ...) * u
+            double coef = 0;
+            for(SplitTerm& split : like_terms[i]) coef += split.coef_val();
+            if(coef == 0) continue;
+
+            term = simp(table.nary({table.num(coef), like_terms[i][0].base}, "*"));
+        }
+
+        if(term->type == nt_nary_sum) has_nested = true;
+        out_list.push_back(term);
+    }
+
+    if(has_constant && constant != 0) out_list.push_back(table.num(constant)); // 0 + u = u
+
+    // a combined term can itself be a sum (e.g. 1 * (u + v)): collect again with its terms
+    if(has_nested) return collect_sum(std::move(out_list));
+
+    if(out_list.size() == 0) return table.num(0);
+    if(out_list.size() == 1) return out_list[0];
+    return table.nary(out_list, "+");
+}
+
+// simplifies the product of the given (simplified) factors
+const Expr *Simplifier::collect_product(vector<const Expr *>&& factors) {
+    flatten_nary(factors, nt_nary_product);
+
+    double constant = 1;
+    bool has_constant = false;
+    ExprBuckets buckets(*this);
+    vector<vector<const Expr *>> like_factors;
+
+    for(const Expr *factor : factors) {
+        if(factor->type == nt_num) { // c * k = eval(c * k)
+            constant *= factor->val;
+            has_constant = true;
+            continue;
+        }
+
+        int i = buckets.find_or_add(factor->type == nt_exponentiation ? factor->arg(0) : factor);
+        if(i == like_factors.size()) like_factors.emplace_back();
+        like_factors[i].push_back(factor);
+    }
+
+    if(has_constant && constant == 0) return table.num(0); // 0 * u = 0
+
+    // c * c^u = c^(u + 1)
+    if(has_constant && constant != 1) {
+        int i = buckets.find(table.num(constant));
+        if(i != -1) {
+            like_factors[i].push_back(table.num(constant));
+            constant = 1;
+        }
+    }
+
+    vector<const Expr *> out_list;
+    bool has_nested = false;
+
+    for(int i : buckets.sorted(false)) {
+        const Expr *factor;
+
+        if(like_factors[i].size() == 1) {
+            factor = like_factors[i][0];
+        } else { // u^a * u^b * ... => u^(a + b + ...)
+            const Expr *base = nullptr;
+            vector<const Expr *> exp_terms;
+
+            for(const Expr *f : like_factors[i]) {
+                bool is_power = f->type == nt_exponentiation;
+                if(base == nullptr) base = is_power ? f->arg(0) : f;
+                exp_terms.push_back(is_power ? f->arg(1) : table.num(1));
+            }
+
+            const Expr *exp = simp(table.nary(exp_terms, "+"));
+            factor = simp(table.binary(base, exp, "^"));
+
+            if(factor->type == nt_num) {
+                constant *= factor->val;
+                has_constant = true;
+                continue;
+            }
+        }
+
+        if(factor->type == nt_nary_product) has_nested = true;
+        out_list.push_back(factor);
+    }
 
-    if(is_binary_op(tree->type())) {
-        left = symb_simp(std::move(((BinaryOpNode *)tree.get())->left));
-        right = symb_simp(std::move(((BinaryOpNode *)tree.get())->right));
-    } else if(is_unary_op(tree->type())) {
-        arg = symb_simp(std::move(((UnaryOpNode *)tree.get())->arg));
+    if(has_constant && constant != 1) { // 1 * u = u
+        if(constant == 0) return table.num(0);
+        out_list.insert(out_list.begin(), table.num(constant));
     }
 
-    switch(tree->type()) {
+    if(has_nested) return collect_product(std::move(out_list));
+
+    if(out_list.size() == 0) return table.num(1);
+    if(out_list.size() == 1) return out_list[0];
+    return table.nary(out_list, "*");
+}
+
+const Expr *Simplifier::simp(const Expr *e) {
+    if(e->simp == nullptr) e->simp = rewrite(simp_node(e));
+    return e->simp;
+}
+
+const Expr *Simplifier::simp_node(const Expr *e) {
+    ExprTable& t = table;
+    const Expr *left = nullptr, *right = nullptr, *arg = nullptr;
+
+    if(is_binary_op(e->type)) {
+        left = simp(e->arg(0));
+        right = simp(e->arg(1));
+    } else if(is_unary_op(e->type)) {
+        arg = simp(e->arg(0));
+    }
+
+    switch(e->type) {
         /* ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ Unary Operators ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ */
         case nt_negation: { // -u => simp(-1 * u)
-            vector<unique_ptr<TreeNode>> ops;
-            ops.push_back(make_unique<NumberNode>(-1));
-            ops.push_back(std::move(arg));
-
-            return symb_simp(make_unique<NaryOpNode>(std::move(ops), "*"));
+            return simp(t.nary({t.num(-1), arg}, "*"));
         }
         /* ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ Binary Operators ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ */
         case nt_sum: { // u + v => simp(u + v)
-            vector<unique_ptr<TreeNode>> ops;
-            ops.push_back(std::move(left));
-            ops.push_back(std::move(right));
-
-            return symb_simp(make_unique<NaryOpNode>(std::move(ops), "+"));
+            return simp(t.nary({left, right}, "+"));
         }
-        case nt_difference: { // u - v => simp(u + -v)
-            vector<unique_ptr<TreeNode>> terms;
-            terms.push_back(std::move(left));
-            terms.push_back(make_unique<UnaryOpNode>(std::move(right), "-"));
-
-            return symb_simp(make_unique<NaryOpNode>(std::move(terms), "+"));
+        case nt_difference: { // u - v => simp(u + simp(-v))
+            return simp(t.nary({left, simp(t.unary(right, "-"))}, "+"));
         }
         case nt_product: { // u * v => simp(u * v)
-            vector<unique_ptr<TreeNode>> ops;
-            ops.push_back(std::move(left));
-            ops.push_back(std::move(right));
-
-            return symb_simp(make_unique<NaryOpNode>(std::move(ops), "*"));
+            return simp(t.nary({left, right}, "*"));
         }
         case nt_quotient: { // u / v => simp(u * simp(v^-1))
-            vector<unique_ptr<TreeNode>> ops;
-            ops.push_back(std::move(left));
-            ops.push_back(symb_simp(make_unique<BinaryOpNode>(std::move(right),
-                                    make_unique<NumberNode>(-1),
-                                    "^")));
-
-            return symb_simp(make_unique<NaryOpNode>(std::move(ops), "*"));
+            return simp(t.nary({left, simp(t.binary(right, t.num(-1), "^"))}, "*"));
         }
         case nt_exponentiation: {
-            if(left->type() == nt_num && right->type() == nt_num) {
-                return make_unique<NumberNode>(pow(left->eval(), right->eval()));
-            } else if(left->type() == nt_num && left->eval() == 0) { // 0^u = 0, assuming u > 0
-                return make_unique<NumberNode>(0);
-            } else if(left->type() == nt_num && left->eval() == 1) { // 1^u = 1
-                return make_unique<NumberNode>(1);
-            } else if(right->type() == nt_num && right->eval() == 1) { // u^1 = u
-                return std::move(left);
-            } else if(right->type() == nt_num && right->eval() == 0) { // u^0 = 1
-                return make_unique<NumberNode>(1);
-            } else if(left->type() == nt_exponentiation) { // (u^v)^w = u^vw
-                unique_ptr<BinaryOpNode> en = unique_ptr<BinaryOpNode>((BinaryOpNode *)left.release());
-
-                vector<unique_ptr<TreeNode>> exp_factors;
-                exp_factors.push_back(std::move(en->right));
-                exp_factors.push_back(std::move(right));
-
-                unique_ptr<TreeNode> exp = symb_simp(make_unique<NaryOpNode>(std::move(exp_factors), "*"));
-
-                return symb_simp(make_unique<BinaryOpNode>(std::move(en->left), std::move(exp), "^"));
-            } else {
-                return make_unique<BinaryOpNode>(std::move(left),
-                                                 std::move(right),
-                                                 "^");
+            if(left->type == nt_num && right->type == nt_num) {
+                return t.num(pow(left->val, right->val));
+            } else { // (identities are simplification rules: see simp_rule_sources)
+                return t.binary(left, right, "^");
             }
         }
         // u ? v => simp(u) ? simp(v)
@@ -521,465 +719,579 @@ unique_ptr<TreeNode> symb_simp(unique_ptr<TreeNode>&& tree) {
         case nt_le:
         case nt_gt:
         case nt_ge: {
-            return make_unique<BinaryOpNode>(std::move(left),
-                                             std::move(right),
-                                             ((BinaryOpNode *)tree.get())->op);
+            return t.binary(left, right, e->name);
         }
         /* ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ N-ary Operators ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ */
-        case nt_deriv: {
-            unique_ptr<DerivativeNode> der = unique_ptr<DerivativeNode>((DerivativeNode *)tree.release());
-            for(auto& arg : der->args) {
-                arg = symb_simp(std::move(arg));
-            }
-            return unique_ptr<TreeNode>((TreeNode *)der.release());
-        }
+        case nt_deriv:
         case nt_fn_call: {
-            unique_ptr<FunctionCallNode> fn = unique_ptr<FunctionCallNode>((FunctionCallNode *)tree.release());
-            for(auto& arg : fn->args) {
-                arg = symb_simp(std::move(arg));
-            }
-            return unique_ptr<TreeNode>((TreeNode *)fn.release());
+            vector<const Expr *> args;
+            for(int i = 0; i < e->num_args; i++) args.push_back(simp(e->arg(i)));
+            return t.intern(e->type, e->name, e->val, args.data(), args.size());
         }
-        case nt_nary_sum: {
+        case nt_nary_sum:
+        case nt_nary_product: {
             // assume that given terms are already simplified, but not necessarily in order
-            // (unless there are more than 2)
-            unique_ptr<NaryOpNode> nn = unique_ptr<NaryOpNode>((NaryOpNode *)tree.release());
-            if(nn->args.size() == 0) {
-                return make_unique<NumberNode>(0);
-            } else if(nn->args.size() == 1) {
-                return symb_simp(std::move(nn->args[0]));
-            } else if(nn->args.size() == 2) {
-                /* ~ ~ ~ ~ ~ Term Combination ~ ~ ~ ~ ~ */
-                auto [c0, b0] = const_and_base(nn->args[0]);
-                auto [c1, b1] = const_and_base(nn->args[1]);
-
-                int cmp;
-                if((cmp = lex_cmp(b0, b1)) == 0) {
-                    vector<unique_ptr<TreeNode>> args;
-                    args.push_back(make_unique<NumberNode>(c0->eval() + c1->eval()));
-                    args.push_back(std::move(b0));
-                    return symb_simp(make_unique<NaryOpNode>(std::move(args), "*"));
-                } else if(cmp == -1) { // terms are out of order
-                    std::swap(nn->args[0], nn->args[1]);
-                }
-
-                /* ~ ~ ~ ~ ~ Numeric Simplifications ~ ~ ~ ~ ~ */
-                if(nn->args[0]->type() == nt_num && nn->args[0]->eval() == 0) { // 0 + u = u
-                    return std::move(nn->args[1]);
-                } else if(nn->args[1]->type() == nt_num && nn->args[1]->eval() == 0) { // u + 0 = u
-                    return std::move(nn->args[0]);
-                    /* ~ ~ ~ ~ ~ Nested Sums ~ ~ ~ ~ ~ */
-                } else if(nn->args[0]->type() == nt_nary_sum && nn->args[1]->type() == nt_nary_sum) {
-                    return merge_sums(std::move(nn->args[0]), std::move(nn->args[1]));
-                } else if(nn->args[0]->type() == nt_nary_sum) {
-                    vector<unique_ptr<TreeNode>> usum; // make args[1] a unary sum to be merged
-                    usum.push_back(std::move(nn->args[1]));
-                    return merge_sums(std::move(nn->args[0]), make_unique<NaryOpNode>(std::move(usum), "+"));
-                } else if(nn->args[1]->type() == nt_nary_sum) {
-                    vector<unique_ptr<TreeNode>> usum; // make args[0] a unary sum to be merged
-                    usum.push_back(std::move(nn->args[0]));
-                    return merge_sums(std::move(nn->args[1]), make_unique<NaryOpNode>(std::move(usum), "+"));
-                } else return std::move(nn);
+            if(e->num_args == 0) {
+                return t.num(e->type == nt_nary_sum ? 0 : 1);
+            } else if(e->num_args == 1) {
+                return simp(e->arg(0));
             } else {
-                // since the original input tree only has binary sums, we can assume that
-                // any nary-sum with more than 2 elements is in lexicographical order
-                unique_ptr<TreeNode> first = std::move(nn->args[0]);
-                nn->args.erase(nn->args.begin());
-
-                if(first->type() != nt_nary_sum) { // ensure first is a sum: if not, make it unary
-                    vector<unique_ptr<TreeNode>> usum;
-                    usum.push_back(std::move(first));
-                    first = make_unique<NaryOpNode>(std::move(usum), "+");
-                }
+                vector<const Expr *> args(e->args, e->args + e->num_args);
+                if(e->type == nt_nary_sum) return collect_sum(std::move(args));
+                return collect_product(std::move(args));
+            }
+        }
+        default: {
+            return e;
+        }
+    }
+}
 
-                unique_ptr<TreeNode> rest = symb_simp(std::move(nn));
-                if(rest->type() != nt_nary_sum) { // do the same for rest
-                    vector<unique_ptr<TreeNode>> usum;
-                    usum.push_back(std::move(rest));
-                    rest = make_unique<NaryOpNode>(std::move(usum), "+");
-                }
+unique_ptr<TreeNode> simp_tree(unique_ptr<TreeNode>&& tree) {
+    ExprTable table;
+    Simplifier simplifier(table);
+    return to_tree(simplifier.simp(table.from_tree(*tree)));
+}
 
-                return merge_sums(std::move(first), std::move(rest));
+/* ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ Expansion ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ */
+
+// A simplified expression is expanded as a sparse polynomial (see poly.h): sums, products and
+// integer powers are converted to Poly operations, and every other subexpression (variables,
+// function calls, non-integer powers, powers too large to expand) becomes a generator, after its
+// own subexpressions are expanded. The polynomial is then converted back to a simplified
+// expression.
+
+struct PolyConverter {
+    Simplifier& simplifier;
+    ExprTable& table;
+    ExprBuckets buckets; // generators, by their keys
+    vector<const Expr *> generators;
+
+    PolyConverter(Simplifier& s) : simplifier(s), table(s.table), buckets(s) { }
+
+    int num_words() { return (generators.size() + POLY_LANES - 1) / POLY_LANES; }
+
+    Poly generator(const Expr *e) {
+        int gen = buckets.find_or_add(e);
+        if(gen == generators.size()) generators.push_back(e);
+        return Poly::generator(gen, num_words());
+    }
+
+    // converts a simplified expression; its non-polynomial subexpressions become generators
+    Poly from_expr(const Expr *e) {
+        switch(e->type) {
+            case nt_num: return Poly::constant(e->val, num_words());
+            case nt_nary_sum:
+            case nt_nary_product: {
+                bool is_sum = e->type == nt_nary_sum;
+                Poly result = Poly::constant(is_sum ? 0 : 1, num_words());
+
+                for(int i = 0; i < e->num_args; i++) {
+                    Poly p = from_expr(e->arg(i));
+                    result.widen(p.num_words);
+                    p.widen(result.num_words);
+
+                    if(is_sum) result += p;
+                    else result = result * p;
+                }
+                return result;
+            }
+            case nt_exponentiation: return from_power(e);
+            case nt_fn_call:
+            case nt_deriv: {
+                vector<const Expr *> args;
+                for(int i = 0; i < e->num_args; i++) args.push_back(simplifier.expand(e->arg(i)));
+                return generator(table.intern(e->type, e->name, e->val, args.data(), args.size()));
+            }
+            default: {
+                return generator(e);
             }
         }
-        case nt_nary_product: {
-            unique_ptr<NaryOpNode> nn = unique_ptr<NaryOpNode>((NaryOpNode *)tree.release());
-
-            if(nn->args.size() == 0) {
-                return make_unique<NumberNode>(1);
-            } else if(nn->args.size() == 1) {
-                return symb_simp(std::move(nn->args[0]));
-            } else if(nn->args.size() == 2) {
-                /* ~ ~ ~ ~ ~ Term Combination ~ ~ ~ ~ ~ */
-                auto [b0, e0] = base_and_exp(nn->args[0]);
-                auto [b1, e1] = base_and_exp(nn->args[1]);
-
-                int cmp;
-
-                if((cmp = lex_cmp(b0, b1)) == 0) {
-                    vector<unique_ptr<TreeNode>> exp_terms;
-                    exp_terms.push_back(std::move(e0));
-                    exp_terms.push_back(std::move(e1));
-
-                    unique_ptr<TreeNode> exp = symb_simp(make_unique<NaryOpNode>(std::move(exp_terms), "+"));
-                    return symb_simp(make_unique<BinaryOpNode>(std::move(b0), std::move(exp), "^"));
-                } else if(cmp == 1) {
-                    std::swap(nn->args[0], nn->args[1]);
-                }
+    }
 
-                /* ~ ~ ~ ~ ~ Numeric Simplifications ~ ~ ~ ~ ~ */
-                if(nn->args[0]->type() == nt_num && nn->args[1]->type() == nt_num) { // c * k = eval(c * k)
-                    return make_unique<NumberNode>(nn->args[0]->eval() * nn->args[1]->eval());
-                } else if(nn->args[0]->type() == nt_num && nn->args[0]->eval() == 1) { // 1 * u = u
-                    return std::move(nn->args[1]);
-                } else if(nn->args[1]->type() == nt_num && nn->args[1]->eval() == 1) { // u * 1 = u
-                    return std::move(nn->args[0]);
-                } else if(nn->args[0]->type() == nt_num && nn->args[0]->eval() == 0) { // 0 * u = 0
-                    return std::move(nn->args[0]);
-                } else if(nn->args[1]->type() == nt_num && nn->args[1]->eval() == 0) { // u * 0 = 0
-                    return std::move(nn->args[1]);
-                    /* ~ ~ ~ ~ ~ Nested Products ~ ~ ~ ~ ~ */
-                } else if(nn->args[0]->type() == nt_nary_product && nn->args[1]->type() == nt_nary_product) {
-                    return merge_products(std::move(nn->args[0]), std::move(nn->args[1]));
-                } else if(nn->args[0]->type() == nt_nary_product) {
-                    vector<unique_ptr<TreeNode>> uprod; // make args[1] a unary product to be merged
-                    uprod.push_back(std::move(nn->args[1]));
-
-                    return merge_products(std::move(nn->args[0]), make_unique<NaryOpNode>(std::move(uprod), "*"));
-                } else if(nn->args[1]->type() == nt_nary_product) {
-                    vector<unique_ptr<TreeNode>> uprod; // make args[0] a unary product to be merged
-                    uprod.push_back(std::move(nn->args[0]));
-
-                    return merge_products(std::move(nn->args[1]), make_unique<NaryOpNode>(std::move(uprod), "*"));
-                } else return std::move(nn);
-            } else {
-                unique_ptr<TreeNode> first = std::move(nn->args[0]);
-                nn->args.erase(nn->args.begin());
+    Poly from_power(const Expr *e) {
+        const Expr *left = e->arg(0), *right = e->arg(1);
+        double exp = right->type == nt_num ? right->val : NAN;
 
-                if(first->type() != nt_nary_product) {
-                    vector<unique_ptr<TreeNode>> uprod;
-                    uprod.push_back(std::move(first));
-                    first = make_unique<NaryOpNode>(std::move(uprod), "*");
+        if(!(exp == floor(exp) && abs(exp) <= POLY_MAX_DEGREE)) {
+            if(left->type == nt_nary_product) { // (u * v)^w => u^w * v^w
+                vector<const Expr *> factors;
+                for(int i = 0; i < left->num_args; i++) {
+                    factors.push_back(simplifier.simp(table.binary(left->arg(i), right, "^")));
                 }
+                return from_expr(simplifier.simp(table.nary(factors, "*")));
+            }
 
-                unique_ptr<TreeNode> rest = symb_simp(std::move(nn));
-                if(rest->type() != nt_nary_product) {
-                    vector<unique_ptr<TreeNode>> uprod;
-                    uprod.push_back(std::move(rest));
-                    rest = make_unique<NaryOpNode>(std::move(uprod), "*");
-                }
+            const Expr *base = simplifier.expand(left);
+            return from_simplified_power(simplifier.simp(table.binary(base, simplifier.expand(right), "^")));
+        }
+
+        Poly base = from_expr(left);
+        int n = exp, terms = base.num_nonzero_terms();
+
+        if(terms == 1 && base.max_degree * abs(exp) <= POLY_MAX_DEGREE) { // (c * u^v)^n = c^n * u^vn
+            return base.pow(n);
+        } else if(terms > 1 && abs(exp) <= get_id_value("INT_POWER_EXPANSION_THRESHOLD") &&
+                  multinomial_size(terms, abs(n)) <= get_id_value("POLY_EXPANSION_THRESHOLD") &&
+                  base.max_degree * abs(exp) <= POLY_MAX_DEGREE) {
+            if(n >= 0) return base.pow(n);
+
+            // (u + v)^-n => expand((u + v)^n)^-1
+            Poly power = base.pow(-n);
+            return from_simplified_power(simplifier.simp(table.binary(to_expr(power), table.num(-1), "^")));
+        }
+
+        // too large to expand: keep the (expanded) power
+        return from_simplified_power(simplifier.simp(table.binary(to_expr(base), right, "^")));
+    }
+
+    // a power that can't be expanded is a generator (unless it simplified to something else)
+    Poly from_simplified_power(const Expr *power) {
+        if(power->type == nt_exponentiation) return generator(power);
+        else return from_expr(power);
+    }
+
+    // builds the simplified expression of p
+    const Expr *to_expr(Poly& p) {
+        vector<int> order = buckets.sorted(false); // (the order of factors in a simplified product)
+
+        // generators that are powers can combine with each other (u^v * u^w), so the terms of
+        // p aren't necessarily simplified
+        bool has_powers = false;
+        for(const Expr *gen : generators) if(gen->type == nt_exponentiation) has_powers = true;
+
+        double constant = 0;
+        vector<double> coefs;
+        vector<const Expr *> bases;
+
+        for(int t = 0; t < p.num_terms(); t++) {
+            if(p.coefs[t] == 0) continue;
 
-                return merge_products(std::move(first), std::move(rest));
+            vector<const Expr *> factors;
+            for(int gen : order) {
+                int exp = gen < p.num_words * POLY_LANES ? p.exponent(t, gen) : 0;
+                if(exp == 0) continue;
+
+                const Expr *factor = generators[gen];
+                if(exp != 1) factor = table.binary(factor, table.num(exp), "^");
+                if(exp != 1 && has_powers) factor = simplifier.simp(factor); // (u^v)^n => u^vn
+                factors.push_back(factor);
+            }
+
+            if(factors.empty()) {
+                constant += p.coefs[t];
+                continue;
             }
+
+            coefs.push_back(p.coefs[t]);
+            bases.push_back(factors.size() == 1 ? factors[0] : table.nary(factors, "*"));
         }
-        default: {
-            return std::move(tree);
+
+        vector<const Expr *> terms;
+        if(has_powers) {
+            for(int i = 0; i < bases.size(); i++) {
+                terms.push_back(simplifier.simp(table.nary({table.num(coefs[i]), bases[i]}, "*")));
+            }
+            terms.push_back(table.num(constant));
+            return simplifier.simp(table.nary(terms, "+"));
         }
+
+        // like collect_sum: terms by descending base, then the constant
+        vector<int> term_order(bases.size());
+        iota(term_order.begin(), term_order.end(), 0);
+        stable_sort(term_order.begin(), term_order.end(), [&](int a, int b) {
+            return lex_cmp(bases[a], bases[b]) == 1;
+        });
+
+        for(int i : term_order) {
+            const Expr *term = bases[i];
+
+            if(coefs[i] != 1) {
+                vector<const Expr *> factors = {table.num(coefs[i])};
+                if(term->type == nt_nary_product) factors.insert(factors.end(), term->args, term->args + term->num_args);
+                else factors.push_back(term);
+                term = table.nary(factors, "*");
+            }
+            terms.push_back(term);
+        }
+        if(constant != 0) terms.push_back(table.num(constant));
+
+        if(terms.size() == 0) return table.num(0);
+        if(terms.size() == 1) return terms[0];
+        return table.nary(terms, "+");
     }
+};
+
+// expands a simplified expression
+const Expr *Simplifier::expand(const Expr *e) {
+    PolyConverter converter(*this);
+    Poly p = converter.from_expr(e);
+    return converter.to_expr(p);
+}
+unique_ptr<TreeNode> expand_tree(unique_ptr<TreeNode>&& tree) {
+    ExprTable table;
+    Simplifier simplifier(table);
+    return to_tree(simplifier.expand(simplifier.simp(table.from_tree(*tree))));
 }
 
-// separates the constant factor from a term, and returns a (constant_factor, rest) pair
-pair<unique_ptr<TreeNode>, unique_ptr<TreeNode>> const_and_base(unique_ptr<TreeNode>& node) {
-    if(node->type() == nt_num)
-        return pair<unique_ptr<TreeNode>, unique_ptr<TreeNode>>(node->copy().release(),
-                unique_ptr<TreeNode>(new NumberNode(1)));
-    if(node->type() != nt_nary_product)
-        return pair<unique_ptr<TreeNode>, unique_ptr<TreeNode>>(unique_ptr<TreeNode>(new NumberNode(1)),
-                node->copy().release());
+/* ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ Rewrite Rules ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ */
 
-    unique_ptr<NaryOpNode> nn = unique_ptr<NaryOpNode>((NaryOpNode *)node->copy().release());
-    if(nn->args.size() == 0)
-        return pair<unique_ptr<TreeNode>, unique_ptr<TreeNode>>(unique_ptr<TreeNode>(new NumberNode(1)),
-                                                                unique_ptr<TreeNode>(new NumberNode(1)));
-    else if(nn->args[0]->type() != nt_num) // assume that first is constant, because node is simplified
-        return pair<unique_ptr<TreeNode>, unique_ptr<TreeNode>>(unique_ptr<TreeNode>(new NumberNode(1)),
-                                                                unique_ptr<TreeNode>(nn.release()));
+// built-in rules (pattern, replacement); users can add more with the rule and deriv_rule macros
+const char *simp_rule_sources[][2] = {
+    {"0^_u", "0"}, // assuming u > 0
+    {"1^_u", "1"},
+    {"_u^1", "_u"},
+    {"_u^0", "1"},
+    {"(_u^_v)^_w", "_u^(_v * _w)"},
+};
 
-    // first factor is the constant factor
-    unique_ptr<TreeNode> factor = std::move(nn->args[0]);
-    nn->args.erase(nn->args.begin());
+const char *deriv_rule_sources[][2] = { // (see Differentiator)
+    {"_u + _v", "_du + _dv"},
+    {"_u - _v", "_du + -_dv"},
+    {"-_u", "-_du"},
+    {"_u * _v", "_du * _v + _dv * _u"},
+    {"_u / _v", "_du * _v^-1 + _v^-1 * (0 * ln(_v) + _dv / _v * -1) * _u"}, // d(u * v^-1)
+    {"_u ^ _v", "_u^_v * (_dv * ln(_u) + _du / _u * _v)"},
+    {"ln(_u)", "_du / _u"},
+    {"sin(_u)", "cos(_u) * _du"},
+    {"cos(_u)", "-(sin(_u) * _du)"},
+    {"tan(_u)", "sec(_u)^2 * _du"},
+    {"csc(_u)", "-(csc(_u) * cot(_u) * _du)"},
+    {"sec(_u)", "sec(_u) * tan(_u) * _du"},
+    {"cot(_u)", "-(csc(_u)^2 * _du)"},
+    {"asin(_u)", "(1 - _u^2)^(-1/2) * _du"},
+    {"acos(_u)", "-((1 - _u^2)^(-1/2) * _du)"},
+    {"atan(_u)", "_du / (1 + _u^2)"},
+};
 
-    return pair<unique_ptr<TreeNode>, unique_ptr<TreeNode>>(std::move(factor),
-                                                            symb_simp(unique_ptr<TreeNode>(nn.release())));
+void init_cas_rules() {
+    ctx->simp_rules = make_unique<RuleSet>();
+    for(auto& source : simp_rule_sources) add_rule(*ctx->simp_rules, source[0], source[1]);
+
+    ctx->deriv_rules = make_unique<RuleSet>();
+    for(auto& source : deriv_rule_sources) add_rule(*ctx->deriv_rules, source[0], source[1]);
 }
 
-pair<unique_ptr<TreeNode>, unique_ptr<TreeNode>> base_and_exp(unique_ptr<TreeNode>& node) {
-    if(node->type() != nt_exponentiation)
-        return pair<unique_ptr<TreeNode>, unique_ptr<TreeNode>>(node->copy().release(),
-                unique_ptr<TreeNode>(new NumberNode(1)));
+constexpr int MAX_REWRITE_DEPTH = 256; // nested rewrites, before the rules are assumed to loop
+
+thread_local int rewrite_depth = 0;
+
+struct RewriteScope {
+    RewriteScope() {
+        if(++rewrite_depth > MAX_REWRITE_DEPTH) {
+            rewrite_depth--;
+            throw invalid_expression_error("simplification rules don't terminate");
+        }
+    }
+    ~RewriteScope() { rewrite_depth--; }
+};
+
+
+// rewrites a simplified expression by the simplification rule that matches it, if any (the
+// result is simplified again, so its subexpressions may be rewritten in turn)
+const Expr *Simplifier::rewrite(const Expr *e) {
+    ExprBindings bindings;
+    const Rule *rule = ctx->simp_rules ? ctx->simp_rules->match(e, bindings) : nullptr;
+    if(rule == nullptr) return e;
+
+    RewriteScope scope;
+    return simp(instantiate(rule->replacement, bindings));
+}
 
-    unique_ptr<BinaryOpNode> bn = unique_ptr<BinaryOpNode>((BinaryOpNode *)node->copy().release());
+// builds a rule's replacement from the subexpressions its pattern matched
+const Expr *Simplifier::instantiate(const Expr *e, const ExprBindings& bindings) {
+    if(is_pattern_var(e)) {
+        const Expr *bound = find_binding(bindings, e->name);
+        if(bound != nullptr) return bound;
+    }
 
-    return pair<unique_ptr<TreeNode>, unique_ptr<TreeNode>>(std::move(bn->left), std::move(bn->right));
+    vector<const Expr *> args;
+    for(int i = 0; i < e->num_args; i++) args.push_back(instantiate(e->arg(i), bindings));
+    return table.intern(e->type, e->name, e->val, args.data(), args.size());
 }
 
-// merges and simplifies two lists of nodes under a single nary operator
-vector<unique_ptr<TreeNode>> merge_nary_lists(vector<unique_ptr<TreeNode>>&& a,
-                                              vector<unique_ptr<TreeNode>>&& b,
-                                              string op,
-                                              enum node_type op_type) {
-    vector<unique_ptr<TreeNode>> out_list;
-    int ai = 0, bi = 0;
+/* ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ Memo Tables ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ */
 
-    if(a.size() == 0) return b;
-    if(b.size() == 0) return a;
+// The outermost deriv, simp and expand calls are memoized per context: a repeated command, or a
+// graph/deriv with AUTO_SIMP of something already simplified, gets a copy of the earlier result.
+// Inputs and results are stored as compact byte encodings (encode_tree), so a miss costs two
+// appends to a string rather than two heap copies of trees, and inputs are matched exactly (the
+// structural keys would also match lex_cmp-equal trees like u and u^1, which can differentiate
+// differently). Entries are evicted least recently used first. A derivative also depends on the
+// differential, PARTIAL and the user functions it inlines: the first two are part of its key,
+// and the tables are cleared when a function is assigned.
 
-    // do merge-sort-like routine to maintain sorted order of lists and
-    // attempt to simplify matching terms along the way (hopefully combinable
-    // nodes are adjacent when placed in order)
+constexpr int CAS_CACHE_MAX_ENTRIES = 256;
+constexpr size_t CAS_CACHE_MAX_BYTES = 1 << 22; // (of keys and results together)
 
-    while(ai < a.size() && bi < b.size()) {
-        // try to merge a[ai] and b[bi]
-        vector<unique_ptr<TreeNode>> args;
-        args.push_back(a[ai]->copy());
-        args.push_back(b[bi]->copy());
+template<typename T>
+void append_raw(string& out, T val) {
+    out.append((const char *) &val, sizeof(T));
+}
 
-        unique_ptr<TreeNode> _c = symb_simp(make_unique<NaryOpNode>(std::move(args), op));
+template<typename T>
+T read_raw(const char *& pos) {
+    T val;
+    memcpy(&val, pos, sizeof(T));
+    pos += sizeof(T);
+    return val;
+}
 
-        if(_c->type() != op_type) {
-            ai++, bi++;
+void append_code_string(string& out, const string& str) {
+    append_raw<int32_t>(out, str.size());
+    out += str;
+}
 
-            if(_c->type() == nt_num && op_type == nt_nary_sum && _c->eval() == 0);
-            else if(_c->type() == nt_num && op_type == nt_nary_product && _c->eval() == 1);
-            else if(_c->type() == nt_num && op_type == nt_nary_product && _c->eval() == 0)
-                return vector<unique_ptr<TreeNode>>();
-            else {
-                // _c fall anywhere in out_list in lexicographical order, and it might
-                // be combinable with any element of out-list; recursively call merge_nary_lists
-                // on _c and out_list to get an updated out_list.
-                vector<unique_ptr<TreeNode>> c_list;
-                c_list.push_back(std::move(_c));
-                out_list = merge_nary_lists(std::move(c_list), std::move(out_list), op, op_type);
-            }
-        } else {
-            unique_ptr<NaryOpNode> c = unique_ptr<NaryOpNode>((NaryOpNode *)_c.release());
-            assert(c->args.size() == 2); // c must be exactly equal to {a[ai], b[bi]} or
-                                         // {b[bi], a[ai]}, because neither element can be a
-                                         // product (both are simplfied, and simplified nodes cannot
-                                         // contain nested nary operators of the same type)
+string read_code_string(const char *& pos) {
+    int32_t size = read_raw<int32_t>(pos);
+    pos += size;
+    return string(pos - size, size);
+}
 
-            // take the smaller element of c and add it into out_list, leaving the other
-            // one in its respective list (this is following the merge-sort routine)
+void encode_args(string& out, vector<unique_ptr<TreeNode>>& args) {
+    append_raw<int32_t>(out, args.size());
+    for(auto& arg : args) encode_tree(out, *arg);
+}
 
-            unique_ptr<TreeNode>& to_ins = c->args[0];
+vector<unique_ptr<TreeNode>> decode_args(const char *& pos) {
+    vector<unique_ptr<TreeNode>> args(read_raw<int32_t>(pos));
+    for(auto& arg : args) arg = decode_tree(pos);
+    return args;
+}
 
-            if(lex_cmp(to_ins, a[ai]) == 0) {
-                ai++;
-            } else if(lex_cmp(to_ins, b[bi]) == 0) {
-                bi++;
-            } else assert(false);
+void encode_tree(string& out, TreeNode& tree) {
+    enum node_type type = tree.type();
+    append_raw<uint8_t>(out, type);
 
-            out_list.push_back(std::move(to_ins));
+    switch(type) {
+        case nt_num: append_raw<double>(out, ((NumberNode&) tree).val); break;
+        case nt_id: append_code_string(out, ((VariableNode&) tree).id); break;
+        case nt_fn_call: {
+            FunctionCallNode& fn = (FunctionCallNode&) tree;
+            append_code_string(out, fn.fn_id);
+            encode_args(out, fn.args);
+            break;
+        }
+        case nt_deriv: {
+            DerivativeNode& der = (DerivativeNode&) tree;
+            append_code_string(out, der.fn_id);
+            append_raw<int32_t>(out, der.nth_deriv);
+            encode_args(out, der.args);
+            break;
+        }
+        case nt_negation: {
+            UnaryOpNode& un = (UnaryOpNode&) tree;
+            append_code_string(out, un.op);
+            encode_tree(out, *un.arg);
+            break;
+        }
+        case nt_nary_sum:
+        case nt_nary_product: encode_args(out, ((NaryOpNode&) tree).args); break;
+        default: {
+            BinaryOpNode& bn = (BinaryOpNode&) tree;
+            append_code_string(out, bn.op);
+            encode_tree(out, *bn.left);
+            encode_tree(out, *bn.right);
+            break;
         }
     }
+}
+
+unique_ptr<TreeNode> decode_tree(const char *& pos) {
+    enum node_type type = (enum node_type) read_raw<uint8_t>(pos);
+
+    switch(type) {
+        case nt_num: return make_unique<NumberNode>(read_raw<double>(pos));
+        case nt_id: return make_unique<VariableNode>(read_code_string(pos));
+        case nt_fn_call: {
+            string fn_id = read_code_string(pos);
+            return make_unique<FunctionCallNode>(fn_id, decode_args(pos));
+        }
+        case nt_deriv: {
+            string fn_id = read_code_string(pos);
+            int nth_deriv = read_raw<int32_t>(pos);
+            return make_unique<DerivativeNode>(fn_id, decode_args(pos), nth_deriv);
+        }
+        case nt_negation: {
+            string op = read_code_string(pos);
+            return make_unique<UnaryOpNode>(decode_tree(pos), op);
+        }
+        case nt_nary_sum:
+        case nt_nary_product: return make_unique<NaryOpNode>(decode_args(pos), type == nt_nary_sum ? "+" : "*");
+        default: {
+            string op = read_code_string(pos);
+            unique_ptr<TreeNode> left = decode_tree(pos);
+            return make_unique<BinaryOpNode>(std::move(left), decode_tree(pos), op);
+        }
+    }
+}
 
-    while(ai != a.size()) out_list.push_back(std::move(a[ai++]));
-    while(bi != b.size()) out_list.push_back(std::move(b[bi++]));
+void CasCache::clear() {
+    index.clear();
+    entries.clear();
+    num_bytes = 0;
+}
 
-    return out_list;
+void CasCache::evict_last() {
+    CasMemoEntry& last = entries.back();
+    index.erase(last.key);
+    num_bytes -= last.key.size() + last.result.size();
+    entries.pop_back();
 }
 
-unique_ptr<TreeNode> merge_sums(unique_ptr<TreeNode>&& _a, unique_ptr<TreeNode>&& _b) {
-    assert(_a->type() == nt_nary_sum && _b->type() == nt_nary_sum);
-    unique_ptr<NaryOpNode> a = unique_ptr<NaryOpNode>((NaryOpNode *)_a.release());
-    unique_ptr<NaryOpNode> b = unique_ptr<NaryOpNode>((NaryOpNode *)_b.release());
+// returns compute(tree), or a copy of its result for an identical earlier input
+unique_ptr<TreeNode> cas_memo(enum cas_op op, const string& options, unique_ptr<TreeNode>&& tree,
+                              const function<unique_ptr<TreeNode>(unique_ptr<TreeNode>&&)>& compute) {
+    if(ctx->cas_cache == nullptr) ctx->cas_cache = make_unique<CasCache>();
+    CasCache& cache = *ctx->cas_cache;
+
+    string key;
+    append_raw<uint8_t>(key, op);
+    append_code_string(key, options);
+    encode_tree(key, *tree);
+
+    auto found = cache.index.find(key);
+    if(found != cache.index.end()) {
+        cache.entries.splice(cache.entries.begin(), cache.entries, found->second);
+        cache.stats.hits[op]++;
+        const char *pos = found->second->result.data();
+        return decode_tree(pos);
+    }
+
+    cache.stats.misses[op]++;
+    unique_ptr<TreeNode> result = compute(std::move(tree));
+
+    string result_code;
+    encode_tree(result_code, *result);
+    size_t num_bytes = key.size() + result_code.size();
+
+    if(num_bytes <= CAS_CACHE_MAX_BYTES) {
+        cache.entries.push_front(CasMemoEntry {std::move(key), std::move(result_code)});
+        cache.index.emplace(cache.entries.front().key, cache.entries.begin());
+        cache.num_bytes += num_bytes;
 
-    vector<unique_ptr<TreeNode>> out_list = merge_nary_lists(std::move(a->args),
-                                                             std::move(b->args),
-                                                             "+", nt_nary_sum);
+        while(cache.entries.size() > CAS_CACHE_MAX_ENTRIES || cache.num_bytes > CAS_CACHE_MAX_BYTES)
+            cache.evict_last();
+    }
 
-    if(out_list.size() == 0) return make_unique<NumberNode>(0);
-    if(out_list.size() == 1) return std::move(out_list[0]);
-    else return make_unique<NaryOpNode>(std::move(out_list), "+");
+    return result;
 }
 
-unique_ptr<TreeNode> merge_products(unique_ptr<TreeNode>&& _a, unique_ptr<TreeNode>&& _b) {
-    assert(_a->type() == nt_nary_product && _b->type() == nt_nary_product);
-    unique_ptr<NaryOpNode> a = unique_ptr<NaryOpNode>((NaryOpNode *)_a.release());
-    unique_ptr<NaryOpNode> b = unique_ptr<NaryOpNode>((NaryOpNode *)_b.release());
+unique_ptr<TreeNode> symb_deriv(unique_ptr<TreeNode>&& tree) {
+    string options = ctx->diff_id + (ctx->is_partial ? " (partial)" : "");
+    return cas_memo(cas_deriv, options, std::move(tree), deriv_tree);
+}
 
-    vector<unique_ptr<TreeNode>> out_list = merge_nary_lists(std::move(a->args),
-                                                             std::move(b->args),
-                                                             "*", nt_nary_product);
+vector<vector<unique_ptr<TreeNode>>> symb_jacobian(vector<unique_ptr<TreeNode>>&& trees,
+                                                   const vector<string>& ids) {
+    ExprTable table; // shared by every output
+    Differentiator differentiator(table);
 
-    if(out_list.size() == 0) return make_unique<NumberNode>(1);
-    if(out_list.size() == 1) return std::move(out_list[0]);
-    else return make_unique<NaryOpNode>(std::move(out_list), "*");
+    vector<vector<unique_ptr<TreeNode>>> jacobian;
+    for(auto& tree : trees) {
+        jacobian.emplace_back();
+        for(const Expr *partial : differentiator.gradient(table.from_tree(*tree), ids))
+            jacobian.back().push_back(to_tree(partial));
+    }
+    return jacobian;
 }
 
-/* ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ Expansion ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ */
+unique_ptr<TreeNode> symb_simp(unique_ptr<TreeNode>&& tree) {
+    return cas_memo(cas_simp, "", std::move(tree), simp_tree);
+}
 
-unique_ptr<TreeNode> symb_expand(unique_ptr<TreeNode>&& tree, bool is_simplified) {
-    if(!is_simplified) tree = symb_simp(std::move(tree));
+unique_ptr<TreeNode> symb_expand(unique_ptr<TreeNode>&& tree) {
+    string options = to_string(get_id_value("INT_POWER_EXPANSION_THRESHOLD")) + " " +
+                     to_string(get_id_value("POLY_EXPANSION_THRESHOLD"));
+    return cas_memo(cas_expand, options, std::move(tree), expand_tree);
+}
 
-    function<unique_ptr<TreeNode>(unique_ptr<TreeNode>&&)> lambda = [&](auto node) {
-        unique_ptr<TreeNode> result;
+CasCacheStats cas_cache_stats(CalcContext& c) {
+    CasCacheStats stats;
+    if(c.cas_cache) {
+        stats = c.cas_cache->stats;
+        stats.entries = c.cas_cache->entries.size();
+    }
+    return stats;
+}
 
-        if(node->type() == nt_nary_product) {
-            unique_ptr<NaryOpNode> nn = unique_ptr<NaryOpNode>((NaryOpNode *)node.release());
-            bool found_sum = false;
+/* ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ Pretty Tree ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ */
 
-            for(int i = 0; i < nn->args.size(); i++) {
-                if(nn->args[i]->type() == nt_nary_sum) {
-                    unique_ptr<NaryOpNode> sn = unique_ptr<NaryOpNode>((NaryOpNode *)nn->args[i].release());
-                    nn->args.erase(nn->args.begin() + i);
-                    node = nn->args.size() == 1 ? std::move(nn->args[0]) : std::move(nn);
-                    vector<unique_ptr<TreeNode>> terms;
+bool is_number(const Expr *e, double val) {
+    return e->type == nt_num && e->val == val;
+}
 
-                    for(auto& term : sn->args) {
-                        terms.push_back(symb_expand(make_unique<BinaryOpNode>(std::move(term), node->copy(), "*")));
-                    }
+// is e a negative number or negation?
+bool is_negative(const Expr *e) {
+    return e->type == nt_num && e->val < 0 ||
+           e->type == nt_negation;
+}
 
-                    if(terms.size() == 1) result = std::move(terms[0]);
-                    else result = symb_simp(make_unique<NaryOpNode>(std::move(terms), "+"));
-                    found_sum = true;
-                    break;
-                }
-            }
+// the negation of a negative-number/negation node
+const Expr *negate_negative(ExprTable& table, const Expr *e) {
+    assert(is_negative(e));
+    return e->type == nt_num ? table.num(-e->val) : e->arg(0);
+}
 
-            if(!found_sum) // no factor is a sum: return the product as-is.
-                result = std::move(nn);
-        } else if(node->type() == nt_exponentiation) {
-            unique_ptr<BinaryOpNode> bn = unique_ptr<BinaryOpNode>((BinaryOpNode *)node.release());
-            if(bn->left->type() == nt_nary_sum &&
-               bn->right->type() == nt_num &&
-               int(bn->right->eval()) == bn->right->eval() &&
-               abs(bn->right->eval()) <= get_id_value("INT_POWER_EXPANSION_THRESHOLD")) {
-                int exp = bn->right->eval();
+// converts a simplified expression into a "readable" one (adds quotients/negations/subtractions
+// where appropriate); each distinct subexpression is converted once
+const Expr *pretty_expr(ExprTable& t, const Expr *e, unordered_map<const Expr *, const Expr *>& done) {
+    if(e->num_args == 0) return e;
 
-                vector<unique_ptr<TreeNode>> terms;
+    auto found = done.find(e);
+    if(found != done.end()) return found->second;
 
-                for(int i = 0; i < abs(exp); i++) {
-                    terms.push_back(bn->left->copy());
-                }
+    vector<const Expr *> args;
+    for(int i = 0; i < e->num_args; i++) args.push_back(pretty_expr(t, e->arg(i), done));
+    const Expr *result = t.intern(e->type, e->name, e->val, args.data(), args.size());
 
-                unique_ptr<TreeNode> prod = make_unique<NaryOpNode>(std::move(terms), "*");
-                if(exp < 0) result = make_unique<BinaryOpNode>(make_unique<NumberNode>(1),
-                                                               std::move(prod),
-                                                               "/");
-                else result = std::move(prod);
-
-                result = lambda(std::move(result));
-            } else if(bn->left->type() == nt_nary_product) {
-                unique_ptr<NaryOpNode> nn = unique_ptr<NaryOpNode>((NaryOpNode *)bn->left.release());
-
-                vector<unique_ptr<TreeNode>> terms;
-                for(auto& term : nn->args) {
-                    terms.push_back(symb_expand(make_unique<BinaryOpNode>(std::move(term),
-                                                                          bn->right->copy(),
-                                                                          "^")));
-                }
+    if(e->type == nt_product) {
+        const Expr *left = args[0], *right = args[1];
 
-                result = symb_expand(make_unique<NaryOpNode>(std::move(terms), "*"));
-            } else result = std::move(bn);
-        } else result = std::move(node);
+        if(is_number(left, -1)) { // negation
+            result = t.unary(right, "-");
+        } else if(left->type == nt_quotient && right->type == nt_quotient) { // a/b * c/d => a * c / (b * d)
+            const Expr *ll = left->arg(0), *rl = right->arg(0), *numer;
 
-        return result;
-    };
+            if(is_number(ll, 1)) numer = rl;
+            else if(is_number(rl, 1)) numer = ll;
+            else numer = t.binary(ll, rl, "*");
 
-    return tree->exe_on_children(std::move(tree), lambda);
-}
+            result = t.binary(numer, t.binary(left->arg(1), right->arg(1), "*"), "/");
+        } else if(left->type == nt_quotient || right->type == nt_quotient) { // a/b * c => a * c / b
+            if(right->type == nt_quotient) swap(left, right);
+            const Expr *numer;
 
-/* ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ Pretty Tree ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ */
+            if(is_number(left->arg(0), 1)) numer = right;
+            else if(is_number(right, 1)) numer = left->arg(0);
+            else numer = t.binary(left->arg(0), right, "*");
 
-// is tree a negative number or negation?
-bool tree_is_negative(unique_ptr<TreeNode>& tree) {
-    return tree->type() == nt_num && tree->eval() < 0 ||
-           tree->type() == nt_negation;
-}
+            result = t.binary(numer, left->arg(1), "/");
+        }
+    } else if(e->type == nt_exponentiation) {
+        const Expr *base = args[0], *exp = args[1];
 
-// negate a negative-number/negation tree in-place
-void negate_negated_tree(unique_ptr<TreeNode>& tree) {
-    if(tree->type() == nt_num) {
-        ((NumberNode *)tree.get())->val *= -1;
-    } else if(tree->type() == nt_negation) {
-        tree = std::move(((UnaryOpNode *)tree.get())->arg);
-    } else assert(false);
+        if(is_negative(exp)) { // u^-v => 1 / u^v
+            const Expr *denom = is_number(exp, -1) ? base : t.binary(base, negate_negative(t, exp), "^");
+            result = t.binary(t.num(1), denom, "/");
+        }
+    } else if(e->type == nt_sum) {
+        const Expr *left = args[0], *right = args[1];
+
+        if(is_negative(left) && is_negative(right)) { // -u + -v => -(u + v)
+            result = t.unary(t.binary(negate_negative(t, left), negate_negative(t, right), "+"), "-");
+        } else if(is_negative(left) || is_negative(right)) { // -u + v => v - u
+            if(is_negative(left)) swap(left, right);
+            result = t.binary(left, negate_negative(t, right), "-");
+        }
+    }
+
+    done[e] = result;
+    return result;
 }
 
-// converts simplified trees into "readable" trees (adds
-// quotients/negations/subtractions where appropriate)
 unique_ptr<TreeNode> pretty_tree(unique_ptr<TreeNode>&& tree) {
-    return tree->exe_on_children(std::move(tree), [](auto node) {
-            if(node->type() != nt_product        &&
-               node->type() != nt_exponentiation &&
-               node->type() != nt_sum) return node;
-
-            unique_ptr<BinaryOpNode> bn = unique_ptr<BinaryOpNode>((BinaryOpNode *)node.release());
-            unique_ptr<TreeNode> result;
-
-            if(bn->type() == nt_product) {
-                if(bn->left->type() == nt_num && bn->left->eval() == -1) { // negation
-                    result = make_unique<UnaryOpNode>(std::move(bn->right), "-");
-                } else if(bn->left->type() == nt_quotient && bn->right->type() == nt_quotient) {
-                    unique_ptr<TreeNode> numer, denom, ll, lr, rl, rr;
-                    unique_ptr<BinaryOpNode> left, right;
-
-                    left = unique_ptr<BinaryOpNode>((BinaryOpNode *)bn->left.release());
-                    right = unique_ptr<BinaryOpNode>((BinaryOpNode *)bn->right.release());
-                    ll = unique_ptr<TreeNode>(left->left.release());
-                    lr = unique_ptr<TreeNode>(left->right.release());
-                    rl = unique_ptr<TreeNode>(right->left.release());
-                    rr = unique_ptr<TreeNode>(right->right.release());
-
-                    if(ll->type() == nt_num && ll->eval() == 1)
-                        numer = std::move(rl);
-                    else if(rl->type() == nt_num && rl->eval() == 1)
-                        numer = std::move(ll);
-                    else
-                        numer = make_unique<BinaryOpNode>(std::move(ll), std::move(rl), "*");
-
-                    denom = make_unique<BinaryOpNode>(std::move(lr), std::move(rr), "*");
-                    result = make_unique<BinaryOpNode>(std::move(numer), std::move(denom), "/");
-                } else if(bn->left->type() == nt_quotient || bn->right->type() == nt_quotient) {
-                    if(bn->right->type() == nt_quotient) std::swap(bn->left, bn->right);
-                    unique_ptr<BinaryOpNode> left = unique_ptr<BinaryOpNode>((BinaryOpNode *)bn->left.release());
-                    unique_ptr<TreeNode> numer, denom;
-
-                    if(left->left->type() == nt_num && left->left->eval() == 1)
-                        numer = std::move(bn->right);
-                    else if(bn->right->type() == nt_num && bn->right->eval() == 1)
-                        numer = std::move(left->left);
-                    else
-                        numer = make_unique<BinaryOpNode>(std::move(left->left), std::move(bn->right), "*");
-
-                    denom = std::move(left->right);
-                    result = make_unique<BinaryOpNode>(std::move(numer), std::move(denom), "/");
-                } else {
-                    result = unique_ptr<TreeNode>((TreeNode *)bn.release());
-                }
-            } else if(bn->type() == nt_exponentiation) {
-                if(tree_is_negative(bn->right)) {
-                    unique_ptr<TreeNode> resl = make_unique<NumberNode>(1), resr;
-
-                    if(bn->right->type() == nt_num && bn->right->eval() == -1) {
-                        resr = std::move(bn->left);
-                    } else {
-                        negate_negated_tree(bn->right);
-                        resr = make_unique<BinaryOpNode>(std::move(bn->left),
-                                                         std::move(bn->right),
-                                                         "^");
-                    }
-
-                    result = make_unique<BinaryOpNode>(std::move(resl), std::move(resr), "/");
-
-                } else {
-                    result = unique_ptr<TreeNode>((TreeNode *)bn.release());
-                }
-            } else if(bn->type() == nt_sum) {
-                if(tree_is_negative(bn->left) && tree_is_negative(bn->right)) {
-                    negate_negated_tree(bn->left);
-                    negate_negated_tree(bn->right);
-                    result = make_unique<UnaryOpNode>(std::move(bn), "-");
-                } else if(tree_is_negative(bn->left) || tree_is_negative(bn->right)) {
-                    if(tree_is_negative(bn->left)) std::swap(bn->left, bn->right);
-                    negate_negated_tree(bn->right);
-                    result = make_unique<BinaryOpNode>(std::move(bn->left), std::move(bn->right), "-");
-                } else {
-                    result = unique_ptr<TreeNode>((TreeNode *)bn.release());
-                }
-            } else assert(false);
-
-            return result;
-        });
+    ExprTable table;
+    unordered_map<const Expr *, const Expr *> done;
+    return to_tree(pretty_expr(table, table.from_tree(*tree), done));
 }
@@ -3,21 +3,98 @@
 
 #include "backend.h"
 
-// symbolic derivative options
-extern string diff_id;
-extern bool is_partial;
+// This structure is only used during symbolic simplification;
+// binarize(tree) should be called to convert this back to binary
+// operations on a simplified tree before further operations
+struct NaryOpNode : TreeNode {
+    vector<unique_ptr<TreeNode>> args;
+    string op;
+
+    NaryOpNode(vector<unique_ptr<TreeNode>>&& a, string o):
+        args(std::move(a)),
+        op(o) {
+            assert(o == "+" || o == "*"); // only addition or multiplication
+        }
+
+    enum node_type type() override {
+        if(op == "+") return nt_nary_sum;
+        else if(op == "*") return nt_nary_product;
+        else throw calculator_error("internal error: invalid operator for nary operator");
+    }
+
+    unique_ptr<TreeNode> exe_on_children(unique_ptr<TreeNode>&& self, macro_fn fn) override {
+        for(auto& arg : args) arg = arg->exe_on_children(std::move(arg), fn);
+        return fn(std::move(self));
+    }
+
+    unique_ptr<TreeNode> clone() override {
+        vector<unique_ptr<TreeNode>> args_copy;
+        for(auto& arg : args) {
+            args_copy.push_back(arg->copy());
+        }
+
+        return make_unique<NaryOpNode>(std::move(args_copy), op);
+    }
+
+    void append_string(string& out, enum node_type parent_type = nt_none) override {
+        if(args.size() == 0) {
+            out += "[empty n-ary " + op + "]";
+            return;
+        }
+
+        out += '(';
+        for(int i = 0; i < args.size(); i++) {
+            out += '(';
+            args[i]->append_string(out);
+            out += ')';
+            if(i + 1 != args.size()) out += " " + op + " ";
+        }
+        out += ')';
+    }
+
+    double eval() override {
+        double result = op == "+" ? 0 : 1;
+        for(int i = 0; i < args.size(); i++) {
+            if(op == "+") result += args[i]->eval();
+            else result *= args[i]->eval();
+        }
+        return result;
+    }
+};
+
+/* ~ ~ ~ ~ ~ Memo Tables ~ ~ ~ ~ ~ */
+
+enum cas_op { cas_simp, cas_deriv, cas_expand };
+
+// a memoized result of the CAS (see cas_memo)
+struct CasMemoEntry {
+    string key;    // the operation, the context state the result depends on, and the input
+    string result; // (both encoded by encode_tree)
+};
+
+struct CasCache {
+    list<CasMemoEntry> entries; // most recently used first
+    unordered_map<string_view, list<CasMemoEntry>::iterator> index; // by key
+    size_t num_bytes = 0;
+    CasCacheStats stats;
+
+    void clear();
+    void evict_last();
+};
+
+void encode_tree(string& out, TreeNode& tree);
+unique_ptr<TreeNode> decode_tree(const char *& pos);
 
 unique_ptr<TreeNode> symb_deriv(unique_ptr<TreeNode>&& node);
+// jacobian[i][j] is the partial derivative of trees[i] with respect to ids[j]
+vector<vector<unique_ptr<TreeNode>>> symb_jacobian(vector<unique_ptr<TreeNode>>&& trees,
+                                                   const vector<string>& ids);
 unique_ptr<TreeNode> symb_simp(unique_ptr<TreeNode>&& tree);
-unique_ptr<TreeNode> symb_expand(unique_ptr<TreeNode>&& tree, bool is_simplified = false);
+unique_ptr<TreeNode> symb_expand(unique_ptr<TreeNode>&& tree);
 
-pair<unique_ptr<TreeNode>, unique_ptr<TreeNode>> const_and_base(unique_ptr<TreeNode>& node);
-pair<unique_ptr<TreeNode>, unique_ptr<TreeNode>> base_and_exp(unique_ptr<TreeNode>& node);
+void init_cas_rules();
 
 unique_ptr<TreeNode> binarize(unique_ptr<TreeNode>&& tree);
 unique_ptr<TreeNode> pretty_tree(unique_ptr<TreeNode>&& tree);
 
-unique_ptr<TreeNode> merge_sums(unique_ptr<TreeNode>&& _a, unique_ptr<TreeNode>&& _b);
-unique_ptr<TreeNode> merge_products(unique_ptr<TreeNode>&& _a, unique_ptr<TreeNode>&& _b);
-
 #endif // CAS
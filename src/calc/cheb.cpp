@@ -0,0 +1,163 @@
+#include "cheb.h"
+
+/* ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ Chebyshev Tables ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ */
+
+// the Chebyshev point k of [lo, hi] (cos(k pi / CHEB_DEGREE), mapped from [-1, 1])
+inline double cheb_point(double lo, double hi, int k) {
+    return (lo + hi) / 2 + (hi - lo) / 2 * cos(M_PI * k / CHEB_DEGREE);
+}
+
+// the coefficients of the interpolant through the values y at the Chebyshev points (a discrete
+// cosine transform; the points' cosines are the coefficients' terms)
+void cheb_coefs(const double *y, double *c) {
+    for(int j = 0; j <= CHEB_DEGREE; j++) {
+        double sum = (y[0] + (j % 2 ? -1 : 1) * y[CHEB_DEGREE]) / 2;
+        for(int k = 1; k < CHEB_DEGREE; k++) sum += y[k] * cos(M_PI * j * k / CHEB_DEGREE);
+        c[j] = sum * 2 / CHEB_DEGREE;
+    }
+    c[0] /= 2;
+    c[CHEB_DEGREE] /= 2;
+}
+
+// the sum of c_j T_j(t), by Clenshaw's recurrence
+inline double clenshaw(const double *c, double t) {
+    double b1 = 0, b2 = 0;
+    for(int j = CHEB_DEGREE; j > 0; j--) {
+        double b0 = 2 * t * b1 - b2 + c[j];
+        b2 = b1;
+        b1 = b0;
+    }
+    return t * b1 - b2 + c[0];
+}
+
+bool ChebyshevTable::eval(double x, double& y) const {
+    if(!(x >= breaks.front() && x <= breaks.back())) return false; // (NAN too)
+
+    int i = upper_bound(breaks.begin(), breaks.end(), x) - breaks.begin() - 1;
+    i = min(i, num_pieces() - 1); // (x == b)
+    if(!fitted[i]) return false;
+
+    double lo = breaks[i], hi = breaks[i + 1];
+    y = clenshaw(&coefs[i * (CHEB_DEGREE + 1)], (2 * x - lo - hi) / (hi - lo));
+    return true;
+}
+
+struct ChebyshevPiece {
+    double lo, hi;
+    int depth;
+    bool fitted;
+    array<double, CHEB_DEGREE + 1> coefs;
+};
+
+ChebyshevTable tabulate_chebyshev(const batch_fn& f, double a, double b, double tol) {
+    vector<ChebyshevPiece> pending {{a, b, 0}}, pieces;
+    double scale = 0; // the largest value sampled
+
+    while(!pending.empty()) {
+        int num_points = pending.size() * (CHEB_DEGREE + 1);
+        vector<double> x(num_points), y(num_points);
+        for(int i = 0; i < pending.size(); i++) {
+            for(int k = 0; k <= CHEB_DEGREE; k++) {
+                x[i * (CHEB_DEGREE + 1) + k] = cheb_point(pending[i].lo, pending[i].hi, k);
+            }
+        }
+        f(x.data(), y.data(), num_points);
+        for(double val : y) if(isfinite(val)) scale = max(scale, abs(val));
+
+        vector<ChebyshevPiece> bisected;
+        for(int i = 0; i < pending.size(); i++) {
+            ChebyshevPiece& piece = pending[i];
+            const double *piece_y = &y[i * (CHEB_DEGREE + 1)];
+
+            piece.fitted = all_of(piece_y, piece_y + CHEB_DEGREE + 1, [](double val) { return isfinite(val); });
+            if(piece.fitted) {
+                cheb_coefs(piece_y, piece.coefs.data());
+                piece.fitted = abs(piece.coefs[CHEB_DEGREE - 1]) + abs(piece.coefs[CHEB_DEGREE]) <= tol * scale;
+            }
+
+            // (the pieces there would be if this were the last bisection)
+            int num_pieces = pieces.size() + bisected.size() + (pending.size() - i);
+            if(piece.fitted || piece.depth == CHEB_MAX_DEPTH || num_pieces + 1 > CHEB_MAX_PIECES) {
+                pieces.push_back(piece);
+                continue;
+            }
+            double mid = (piece.lo + piece.hi) / 2;
+            bisected.push_back({piece.lo, mid, piece.depth + 1});
+            bisected.push_back({mid, piece.hi, piece.depth + 1});
+        }
+        pending = std::move(bisected);
+    }
+
+    sort(pieces.begin(), pieces.end(), [](const ChebyshevPiece& p, const ChebyshevPiece& q) {
+        return p.lo < q.lo;
+    });
+
+    ChebyshevTable table;
+    for(ChebyshevPiece& piece : pieces) {
+        table.breaks.push_back(piece.lo);
+        table.coefs.insert(table.coefs.end(), piece.coefs.begin(), piece.coefs.end());
+        table.fitted.push_back(piece.fitted);
+    }
+    table.breaks.push_back(b);
+    return table;
+}
+
+/* ~ ~ ~ ~ ~ Tabulated Functions ~ ~ ~ ~ ~ */
+
+TabulatedFunction::TabulatedFunction(const UserFunction& original, double a, double b, double tol) :
+    UserFunction(vector<string>(original.arg_ids), original.tree->copy()) {
+    program = BatchProgram::compile(*tree, arg_ids[0]);
+
+    table = tabulate_chebyshev([&](const double *x, double *y, int n) {
+        if(program) {
+            platform_parallel_for((n + BATCH_SIZE - 1) / BATCH_SIZE, [&](int batch) {
+                vector<double> regs = program->new_registers();
+                int start = batch * BATCH_SIZE;
+                program->run(x + start, y + start, min(BATCH_SIZE, n - start), regs.data());
+            });
+            return;
+        }
+
+        vector<unique_ptr<TreeNode>> args(1);
+        for(int i = 0; i < n; i++) {
+            args[0] = make_unique<NumberNode>(x[i]);
+            y[i] = UserFunction::eval(args); // (the original)
+        }
+    }, a, b, tol);
+}
+
+double TabulatedFunction::eval(vector<unique_ptr<TreeNode>>& args) {
+    if(args.size() != 1) return UserFunction::eval(args); // (reports the error)
+
+    double x = args[0]->eval(), y;
+    if(table.eval(x, y)) return y;
+
+    vector<unique_ptr<TreeNode>> arg_vals(1);
+    arg_vals[0] = make_unique<NumberNode>(x);
+    return UserFunction::eval(arg_vals);
+}
+
+bool TabulatedFunction::eval_batch(const double *const *arg_cols, double *out, int n) {
+    if(!program) return false;
+
+    // (the points off the table are evaluated together, by the original's program)
+    double off_x[BATCH_SIZE], off_y[BATCH_SIZE];
+    int off[BATCH_SIZE], num_off = 0;
+    vector<double> regs;
+
+    auto eval_off = [&]() {
+        if(regs.empty()) regs = program->new_registers();
+        program->run(off_x, off_y, num_off, regs.data());
+        for(int k = 0; k < num_off; k++) out[off[k]] = off_y[k];
+        num_off = 0;
+    };
+
+    for(int j = 0; j < n; j++) {
+        if(table.eval(arg_cols[0][j], out[j])) continue;
+        off_x[num_off] = arg_cols[0][j];
+        off[num_off++] = j;
+        if(num_off == BATCH_SIZE) eval_off();
+    }
+    if(num_off > 0) eval_off();
+    return true;
+}
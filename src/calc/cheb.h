@@ -0,0 +1,56 @@
+#ifndef CHEB
+#define CHEB
+
+#include "batch.h"
+#include "numdiff.h"
+
+/* ~ ~ ~ ~ ~ Chebyshev Tables ~ ~ ~ ~ ~ */
+
+/*
+ * ChebyshevTable: a piecewise Chebyshev interpolant of a function on [a, b], for functions
+ * that are slow to evaluate (nested nintegrals, long chains of calls) and evaluated over and
+ * over on the same interval, as graphs and traces do. Each piece interpolates the function at
+ * the CHEB_DEGREE + 1 Chebyshev points of its interval, and is evaluated by Clenshaw's
+ * recurrence in a few multiply-adds. tabulate_chebyshev bisects [a, b] until the last two
+ * coefficients of each piece (which bound the error of smooth functions) are within tol of the
+ * largest value sampled. Pieces that don't converge within CHEB_MAX_DEPTH bisections (around
+ * kinks and jumps) or that sample a non-finite value (around poles) aren't fitted, and are
+ * left to the original function. The points of each round of bisections are sampled together,
+ * so f evaluates a whole batch of points each time it's called.
+ *
+ * TabulatedFunction: a user function with a table, made by the tabulate macro. Calls in [a, b]
+ * evaluate the table, and calls elsewhere (or in unfitted pieces) the original, whose tree it
+ * keeps, so derivatives (symbolic, or on jets) are still those of the original. Like a graph,
+ * the table has the values of the identifiers the function reads when it was tabulated.
+ */
+
+constexpr int CHEB_DEGREE = 16;
+constexpr int CHEB_MAX_DEPTH = 20;    // (bisections of [a, b])
+constexpr int CHEB_MAX_PIECES = 4096;
+
+struct ChebyshevTable {
+    vector<double> breaks; // piece i is [breaks[i], breaks[i + 1]]
+    vector<double> coefs;  // CHEB_DEGREE + 1 per piece, from c_0
+    vector<bool> fitted;
+
+    int num_pieces() const { return fitted.size(); }
+
+    // false (with y unset) if x isn't in a fitted piece
+    bool eval(double x, double& y) const;
+};
+
+ChebyshevTable tabulate_chebyshev(const batch_fn& f, double a, double b, double tol);
+
+struct TabulatedFunction : UserFunction {
+    ChebyshevTable table;
+    unique_ptr<BatchProgram> program; // the original's, if it has a batch form
+
+    TabulatedFunction(const UserFunction& original, double a, double b, double tol);
+
+    double eval(vector<unique_ptr<TreeNode>>& args) override;
+    // (with no batch form for the original, the calls are evaluated point by point)
+    bool eval_batch(const double *const *arg_cols, double *out, int n) override;
+    int num_args() override { return 1; }
+};
+
+#endif // CHEB
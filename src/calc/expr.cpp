@@ -0,0 +1,117 @@
+#include "expr.h"
+
+/* ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ Expression DAG ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ */
+
+constexpr size_t EXPR_BLOCK_SIZE = 256; // nodes (or arguments) per block
+
+const Expr *ExprTable::intern(enum node_type type, const string& name, double val,
+                              const Expr *const *args, int num_args) {
+    uint64_t val_bits;
+    memcpy(&val_bits, &val, sizeof(double));
+
+    size_t hash = std::hash<string>()(name) ^ (type * 0x9e3779b97f4a7c15ull);
+    hash = hash * 31 + val_bits;
+    for(int i = 0; i < num_args; i++) hash = hash * 31 + (uintptr_t) args[i];
+    hash ^= hash >> 29;
+
+    // keep the index at most half full
+    if(2 * (num_nodes + 1) > slots.size()) {
+        vector<const Expr *> old_slots(max<size_t>(EXPR_BLOCK_SIZE, 2 * slots.size()), nullptr);
+        swap(slots, old_slots);
+        for(const Expr *e : old_slots) {
+            if(e == nullptr) continue;
+            size_t i = e->hash & (slots.size() - 1);
+            while(slots[i] != nullptr) i = (i + 1) & (slots.size() - 1);
+            slots[i] = e;
+        }
+    }
+
+    // children are already unique, so they're compared by pointer
+    size_t i = hash & (slots.size() - 1);
+    for(; slots[i] != nullptr; i = (i + 1) & (slots.size() - 1)) {
+        const Expr *e = slots[i];
+        if(e->hash == hash && e->type == type && e->num_args == num_args && e->name == name &&
+           memcmp(&e->val, &val, sizeof(double)) == 0 &&
+           equal(args, args + num_args, e->args)) return e;
+    }
+
+    // new node: copy the arguments, then the node, into the current blocks
+    const Expr *const *stored_args = nullptr;
+    if(num_args) {
+        if(arg_blocks.empty() || arg_blocks.back().size() + num_args > arg_blocks.back().capacity()) {
+            arg_blocks.emplace_back();
+            arg_blocks.back().reserve(max<size_t>(EXPR_BLOCK_SIZE, num_args));
+        }
+        vector<const Expr *>& block = arg_blocks.back();
+        stored_args = block.data() + block.size();
+        block.insert(block.end(), args, args + num_args);
+    }
+
+    if(node_blocks.empty() || node_blocks.back().size() == node_blocks.back().capacity()) {
+        node_blocks.emplace_back();
+        node_blocks.back().reserve(EXPR_BLOCK_SIZE);
+    }
+    node_blocks.back().push_back(Expr {type, name, val, stored_args, num_args, hash});
+
+    num_nodes++;
+    slots[i] = &node_blocks.back().back();
+    return slots[i];
+}
+
+const Expr *ExprTable::from_tree(TreeNode& tree) {
+    vector<const Expr *> args;
+
+    switch(tree.type()) {
+        case nt_num: return num(((NumberNode&) tree).val);
+        case nt_id: return var(((VariableNode&) tree).id);
+        case nt_fn_call: {
+            FunctionCallNode& fn = (FunctionCallNode&) tree;
+            for(auto& arg : fn.args) args.push_back(from_tree(*arg));
+            return intern(nt_fn_call, fn.fn_id, 0, args.data(), args.size());
+        }
+        case nt_deriv: {
+            DerivativeNode& dn = (DerivativeNode&) tree;
+            for(auto& arg : dn.args) args.push_back(from_tree(*arg));
+            return intern(nt_deriv, dn.fn_id, dn.nth_deriv, args.data(), args.size());
+        }
+        case nt_negation: {
+            UnaryOpNode& un = (UnaryOpNode&) tree;
+            return unary(from_tree(*un.arg), un.op);
+        }
+        case nt_nary_sum:
+        case nt_nary_product: {
+            NaryOpNode& nn = (NaryOpNode&) tree;
+            for(auto& arg : nn.args) args.push_back(from_tree(*arg));
+            return intern(tree.type(), nn.op, 0, args.data(), args.size());
+        }
+        default: {
+            BinaryOpNode& bn = (BinaryOpNode&) tree;
+            const Expr *left = from_tree(*bn.left);
+            return binary(left, from_tree(*bn.right), bn.op);
+        }
+    }
+}
+
+// builds a (mutable) tree from e; shared subexpressions are copied once per use
+unique_ptr<TreeNode> to_tree(const Expr *e) {
+    switch(e->type) {
+        case nt_num: return make_unique<NumberNode>(e->val);
+        case nt_id: return make_unique<VariableNode>(e->name);
+        case nt_negation: return make_unique<UnaryOpNode>(to_tree(e->arg(0)), e->name);
+        case nt_fn_call:
+        case nt_deriv:
+        case nt_nary_sum:
+        case nt_nary_product: {
+            vector<unique_ptr<TreeNode>> args;
+            for(int i = 0; i < e->num_args; i++) args.push_back(to_tree(e->arg(i)));
+
+            if(e->type == nt_fn_call) return make_unique<FunctionCallNode>(e->name, std::move(args));
+            if(e->type == nt_deriv) return make_unique<DerivativeNode>(e->name, std::move(args), (int) e->val);
+            return make_unique<NaryOpNode>(std::move(args), e->name);
+        }
+        default: {
+            unique_ptr<TreeNode> left = to_tree(e->arg(0));
+            return make_unique<BinaryOpNode>(std::move(left), to_tree(e->arg(1)), e->name);
+        }
+    }
+}
@@ -0,0 +1,62 @@
+#ifndef EXPR
+#define EXPR
+
+#include "cas.h"
+
+/* ~ ~ ~ ~ ~ Expression DAG ~ ~ ~ ~ ~ */
+
+/*
+ * Expr: an immutable expression node, used by the CAS in place of TreeNode where rewrites
+ * would otherwise copy subtrees. Nodes are hash-consed by an ExprTable: structurally identical
+ * subexpressions are the same node, so they're shared instead of copied, and can be compared
+ * (and used as map keys) by pointer. Trees are converted with ExprTable::from_tree and to_tree.
+ */
+struct Expr {
+    enum node_type type;
+    string name; // variable id, function id or operator ("" for numbers)
+    double val;  // value of a number, or the order of a derivative (0 otherwise)
+    const Expr *const *args; // operands or function arguments (stored by the table)
+    int num_args;
+    size_t hash;
+    mutable const Expr *deriv = nullptr; // memoized derivative (see symb_deriv)
+    mutable const Expr *simp = nullptr;  // memoized simplification (see symb_simp)
+    mutable const Expr *key = nullptr;   // canonical node under lex_cmp (see Simplifier::key)
+
+    const Expr *arg(int i) const { return args[i]; }
+};
+
+// owns the nodes of a DAG; nodes live as long as the table
+struct ExprTable {
+    vector<vector<Expr>> node_blocks;        // nodes are appended to the last block, which
+    vector<vector<const Expr *>> arg_blocks; // is never grown past its capacity (so they stay put)
+    vector<const Expr *> slots; // open-addressed index of nodes by hash (size is a power of 2)
+    size_t num_nodes = 0;
+
+    // returns the unique node with the given contents
+    const Expr *intern(enum node_type type, const string& name, double val,
+                       const Expr *const *args, int num_args);
+
+    const Expr *num(double val) { return intern(nt_num, "", val, nullptr, 0); }
+    const Expr *var(const string& id) { return intern(nt_id, id, 0, nullptr, 0); }
+    const Expr *call(const string& fn_id, const Expr *arg) {
+        return intern(nt_fn_call, fn_id, 0, &arg, 1);
+    }
+    const Expr *unary(const Expr *arg, const string& op) {
+        return intern(nt_negation, op, 0, &arg, 1);
+    }
+    const Expr *binary(const Expr *left, const Expr *right, const string& op) {
+        const Expr *args[] = {left, right};
+        return intern(binary_op_type(op), op, 0, args, 2);
+    }
+    const Expr *nary(const vector<const Expr *>& args, const string& op) {
+        return intern(op == "+" ? nt_nary_sum : nt_nary_product, op, 0, args.data(), args.size());
+    }
+
+    const Expr *from_tree(TreeNode& tree);
+};
+
+unique_ptr<TreeNode> to_tree(const Expr *e);
+
+int lex_cmp(const Expr *a, const Expr *b);
+
+#endif // EXPR
@@ -0,0 +1,192 @@
+#include "fastmath.h"
+
+/* ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ Fast Math Kernels ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ */
+
+// Each kernel's first loop writes NAN for the arguments outside its fast range, and its second
+// loop recomputes the NANs by libm (which also gives any NAN that is the right result).
+
+// (the builtin of C++20's bit_cast, in GCC and Clang; memcpy gets folded into loads that don't vectorize)
+inline uint64_t to_bits(double x) { return __builtin_bit_cast(uint64_t, x); }
+inline double from_bits(uint64_t u) { return __builtin_bit_cast(double, u); }
+
+// x + ROUNDER - ROUNDER is x rounded to an integer for |x| < 2^51, and the low bits of
+// to_bits(x + ROUNDER) are that integer (in two's complement)
+constexpr double ROUNDER = 0x1.8p52;
+
+// (selections by integer conditions are bit operations: SSE2 has no 64-bit integer comparisons)
+
+// a if bit is 1, else b
+inline double select_bit(uint64_t bit, double a, double b) {
+    uint64_t mask = -bit;
+    return from_bits((to_bits(a) & mask) | (to_bits(b) & ~mask));
+}
+
+// -x if bit is 1, else x
+inline double negate_bit(uint64_t bit, double x) { return from_bits(to_bits(x) ^ bit << 63); }
+
+/* ~ ~ ~ ~ ~ Trigonometric Functions ~ ~ ~ ~ ~ */
+
+constexpr double TRIG_FAST_MAX = 1e5; // (past it, k pi/2 below needs more bits of pi)
+
+constexpr double TWO_OVER_PI = 6.36619772367581382433e-01;
+constexpr double PIO2_1 = 1.57079632673412561417e+00; // pi/2 = PIO2_1 + PIO2_2 + PIO2_3, where
+constexpr double PIO2_2 = 6.07710050630396597660e-11; // k PIO2_1 and k PIO2_2 are exact
+constexpr double PIO2_3 = 2.02226624879595063154e-21;
+
+// sin on [-pi/4, pi/4]: r + r^3 (S1 + S2 r^2 + ...)
+constexpr double S1 = -1.66666666666666324348e-01, S2 = 8.33333333332248946124e-03,
+                 S3 = -1.98412698298579493134e-04, S4 = 2.75573137070700676789e-06,
+                 S5 = -2.50507602534068634195e-08, S6 = 1.58969099521155010221e-10;
+
+// cos on [-pi/4, pi/4]: 1 - r^2 / 2 + r^4 (C1 + C2 r^2 + ...)
+constexpr double C1 = 4.16666666666666019037e-02, C2 = -1.38888888888741095749e-03,
+                 C3 = 2.48015872894767294178e-05, C4 = -2.75573143513906633035e-07,
+                 C5 = 2.08757232129817482790e-09, C6 = -1.13596475577881948265e-11;
+
+// sin and cos of r = x - k pi/2 in [-pi/4, pi/4], and k mod 4 (the quadrant of x)
+inline void sin_cos_reduced(double x, double& s, double& c, uint64_t& quadrant) {
+    double shifted = x * TWO_OVER_PI + ROUNDER;
+    double k = shifted - ROUNDER;
+    quadrant = to_bits(shifted) & 3;
+
+    double r = ((x - k * PIO2_1) - k * PIO2_2) - k * PIO2_3;
+    double z = r * r;
+    s = r + r * z * (S1 + z * (S2 + z * (S3 + z * (S4 + z * (S5 + z * S6)))));
+    c = 1 - (0.5 * z - z * z * (C1 + z * (C2 + z * (C3 + z * (C4 + z * (C5 + z * C6))))));
+}
+
+void fast_sin(const double *const *arg_cols, double *out, int n) {
+    const double *x = arg_cols[0];
+    for(int j = 0; j < n; j++) {
+        double s, c;
+        uint64_t quadrant;
+        sin_cos_reduced(x[j], s, c, quadrant);
+        double val = negate_bit(quadrant >> 1 & 1, select_bit(quadrant & 1, c, s));
+        out[j] = abs(x[j]) <= TRIG_FAST_MAX ? val : NAN;
+    }
+    for(int j = 0; j < n; j++) if(isnan(out[j])) out[j] = sin(x[j]);
+}
+
+void fast_cos(const double *const *arg_cols, double *out, int n) {
+    const double *x = arg_cols[0];
+    for(int j = 0; j < n; j++) {
+        double s, c;
+        uint64_t quadrant;
+        sin_cos_reduced(x[j], s, c, quadrant);
+        double val = negate_bit((quadrant + 1) >> 1 & 1, select_bit(quadrant & 1, s, c));
+        out[j] = abs(x[j]) <= TRIG_FAST_MAX ? val : NAN;
+    }
+    for(int j = 0; j < n; j++) if(isnan(out[j])) out[j] = cos(x[j]);
+}
+
+void fast_tan(const double *const *arg_cols, double *out, int n) {
+    const double *x = arg_cols[0];
+    for(int j = 0; j < n; j++) {
+        double s, c;
+        uint64_t quadrant;
+        sin_cos_reduced(x[j], s, c, quadrant);
+        uint64_t odd = quadrant & 1;
+        double val = select_bit(odd, -c, s) / select_bit(odd, s, c);
+        out[j] = abs(x[j]) <= TRIG_FAST_MAX ? val : NAN;
+    }
+    for(int j = 0; j < n; j++) if(isnan(out[j])) out[j] = tan(x[j]);
+}
+
+/* ~ ~ ~ ~ ~ Logarithms ~ ~ ~ ~ ~ */
+
+constexpr double LN2_HI = 6.93147180369123816490e-01; // ln 2 = LN2_HI + LN2_LO, where k LN2_HI
+constexpr double LN2_LO = 1.90821492927058770002e-10; // is exact
+
+// ln(1 + f) = f - f^2 / 2 + s (f^2 / 2 + R(s^2)), for s = f / (2 + f)
+constexpr double LG1 = 6.666666666666735130e-01, LG2 = 3.999999999940941908e-01,
+                 LG3 = 2.857142874366239149e-01, LG4 = 2.222219843214978396e-01,
+                 LG5 = 1.818357216161805012e-01, LG6 = 1.531383769920937332e-01,
+                 LG7 = 1.479819860511658591e-01;
+
+// ln x for normal x > 0, of x = 2^k (1 + f) with 1 + f in [sqrt(2) / 2, sqrt(2))
+inline double ln_normal(double x) {
+    uint64_t u = to_bits(x);
+    double m = from_bits((u & 0x000fffffffffffffull) | 0x3ff0000000000000ull); // (in [1, 2))
+    double high = m > M_SQRT2 ? 1 : 0;
+    m *= 1 - 0.5 * high;
+    double k = (from_bits(to_bits(ROUNDER) + (u >> 52)) - ROUNDER) - 1023 + high;
+
+    double f = m - 1, s = f / (2 + f), half_f2 = 0.5 * f * f;
+    double z = s * s, w = z * z;
+    double r = z * (LG1 + w * (LG3 + w * (LG5 + w * LG7))) + w * (LG2 + w * (LG4 + w * LG6));
+    return k * LN2_HI - ((half_f2 - (s * (half_f2 + r) + k * LN2_LO)) - f);
+}
+
+inline bool is_normal_positive(double x) {
+    return (x >= numeric_limits<double>::min()) & (x <= numeric_limits<double>::max()); // (no branch)
+}
+
+void fast_ln(const double *const *arg_cols, double *out, int n) {
+    const double *x = arg_cols[0];
+    for(int j = 0; j < n; j++) out[j] = is_normal_positive(x[j]) ? ln_normal(x[j]) : NAN;
+    for(int j = 0; j < n; j++) if(isnan(out[j])) out[j] = log(x[j]);
+}
+
+void fast_lg(const double *const *arg_cols, double *out, int n) {
+    const double *x = arg_cols[0];
+    for(int j = 0; j < n; j++) out[j] = is_normal_positive(x[j]) ? ln_normal(x[j]) * M_LOG2E : NAN;
+    for(int j = 0; j < n; j++) if(isnan(out[j])) out[j] = log2(x[j]);
+}
+
+void fast_log(const double *const *arg_cols, double *out, int n) {
+    const double *x = arg_cols[0];
+    for(int j = 0; j < n; j++) out[j] = is_normal_positive(x[j]) ? ln_normal(x[j]) * M_LOG10E : NAN;
+    for(int j = 0; j < n; j++) if(isnan(out[j])) out[j] = log10(x[j]);
+}
+
+/* ~ ~ ~ ~ ~ Powers ~ ~ ~ ~ ~ */
+
+constexpr double EXP_FAST_MAX = 700; // (e^y and 2^k below stay normal)
+
+// e^r on [-ln(2) / 2, ln(2) / 2], from R(r^2) = r - r^2 (P1 + P2 r^2 + ...)
+constexpr double P1 = 1.66666666666666019037e-01, P2 = -2.77777777770155933842e-03,
+                 P3 = 6.61375632143793436117e-05, P4 = -1.65339022054652515390e-06,
+                 P5 = 4.13813679705723846039e-08;
+
+// e^y for |y| <= EXP_FAST_MAX, of y = k ln(2) + r
+inline double exp_reduced(double y) {
+    double shifted = y * M_LOG2E + ROUNDER;
+    double k = shifted - ROUNDER;
+    int64_t exponent = to_bits(shifted) - to_bits(ROUNDER);
+
+    double hi = y - k * LN2_HI, lo = k * LN2_LO, r = hi - lo;
+    double t = r * r;
+    double c = r - t * (P1 + t * (P2 + t * (P3 + t * (P4 + t * P5))));
+    double exp_r = 1 - ((lo - (r * c) / (2 - c)) - hi);
+    return exp_r * from_bits((uint64_t) (exponent + 1023) << 52);
+}
+
+// b^e = e^(e ln|b|), negated for b < 0 and odd e (and NAN for b < 0 and non-integer e)
+void fast_pow(const double *const *arg_cols, double *out, int n) {
+    const double *b = arg_cols[0], *e = arg_cols[1];
+    for(int j = 0; j < n; j++) {
+        double abs_b = abs(b[j]);
+        double y = e[j] * ln_normal(abs_b);
+        double val = exp_reduced(y); // (garbage past EXP_FAST_MAX, but replaced below)
+
+        double e_shifted = e[j] + ROUNDER; // (for |e| < 2^51)
+        bool integer = e_shifted - ROUNDER == e[j];
+        val = negate_bit(to_bits(e_shifted) & to_bits(b[j]) >> 63 & 1, val); // (b < 0 and odd e)
+
+        bool fast = is_normal_positive(abs_b) & (abs(y) <= EXP_FAST_MAX) & (abs(e[j]) < 0x1p51);
+        out[j] = fast & (integer | (b[j] >= 0)) ? val : NAN;
+    }
+    for(int j = 0; j < n; j++) if(isnan(out[j])) out[j] = pow(b[j], e[j]);
+}
+
+/* ~ ~ ~ ~ ~ Lookup ~ ~ ~ ~ ~ */
+
+const unordered_map<string, fast_fn> fast_kernels = {
+    {"sin", fast_sin}, {"cos", fast_cos}, {"tan", fast_tan},
+    {"ln", fast_ln}, {"lg", fast_lg}, {"log", fast_log}, {"pow", fast_pow},
+};
+
+fast_fn find_fast_kernel(const string& fn_id) {
+    auto kernel = fast_kernels.find(fn_id);
+    return kernel == fast_kernels.end() ? nullptr : kernel->second;
+}
@@ -0,0 +1,41 @@
+#ifndef FASTMATH
+#define FASTMATH
+
+#include "backend.h"
+
+/* ~ ~ ~ ~ ~ Fast Math Kernels ~ ~ ~ ~ ~ */
+
+/*
+ * Kernels of sin, cos, tan, ln, lg, log and pow over whole columns, for plotting (see
+ * PLOT_FAST_MATH). Each is a branch-free loop that reduces the argument and evaluates a
+ * polynomial (the fdlibm ones), written so that compilers vectorize it: SSE2 or AVX2 natively
+ * (with -O3 -fno-trapping-math, and -mavx2 or -march=native for AVX2), and wasm SIMD128 with
+ * -msimd128. Libm calls can't be vectorized, and each of them handles every special case.
+ * Arguments outside a kernel's fast range are recomputed by libm in a second pass, so results are
+ * libm's there:
+ *
+ *   sin, cos, tan   |x| <= 1e5      abs error <= 2.3e-16 (sin, cos), rel error <= 6e-16 (tan)
+ *   ln, lg, log     normal x > 0    rel error <= 2.6e-16
+ *   pow(b, e)       normal b != 0,  rel error <= 5e-15 for |e ln b| < 23, growing with |e ln b|
+ *                   |e ln b| < 700  to <= 6e-14 (b < 0 only with integer e)
+ *
+ * (the largest differences from libm over 10^6 random arguments in each range). That is far
+ * below what a pixel needs, but the values aren't bit-identical to libm's, which is why
+ * calculations keep using libm and only graphs use these.
+ */
+
+// out[j] = the function of arg_cols[0][j] (and arg_cols[1][j], for pow), like eval_batch
+typedef void (*fast_fn)(const double *const *arg_cols, double *out, int n);
+
+// the kernel of built-in fn_id, or nullptr if it has none
+fast_fn find_fast_kernel(const string& fn_id);
+
+void fast_sin(const double *const *arg_cols, double *out, int n);
+void fast_cos(const double *const *arg_cols, double *out, int n);
+void fast_tan(const double *const *arg_cols, double *out, int n);
+void fast_ln(const double *const *arg_cols, double *out, int n);
+void fast_lg(const double *const *arg_cols, double *out, int n);
+void fast_log(const double *const *arg_cols, double *out, int n);
+void fast_pow(const double *const *arg_cols, double *out, int n); // (also of ^)
+
+#endif // FASTMATH
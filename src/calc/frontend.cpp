@@ -2,50 +2,81 @@
 
 /* ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ Frontend Interface (with webpage) ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ */
 
-double last_answer = NAN;
-string latex_result = "";
+// initializes backend constants and functions of the given context
+void init(CalcContext& c) {
+    ContextScope scope(c);
 
-// initializes backend constants and functions
-void init() {
     init_constants();
     init_functions();
 }
 
-// evaluates the (user provided) string, and returns the result as a string
-string calculate_text(string text, bool just_numeric_result) {
+// lexes and parses the (user provided) string; this stage doesn't read any context, so
+// it may run on a different thread than the one evaluating the command
+ParsedCommand parse_command(const string& text) {
+    ParsedCommand cmd;
+
+    try {
+        cmd.tree = parseS(tokenize(text));
+    } catch(calculator_error& err) {
+        cmd.error = err.to_string();
+    }
+
+    return cmd;
+}
+
+// returns true if the tree calls any macro (i.e. tree_node_exe_macro could change it)
+bool has_macro_call(unique_ptr<TreeNode>& tree) {
+    bool found = false;
+
+    tree = tree->exe_on_children(std::move(tree), [&found](unique_ptr<TreeNode>&& node) {
+        if(node->type() == nt_fn_call) {
+            auto macro = ctx->macro_table.find(((FunctionCallNode *)node.get())->fn_id);
+            if(macro != ctx->macro_table.end() && macro->second != nullptr) found = true;
+        }
+        return std::move(node);
+    });
+
+    return found;
+}
+
+// evaluates a parsed command in the given context, and returns the result as a string;
+// the echoed trees are only serialized when an echo option asks for them, and the LaTeX
+// result is only rendered once get_latex_result is called
+string evaluate_command(CalcContext& c, ParsedCommand&& cmd, bool just_numeric_result) {
+    ContextScope scope(c);
+    if(cmd.tree == nullptr) return cmd.error;
+
     try {
         string ret = "";
-        vector<unique_ptr<Token>> token_vec = tokenize(text);
-        unique_ptr<TreeNode> tree = parseS(std::move(token_vec));
+        unique_ptr<TreeNode> tree = std::move(cmd.tree);
 
-        string before_macros = tree->to_string();
-        string latex_before_macros = tree->to_latex_string();
+        // the tree from before macros only needs to be kept if a macro could change it
+        unique_ptr<TreeNode> before_macros = has_macro_call(tree) ? tree->copy() : nullptr;
         tree = tree->exe_on_children(std::move(tree), tree_node_exe_macro);
-        string after_macros = tree->to_string();
-        string latex_after_macros = tree->to_latex_string();
 
-        if(get_id_value("ECHO_TREE")) {
-            ret += "~>  " + before_macros + "\n" +
+        if(!just_numeric_result && get_id_value("ECHO_TREE")) {
+            string after_macros = tree->to_string();
+            ret += "~>  " + (before_macros ? before_macros->to_string() : after_macros) + "\n" +
                    "->  " + after_macros + "\n";
         }
 
-        last_answer = tree->eval();
-
-        latex_result = latex_before_macros == latex_after_macros ?
-                       latex_before_macros + '\\' + '\\' + "\\implies " + to_string(last_answer):
-                       latex_before_macros + '\\' + '\\' + " \\implies " + latex_after_macros;
+        c.last_answer = tree->eval();
 
-        if(get_id_value("ECHO_AUTO")) {
-            ret += "=>  " + (before_macros != after_macros ? after_macros :
-                                                             to_string(last_answer)) + "\n";
+        if(!just_numeric_result && get_id_value("ECHO_AUTO")) {
+            string after_macros = before_macros ? tree->to_string() : "";
+            ret += "=>  " + (before_macros && before_macros->to_string() != after_macros ?
+                             after_macros : to_string(c.last_answer)) + "\n";
         }
 
-        if(get_id_value("ECHO_ANS")) {
-            ret += "+>  " + to_string(last_answer) + "\n";
+        if(!just_numeric_result && get_id_value("ECHO_ANS")) {
+            ret += "+>  " + to_string(c.last_answer) + "\n";
         }
 
+        c.latex_before_macros = std::move(before_macros);
+        c.latex_after_macros = std::move(tree);
+
         if(just_numeric_result)
-            return to_string(last_answer);
+            return to_string(c.last_answer);
         else
             return ret;
     } catch(calculator_error& err) {
@@ -53,9 +84,69 @@ string calculate_text(string text, bool just_numeric_result) {
     }
 }
 
+// evaluates the (user provided) string in the given context, and returns the result as a string
+string calculate_text(CalcContext& c, string text, bool just_numeric_result) {
+    return evaluate_command(c, parse_command(text), just_numeric_result);
+}
+
+// evaluates `count` commands, packed back to back as NUL-terminated strings, in order.
+// Results are packed the same way into the caller's arena `out`: offsets[i] is where the ith
+// written result starts, and offsets[n] is one past the end of the last one, so at most
+// offsets_capacity - 1 results are written. Returns n, the number of results written. Results
+// that don't fit are kept in the context; calling again with count = 0 (to evaluate nothing new)
+// writes them next, so every result of a batch is delivered exactly once and in order. A new
+// batch (count > 0) drops any results of the last one that were never fetched.
+int calculate_batch(CalcContext& c, const char *commands, int count, bool just_numeric_result,
+                    char *out, int out_capacity, int *offsets, int offsets_capacity) {
+    if(count > 0) c.batch_pending.clear(); // (so results line up with this batch's commands)
+    for(int i = 0; i < count; i++) {
+        size_t len = strlen(commands);
+        c.batch_pending.push_back(calculate_text(c, string(commands, len), just_numeric_result));
+        commands += len + 1;
+    }
+    if(offsets_capacity < 1) return 0;
+
+    int n = 0, used = 0;
+    for(; n + 1 < offsets_capacity && !c.batch_pending.empty(); n++) {
+        string& result = c.batch_pending.front();
+        if(used + (int) result.size() + 1 > out_capacity) break;
+
+        offsets[n] = used;
+        memcpy(out + used, result.data(), result.size() + 1); // copy with the NUL
+        used += result.size() + 1;
+        c.batch_pending.pop_front();
+    }
+    offsets[n] = used;
+
+    return n;
+}
+
+// renders (and caches) the LaTeX of the last successfully evaluated command
+string get_latex_result(CalcContext& c) {
+    if(c.latex_after_macros != nullptr) {
+        string after = c.latex_after_macros->to_latex_string();
+        string before = c.latex_before_macros ? c.latex_before_macros->to_latex_string() : after;
+
+        c.latex_result = before == after ?
+                         before + '\\' + '\\' + "\\implies " + to_string(c.last_answer):
+                         before + '\\' + '\\' + " \\implies " + after;
+
+        c.latex_before_macros.reset();
+        c.latex_after_macros.reset();
+    }
+
+    return c.latex_result;
+}
+
+/* ~ ~ ~ ~ ~ Exported Functions (default context) ~ ~ ~ ~ ~ */
+
+void init() {
+    init(default_context());
+}
+
 // C-style wrapper for calculate_text - returns a c-style string
 char *calculate_text(const char *text, bool just_numeric_result) {
-    string result = calculate_text(string(text), just_numeric_result);
+    string result = calculate_text(default_context(), string(text), just_numeric_result);
 
     char *cstr = (char *) malloc(result.size() + 1);
     strcpy(cstr, result.c_str());
@@ -63,7 +154,15 @@ char *calculate_text(const char *text, bool just_numeric_result) {
     return cstr;
 }
 
+int calculate_batch(const char *commands, int count, bool just_numeric_result,
+                    char *out, int out_capacity, int *offsets, int offsets_capacity) {
+    return calculate_batch(default_context(), commands, count, just_numeric_result,
+                           out, out_capacity, offsets, offsets_capacity);
+}
+
 char *get_latex_result() {
+    string latex_result = get_latex_result(default_context());
+
     char *cstr = (char *) malloc(latex_result.size() + 1);
     strcpy(cstr, latex_result.c_str());
 
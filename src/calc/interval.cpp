@@ -0,0 +1,319 @@
+#include "interval.h"
+
+/* ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ Interval Arithmetic ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ */
+
+// x moved up by at least an ulp (without nextafter, a slow call), where NAN bounds (like those of
+// 0 * inf) are unbounded
+inline double round_up(double x) {
+    if(isnan(x)) return INFINITY;
+    return isinf(x) ? x : x + (abs(x) * 0x1p-52 + 0x1p-1074);
+}
+
+inline double round_down(double x) { return -round_up(-x); }
+
+// [lo, hi] rounded outward, which is only def (and cont) if both bounds are finite
+Interval outward(double lo, double hi, bool def, bool cont) {
+    lo = round_down(lo), hi = round_up(hi);
+    def = def && isfinite(lo) && isfinite(hi);
+    return {lo, hi, def, cont && def};
+}
+
+// the enclosure of a function of a that's monotone over it, increasing or decreasing
+Interval monotone(double (*f)(double), const Interval& a, bool increasing = true) {
+    double lo = f(a.lo), hi = f(a.hi);
+    if(!increasing) swap(lo, hi);
+    return outward(lo, hi, a.def, a.cont);
+}
+
+bool is_point(const Interval& a) { return a.lo == a.hi; }
+
+Interval operator-(const Interval& a) { return {-a.hi, -a.lo, a.def, a.cont}; }
+
+Interval operator+(const Interval& a, const Interval& b) {
+    return outward(a.lo + b.lo, a.hi + b.hi, a.def && b.def, a.cont && b.cont);
+}
+
+Interval operator-(const Interval& a, const Interval& b) {
+    return outward(a.lo - b.hi, a.hi - b.lo, a.def && b.def, a.cont && b.cont);
+}
+
+// (the extremes of a product or quotient are among those of its bounds)
+Interval corners(double p, double q, double r, double s, bool def, bool cont) {
+    if(isnan(p) || isnan(q) || isnan(r) || isnan(s)) return Interval::entire();
+    return outward(min({p, q, r, s}), max({p, q, r, s}), def, cont);
+}
+
+Interval operator*(const Interval& a, const Interval& b) {
+    return corners(a.lo * b.lo, a.lo * b.hi, a.hi * b.lo, a.hi * b.hi, a.def && b.def, a.cont && b.cont);
+}
+
+Interval operator/(const Interval& a, const Interval& b) {
+    if(b.lo <= 0 && b.hi >= 0) return Interval::entire(); // (a pole, or all of the reals)
+    return corners(a.lo / b.lo, a.lo / b.hi, a.hi / b.lo, a.hi / b.hi, a.def && b.def, a.cont && b.cont);
+}
+
+// a^n for an integer n
+Interval int_power(const Interval& a, double n) {
+    if(n == 0) return {1, 1, a.def, a.cont}; // (pow(x, 0) is 1 even for NAN)
+
+    bool odd = fmod(n, 2) != 0;
+    if(n < 0 && a.lo <= 0 && a.hi >= 0) return Interval::entire();
+    double lo = pow(a.lo, n), hi = pow(a.hi, n);
+    if(odd) return n > 0 ? outward(lo, hi, a.def, a.cont) : outward(hi, lo, a.def, a.cont);
+
+    if(a.lo >= 0) return n > 0 ? outward(lo, hi, a.def, a.cont) : outward(hi, lo, a.def, a.cont);
+    if(a.hi <= 0) return n > 0 ? outward(hi, lo, a.def, a.cont) : outward(lo, hi, a.def, a.cont);
+    return outward(0, max(lo, hi), a.def, a.cont); // (n > 0 here)
+}
+
+Interval pow(const Interval& a, const Interval& b) {
+    bool def = a.def && b.def, cont = a.cont && b.cont;
+    if(is_point(b) && isfinite(b.lo)) {
+        double e = b.lo;
+        if(e == floor(e)) {
+            Interval result = int_power(a, e);
+            result.def = result.def && b.def;
+            result.cont = result.cont && b.cont;
+            return result;
+        }
+
+        // (non-integer powers of negative numbers are NAN)
+        if(a.hi < 0) return Interval::entire();
+        double lo = max(a.lo, 0.0);
+        def = def && a.lo >= 0;
+        if(e < 0 && lo == 0) return outward(pow(a.hi, e), INFINITY, false, false);
+        return e > 0 ? outward(pow(lo, e), pow(a.hi, e), def, cont && def) :
+                       outward(pow(a.hi, e), pow(lo, e), def, cont && def);
+    }
+
+    // (powers of positive bases are monotone in each argument)
+    if(a.lo <= 0) return Interval::entire();
+    return corners(pow(a.lo, b.lo), pow(a.lo, b.hi), pow(a.hi, b.lo), pow(a.hi, b.hi), def, cont);
+}
+
+constexpr double TRUNC_MAX = 0x1p62; // (of values truncated to long longs, which are exact)
+
+// (an interval that is [0, 1] if a comparison's result isn't known)
+Interval truth(bool is_true, bool is_false) {
+    if(is_true) return {1, 1};
+    if(is_false) return {0, 0};
+    return {0, 1, true, false};
+}
+
+// a comparison, integer division or modulus of a and b, like apply_op
+Interval interval_op(enum batch_op op, const Interval& a, const Interval& b) {
+    // (comparisons are always finite, but with NAN they're 0, or 1 for !=)
+    bool comparison = op != bo_int_quotient && op != bo_mod;
+    if(comparison && !(a.def && b.def)) return truth(false, false);
+    switch(op) {
+        case bo_eq: return truth(is_point(a) && is_point(b) && a.lo == b.lo, a.hi < b.lo || b.hi < a.lo);
+        case bo_ne: return truth(a.hi < b.lo || b.hi < a.lo, is_point(a) && is_point(b) && a.lo == b.lo);
+        case bo_lt: return truth(a.hi < b.lo, a.lo >= b.hi);
+        case bo_gt: return truth(a.lo > b.hi, a.hi <= b.lo);
+        case bo_le: return truth(a.hi <= b.lo, a.lo > b.hi);
+        case bo_ge: return truth(a.lo >= b.hi, a.hi < b.lo);
+        default: break;
+    }
+
+    // (operands are truncated to long longs)
+    if(!a.def || !b.def || !is_point(b) || abs(a.lo) > TRUNC_MAX || abs(a.hi) > TRUNC_MAX || abs(b.lo) > TRUNC_MAX)
+        return Interval::entire();
+
+    long long lo = a.lo, hi = a.hi, m = b.lo;
+    if(m == 0) return Interval::entire();
+    if(lo == hi) return Interval::point(apply_op(op, a.lo, b.lo));
+
+    // (truncated quotients are monotone in the numerator, and remainders are bounded by m)
+    if(op == bo_int_quotient) {
+        double q = lo / m, r = hi / m;
+        return {min(q, r), max(q, r), true, false};
+    }
+    double bound = abs(m) - 1;
+    return {lo >= 0 ? 0 : -bound, hi <= 0 ? 0 : bound, true, false};
+}
+
+/* ~ ~ ~ ~ ~ Built-ins ~ ~ ~ ~ ~ */
+
+// the enclosure of a step function that's nondecreasing over a, continuous if it doesn't step
+Interval steps(double (*f)(double), const Interval& a) {
+    double lo = f(a.lo), hi = f(a.hi);
+    return {lo, hi, a.def, a.cont && lo == hi};
+}
+
+Interval interval_floor(vector<Interval>& args) { return steps(floor, args[0]); }
+Interval interval_ceil(vector<Interval>& args) { return steps(ceil, args[0]); }
+
+Interval interval_int(vector<Interval>& args) {
+    const Interval& a = args[0];
+    if(!a.def || abs(a.lo) > TRUNC_MAX || abs(a.hi) > TRUNC_MAX) return Interval::entire();
+    return steps([](double n) { return (double) (long long) n; }, a);
+}
+
+Interval interval_abs(vector<Interval>& args) {
+    const Interval& a = args[0];
+    if(a.lo >= 0) return a;
+    if(a.hi <= 0) return -a;
+    return {0, max(-a.lo, a.hi), a.def, a.cont};
+}
+
+Interval interval_pow(vector<Interval>& args) { return pow(args[0], args[1]); }
+
+// (like int_factorial, in math.cpp)
+double factorial_of(long long n) {
+    double result = 1;
+    for(long long i = 2; i <= n; i++) result *= i;
+    return result;
+}
+
+// (factorial truncates its argument, and is NAN past 100)
+Interval interval_factorial(vector<Interval>& args) {
+    const Interval& a = args[0];
+    if(!a.def || a.lo >= 101) return Interval::entire();
+
+    double lo = factorial_of(max(a.lo, 0.0)), hi = factorial_of(min(a.hi, 100.0));
+    bool def = a.hi < 101;
+    return outward(lo, hi, def, def && a.cont && lo == hi);
+}
+
+Interval interval_deg(vector<Interval>& args) {
+    return monotone([](double r) { return r * 180 / M_PI; }, args[0]);
+}
+
+Interval interval_rad(vector<Interval>& args) {
+    return monotone([](double d) { return d * M_PI / 180; }, args[0]);
+}
+
+// whether a contains a point offset + k period, for an integer k (erring toward yes, by more than
+// the rounding of a's bounds)
+bool contains_period(const Interval& a, double offset, double period) {
+    double slack = 1e-9 * (period + abs(a.lo) + abs(a.hi));
+    double k = ceil((a.lo - offset) / period);
+    return offset + k * period <= a.hi + slack || offset + (k - 1) * period >= a.lo - slack;
+}
+
+// the enclosure of sin or cos, whose maxima are at peak + 2k pi and minima at peak + pi + 2k pi
+Interval sinusoid(double (*f)(double), const Interval& a, double peak) {
+    if(!isfinite(a.lo) || !isfinite(a.hi) || a.hi - a.lo >= 2 * M_PI) return {-1, 1, a.def, a.cont};
+
+    double p = f(a.lo), q = f(a.hi);
+    Interval result = outward(min(p, q), max(p, q), a.def, a.cont);
+    if(contains_period(a, peak, 2 * M_PI)) result.hi = 1;
+    if(contains_period(a, peak + M_PI, 2 * M_PI)) result.lo = -1;
+    result.lo = max(result.lo, -1.0);
+    result.hi = min(result.hi, 1.0);
+    return result;
+}
+
+Interval interval_sin(vector<Interval>& args) { return sinusoid(sin, args[0], M_PI / 2); }
+Interval interval_cos(vector<Interval>& args) { return sinusoid(cos, args[0], 0); }
+
+// (tan increases between its poles at pi/2 + k pi, and cot decreases between those at k pi)
+Interval interval_tan(vector<Interval>& args) {
+    const Interval& a = args[0];
+    if(!isfinite(a.lo) || !isfinite(a.hi) || a.hi - a.lo >= M_PI || contains_period(a, M_PI / 2, M_PI))
+        return Interval::entire();
+    return monotone(tan, a);
+}
+
+Interval interval_cot(vector<Interval>& args) {
+    const Interval& a = args[0];
+    if(!isfinite(a.lo) || !isfinite(a.hi) || a.hi - a.lo >= M_PI || contains_period(a, 0, M_PI))
+        return Interval::entire();
+    return monotone([](double x) { return 1 / tan(x); }, a, false);
+}
+
+Interval interval_csc(vector<Interval>& args) { return Interval::point(1) / interval_sin(args); }
+Interval interval_sec(vector<Interval>& args) { return Interval::point(1) / interval_cos(args); }
+
+// the enclosure of a function defined on [-1, 1] that's monotone over it
+Interval unit_domain(double (*f)(double), const Interval& a, bool increasing) {
+    if(a.hi < -1 || a.lo > 1) return Interval::entire();
+    bool def = a.lo >= -1 && a.hi <= 1;
+    Interval result = monotone(f, {max(a.lo, -1.0), min(a.hi, 1.0), a.def, a.cont}, increasing);
+    result.def = result.def && def;
+    result.cont = result.cont && def;
+    return result;
+}
+
+Interval interval_asin(vector<Interval>& args) { return unit_domain(asin, args[0], true); }
+Interval interval_acos(vector<Interval>& args) { return unit_domain(acos, args[0], false); }
+Interval interval_atan(vector<Interval>& args) { return monotone(atan, args[0]); }
+
+// the enclosure of a logarithm, which is defined for x > 0
+Interval logarithm(double (*f)(double), const Interval& a) {
+    if(a.hi <= 0) return Interval::entire();
+    if(a.lo <= 0) return outward(-INFINITY, f(a.hi), false, false);
+    return monotone(f, a);
+}
+
+Interval interval_ln(vector<Interval>& args) { return logarithm(log, args[0]); }
+Interval interval_lg(vector<Interval>& args) { return logarithm(log2, args[0]); }
+Interval interval_log(vector<Interval>& args) { return logarithm(log10, args[0]); }
+Interval interval_logb(vector<Interval>& args) { return logarithm(log, args[0]) / logarithm(log, args[1]); }
+
+struct IntervalKernel {
+    interval_fn fn;
+    int arity;
+};
+
+// (perm and comb of varying arguments would only be bounded by the whole line, and have none)
+const unordered_map<string, IntervalKernel> interval_kernels = {
+    {"sin", {interval_sin, 1}}, {"cos", {interval_cos, 1}}, {"tan", {interval_tan, 1}},
+    {"csc", {interval_csc, 1}}, {"sec", {interval_sec, 1}}, {"cot", {interval_cot, 1}},
+    {"asin", {interval_asin, 1}}, {"acos", {interval_acos, 1}}, {"atan", {interval_atan, 1}},
+    {"ln", {interval_ln, 1}}, {"lg", {interval_lg, 1}}, {"log", {interval_log, 1}},
+    {"logb", {interval_logb, 2}}, {"pow", {interval_pow, 2}}, {"deg", {interval_deg, 1}},
+    {"rad", {interval_rad, 1}}, {"abs", {interval_abs, 1}}, {"factorial", {interval_factorial, 1}},
+    {"floor", {interval_floor, 1}}, {"ceil", {interval_ceil, 1}}, {"int", {interval_int, 1}},
+};
+
+interval_fn find_interval_kernel(const string& fn_id, int num_args) {
+    auto kernel = interval_kernels.find(fn_id);
+    if(kernel == interval_kernels.end() || kernel->second.arity != num_args) return nullptr;
+    return kernel->second.fn;
+}
+
+/* ~ ~ ~ ~ ~ Evaluation ~ ~ ~ ~ ~ */
+
+bool has_interval_form(const BatchProgram& program) {
+    for(const BatchInstr& instr : program.code) {
+        if(instr.op == bo_nderiv || (instr.op == bo_call && !instr.interval)) return false;
+    }
+    return true;
+}
+
+Interval interval_eval(const BatchProgram& program, Interval x) {
+    vector<Interval> regs;
+    regs.reserve(program.code.size());
+    vector<Interval> args;
+
+    for(const BatchInstr& instr : program.code) {
+        switch(instr.op) {
+            case bo_const: regs.push_back(Interval::point(instr.val)); break;
+            case bo_var: regs.push_back(x); break;
+            case bo_neg: regs.push_back(-regs[instr.a]); break;
+            case bo_add: regs.push_back(regs[instr.a] + regs[instr.b]); break;
+            case bo_sub: regs.push_back(regs[instr.a] - regs[instr.b]); break;
+            case bo_mul: regs.push_back(regs[instr.a] * regs[instr.b]); break;
+            case bo_div: regs.push_back(regs[instr.a] / regs[instr.b]); break;
+            case bo_pow: regs.push_back(pow(regs[instr.a], regs[instr.b])); break;
+            case bo_call:
+                args.clear();
+                for(int k = 0; k < instr.num_args; k++) {
+                    args.push_back(regs[program.call_args[instr.first_arg + k]]);
+                }
+                regs.push_back(instr.interval(args)); // (see has_interval_form)
+                break;
+            case bo_nderiv: regs.push_back(Interval::entire()); break; // (see has_interval_form)
+            case bo_poly: { // (by Horner's scheme)
+                const double *c = &program.poly_coefs[instr.first_arg];
+                Interval acc = Interval::point(c[instr.num_args - 1]);
+                for(int k = instr.num_args - 2; k >= 0; k--) acc = acc * regs[instr.a] + Interval::point(c[k]);
+                regs.push_back(acc);
+                break;
+            }
+            default: regs.push_back(interval_op(instr.op, regs[instr.a], regs[instr.b])); break;
+        }
+    }
+    return regs[program.result];
+}
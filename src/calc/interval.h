@@ -0,0 +1,37 @@
+#ifndef INTERVAL
+#define INTERVAL
+
+#include "batch.h"
+
+/* ~ ~ ~ ~ ~ Interval Arithmetic ~ ~ ~ ~ ~ */
+
+/*
+ * Interval: an enclosure [lo, hi] of a function's values over an interval of its variable, so one
+ * evaluation bounds the function over a whole span of x: graphs skip the spans that are off the
+ * canvas without sampling them, and find the poles and jumps between samples (see draw). Each
+ * operation rounds its bounds outward by an ulp (wasm has no rounding modes), as it does libm's
+ * results, which are within an ulp. Two decorations qualify the bounds, which only enclose the
+ * finite values: def, that every value is a finite number, and cont, that the function is also
+ * continuous over the interval. Bounds are pessimistic when the variable appears more than once
+ * (x - x over [0, 1] is [-1, 1]), but they are still enclosures.
+ */
+
+struct Interval {
+    double lo, hi;
+    bool def = true, cont = true;
+
+    static Interval point(double val) { return {val, val, isfinite(val), isfinite(val)}; }
+    static Interval entire() { return {-INFINITY, INFINITY, false, false}; }
+};
+
+// whether every instruction of a batch program (see batch.h) has an interval form: built-ins
+// without one (perm, comb, tabulated functions) and nderiv don't
+bool has_interval_form(const BatchProgram& program);
+
+// the enclosure of a batch program over x, without the context
+Interval interval_eval(const BatchProgram& program, Interval x);
+
+// the enclosure of built-in fn_id called with num_args arguments, or nullptr if it has none
+interval_fn find_interval_kernel(const string& fn_id, int num_args);
+
+#endif // INTERVAL
@@ -0,0 +1,411 @@
+#include "jet.h"
+#include "numdiff.h"
+
+/* ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ Taylor Jets ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ */
+
+/* ~ ~ ~ ~ ~ Series Arithmetic ~ ~ ~ ~ ~ */
+
+// (all the jets of an evaluation have the same order)
+
+Jet Jet::variable(int order, double at) {
+    Jet x(order, at);
+    if(order > 0) x[1] = 1;
+    return x;
+}
+
+bool Jet::is_constant() const {
+    for(int k = 1; k < size(); k++) if((*this)[k] != 0) return false;
+    return true;
+}
+
+double Jet::derivative(int k) const {
+    double d = (*this)[k];
+    for(int i = 2; i <= k; i++) d *= i;
+    return d;
+}
+
+Jet operator+(Jet a, const Jet& b) {
+    for(int k = 0; k < a.size(); k++) a[k] += b[k];
+    return a;
+}
+
+Jet operator-(Jet a, const Jet& b) {
+    for(int k = 0; k < a.size(); k++) a[k] -= b[k];
+    return a;
+}
+
+Jet operator-(Jet a) {
+    for(int k = 0; k < a.size(); k++) a[k] = -a[k];
+    return a;
+}
+
+Jet operator*(Jet a, double s) {
+    for(int k = 0; k < a.size(); k++) a[k] *= s;
+    return a;
+}
+
+Jet operator*(const Jet& a, const Jet& b) {
+    Jet w(a.order());
+    for(int k = 0; k < w.size(); k++) {
+        double sum = 0;
+        for(int j = 0; j <= k; j++) sum += a[j] * b[k - j];
+        w[k] = sum;
+    }
+    return w;
+}
+
+// w = a / b solves a = w * b for w's coefficients in turn
+Jet operator/(const Jet& a, const Jet& b) {
+    Jet w(a.order());
+    for(int k = 0; k < w.size(); k++) {
+        double sum = a[k];
+        for(int j = 1; j <= k; j++) sum -= b[j] * w[k - j];
+        w[k] = sum / b[0];
+    }
+    return w;
+}
+
+// the w with w(at) = w0 and w' = u' r (so w = f(u) for f' = r(u))
+Jet integrate(double w0, const Jet& u, const Jet& r) {
+    Jet w(u.order(), w0);
+    for(int k = 1; k < w.size(); k++) {
+        double sum = 0;
+        for(int j = 1; j <= k; j++) sum += j * u[j] * r[k - j];
+        w[k] = sum / k;
+    }
+    return w;
+}
+
+Jet exp(const Jet& u) { // w' = u' w
+    Jet w(u.order(), exp(u[0]));
+    for(int k = 1; k < w.size(); k++) {
+        double sum = 0;
+        for(int j = 1; j <= k; j++) sum += j * u[j] * w[k - j];
+        w[k] = sum / k;
+    }
+    return w;
+}
+
+Jet log(const Jet& u) {
+    return integrate(log(u[0]), u, Jet(u.order(), 1) / u);
+}
+
+// u^a for a constant a
+Jet pow(const Jet& u, double a) {
+    int n = u.order();
+    if(u.is_constant()) return Jet(n, pow(u[0], a));
+
+    if(u[0] == 0) { // (the series below divides by u(at))
+        if(a != floor(a) || a < 0) throw jet_unsupported_error("power of 0 is not smooth");
+        if(a > n) return Jet(n); // u^a has no terms below x^a
+
+        Jet w(n, 1), base = u;
+        for(long e = a; e > 0; e >>= 1) {
+            if(e & 1) w = w * base;
+            if(e > 1) base = base * base;
+        }
+        return w;
+    }
+
+    // u w' = a u' w
+    Jet w(n, pow(u[0], a));
+    for(int k = 1; k <= n; k++) {
+        double sum = 0;
+        for(int j = 1; j <= k; j++) sum += ((a + 1) * j - k) * u[j] * w[k - j];
+        w[k] = sum / (k * u[0]);
+    }
+    return w;
+}
+
+Jet pow(const Jet& u, const Jet& v) {
+    if(v.is_constant()) return pow(u, v[0]);
+    if(!(u[0] > 0)) throw jet_unsupported_error("variable power of a non-positive base");
+    return exp(v * log(u));
+}
+
+// s = sin u and c = cos u, from s' = u' c and c' = -u' s
+void sin_cos(const Jet& u, Jet& s, Jet& c) {
+    s = Jet(u.order(), sin(u[0]));
+    c = Jet(u.order(), cos(u[0]));
+    for(int k = 1; k < s.size(); k++) {
+        double s_sum = 0, c_sum = 0;
+        for(int j = 1; j <= k; j++) {
+            s_sum += j * u[j] * c[k - j];
+            c_sum -= j * u[j] * s[k - j];
+        }
+        s[k] = s_sum / k;
+        c[k] = c_sum / k;
+    }
+}
+
+Jet tan(const Jet& u) { // w' = u' (1 + w^2)
+    Jet w(u.order(), tan(u[0])), q(u.order(), 1 + w[0] * w[0]);
+    for(int k = 1; k < w.size(); k++) {
+        double sum = 0;
+        for(int j = 1; j <= k; j++) sum += j * u[j] * q[k - j];
+        w[k] = sum / k;
+
+        for(int j = 0; j <= k; j++) q[k] += w[j] * w[k - j];
+    }
+    return w;
+}
+
+/* ~ ~ ~ ~ ~ Built-in Functions ~ ~ ~ ~ ~ */
+
+Jet jet_sin(vector<Jet>& args) { Jet s(0), c(0); sin_cos(args[0], s, c); return s; }
+Jet jet_cos(vector<Jet>& args) { Jet s(0), c(0); sin_cos(args[0], s, c); return c; }
+Jet jet_tan(vector<Jet>& args) { return tan(args[0]); }
+Jet jet_csc(vector<Jet>& args) { Jet s(0), c(0); sin_cos(args[0], s, c); return Jet(s.order(), 1) / s; }
+Jet jet_sec(vector<Jet>& args) { Jet s(0), c(0); sin_cos(args[0], s, c); return Jet(c.order(), 1) / c; }
+Jet jet_cot(vector<Jet>& args) { return Jet(args[0].order(), 1) / tan(args[0]); }
+
+Jet jet_asin(vector<Jet>& args) {
+    Jet& u = args[0];
+    return integrate(asin(u[0]), u, pow(Jet(u.order(), 1) - u * u, -0.5));
+}
+
+Jet jet_acos(vector<Jet>& args) {
+    Jet& u = args[0];
+    return integrate(acos(u[0]), u, -pow(Jet(u.order(), 1) - u * u, -0.5));
+}
+
+Jet jet_atan(vector<Jet>& args) {
+    Jet& u = args[0];
+    return integrate(atan(u[0]), u, Jet(u.order(), 1) / (Jet(u.order(), 1) + u * u));
+}
+
+Jet jet_ln(vector<Jet>& args) { return log(args[0]); }
+Jet jet_lg(vector<Jet>& args) { return log(args[0]) * (1 / M_LN2); }
+Jet jet_log(vector<Jet>& args) { return log(args[0]) * (1 / M_LN10); }
+Jet jet_logb(vector<Jet>& args) { return log(args[0]) / log(args[1]); }
+Jet jet_pow(vector<Jet>& args) { return pow(args[0], args[1]); }
+Jet jet_deg(vector<Jet>& args) { return args[0] * (180 / M_PI); }
+Jet jet_rad(vector<Jet>& args) { return args[0] * (M_PI / 180); }
+
+Jet jet_abs(vector<Jet>& args) {
+    Jet& u = args[0];
+    if(u[0] == 0 && !u.is_constant()) throw jet_unsupported_error("abs is not smooth at 0");
+    return u[0] < 0 ? -u : u;
+}
+
+// piecewise constant functions (their derivatives are 0 between the steps)
+Jet jet_floor(vector<Jet>& args) { return Jet(args[0].order(), floor(args[0][0])); }
+Jet jet_ceil(vector<Jet>& args) { return Jet(args[0].order(), ceil(args[0][0])); }
+Jet jet_int(vector<Jet>& args) { return Jet(args[0].order(), (double) (long long) args[0][0]); }
+
+Jet jet_max(vector<Jet>& args) {
+    if(args.empty()) throw jet_unsupported_error("max of no arguments");
+    int best = 0;
+    for(int i = 1; i < args.size(); i++) if(args[i][0] > args[best][0]) best = i;
+    return args[best];
+}
+
+Jet jet_min(vector<Jet>& args) {
+    if(args.empty()) throw jet_unsupported_error("min of no arguments");
+    int best = 0;
+    for(int i = 1; i < args.size(); i++) if(args[i][0] < args[best][0]) best = i;
+    return args[best];
+}
+
+struct JetKernel {
+    jet_fn fn;
+    int arity; // -1 for variadic
+};
+
+const unordered_map<string, JetKernel> jet_kernels = {
+    {"sin", {jet_sin, 1}}, {"cos", {jet_cos, 1}}, {"tan", {jet_tan, 1}},
+    {"csc", {jet_csc, 1}}, {"sec", {jet_sec, 1}}, {"cot", {jet_cot, 1}},
+    {"asin", {jet_asin, 1}}, {"acos", {jet_acos, 1}}, {"atan", {jet_atan, 1}},
+    {"ln", {jet_ln, 1}}, {"lg", {jet_lg, 1}}, {"log", {jet_log, 1}}, {"logb", {jet_logb, 2}},
+    {"pow", {jet_pow, 2}}, {"deg", {jet_deg, 1}}, {"rad", {jet_rad, 1}}, {"abs", {jet_abs, 1}},
+    {"floor", {jet_floor, 1}}, {"ceil", {jet_ceil, 1}}, {"int", {jet_int, 1}},
+    {"max", {jet_max, -1}}, {"min", {jet_min, -1}},
+};
+
+jet_fn find_jet_kernel(const string& fn_id, int num_args) {
+    auto kernel = jet_kernels.find(fn_id);
+    if(kernel == jet_kernels.end() || (kernel->second.arity != -1 && kernel->second.arity != num_args)) return nullptr;
+    return kernel->second.fn;
+}
+
+/* ~ ~ ~ ~ ~ Evaluation ~ ~ ~ ~ ~ */
+
+// evaluates trees on jets, like TreeNode::eval does on numbers
+struct JetEvaluator {
+    int order;
+    const string *var_id; // a global identifier that is the variable (see nderiv), or nullptr
+    vector<pair<const string *, Jet>> *frame; // the parameters of the user function evaluated
+    bool caller_scope; // whether identifiers outside the frame are in the caller's scope
+
+    Jet eval(TreeNode& node);
+    Jet lookup(const string& id);
+    Jet call(const string& fn_id, vector<Jet>& args);
+};
+
+Jet JetEvaluator::lookup(const string& id) {
+    if(frame) for(auto& param : *frame) if(*param.first == id) return param.second;
+
+    if(caller_scope && ctx->param_override && ctx->param_id[id])
+        return Jet(order, ctx->params[ctx->param_id[id] - 1]);
+    if(var_id && id == *var_id) return Jet::variable(order, ctx->identifier_table[id]);
+    return Jet(order, ctx->identifier_table[id]);
+}
+
+Jet JetEvaluator::call(const string& fn_id, vector<Jet>& args) {
+    Function *fn = ctx->fn_table[fn_id].get();
+    if(fn == nullptr) throw invalid_function_call_error("no such function: '" + fn_id + "'");
+
+    if(fn->is_user_fn()) {
+        UserFunction *user_fn = (UserFunction *) fn;
+        if(user_fn->arg_ids.size() != args.size())
+            throw invalid_function_call_error("wrong number of arguments (" + to_string(args.size()) +
+                                              " given, " + to_string(user_fn->arg_ids.size()) +
+                                              " expected)");
+
+        vector<pair<const string *, Jet>> params;
+        for(int i = 0; i < args.size(); i++) params.emplace_back(&user_fn->arg_ids[i], std::move(args[i]));
+
+        JetEvaluator body {order, var_id, &params, false};
+        return body.eval(*user_fn->tree);
+    }
+
+    auto kernel = jet_kernels.find(fn_id);
+    if(kernel != jet_kernels.end()) {
+        if(kernel->second.arity != -1 && kernel->second.arity != args.size())
+            throw jet_unsupported_error("wrong number of arguments"); // (reported by eval)
+        return kernel->second.fn(args);
+    }
+
+    // any other built-in is constant where its arguments are
+    vector<const double *> arg_cols;
+    for(Jet& arg : args) {
+        if(!arg.is_constant()) throw jet_unsupported_error("no series for " + fn_id);
+        arg_cols.push_back(&arg[0]);
+    }
+    Jet result(order);
+    if(!fn->eval_batch(arg_cols.data(), &result[0], 1)) throw jet_unsupported_error("no series for " + fn_id);
+    return result;
+}
+
+Jet JetEvaluator::eval(TreeNode& node) {
+    enum node_type type = node.type();
+    switch(type) {
+        case nt_num: return Jet(order, ((NumberNode&) node).val);
+        case nt_id: return lookup(((VariableNode&) node).id);
+        case nt_negation: return -eval(*((UnaryOpNode&) node).arg);
+        case nt_fn_call: {
+            vector<Jet> args;
+            for(auto& arg : ((FunctionCallNode&) node).args) args.push_back(eval(*arg));
+            return call(((FunctionCallNode&) node).fn_id, args);
+        }
+        case nt_nary_sum:
+        case nt_nary_product: {
+            NaryOpNode& nary = (NaryOpNode&) node;
+            Jet result(order, type == nt_nary_sum ? 0 : 1);
+            for(auto& arg : nary.args) result = type == nt_nary_sum ? result + eval(*arg) : result * eval(*arg);
+            return result;
+        }
+        case nt_assignment: throw jet_unsupported_error("assignment");
+        case nt_deriv: throw jet_unsupported_error("derivative of a derivative");
+        default: break;
+    }
+
+    if(!is_binary_op(type)) throw jet_unsupported_error("unknown node");
+    BinaryOpNode& binary = (BinaryOpNode&) node;
+    Jet left = eval(*binary.left), right = eval(*binary.right);
+
+    switch(type) {
+        case nt_sum: return left + right;
+        case nt_difference: return left - right;
+        case nt_product: return left * right;
+        case nt_quotient: return left / right;
+        case nt_exponentiation: return pow(left, right);
+        default: { // comparisons and integer division are piecewise constant
+            BinaryOpNode constant(make_unique<NumberNode>(left[0]), make_unique<NumberNode>(right[0]), binary.op);
+            return Jet(order, constant.eval());
+        }
+    }
+}
+
+/* ~ ~ ~ ~ ~ Derivatives ~ ~ ~ ~ ~ */
+
+double taylor_derivative(TreeNode& tree, const string& id, double at) {
+    double old_value = ctx->identifier_table[id];
+    ctx->identifier_table[id] = at;
+
+    try {
+        JetEvaluator jets {1, &id, nullptr, true};
+        double d = jets.eval(tree).derivative(1);
+        ctx->identifier_table[id] = old_value;
+        return d;
+    } catch(...) {
+        ctx->identifier_table[id] = old_value;
+        throw;
+    }
+}
+
+// (with the same series arithmetic as JetEvaluator, so batches of nderiv agree with nderiv)
+double jet_derivative(const BatchProgram& program, int order, double at) {
+    vector<Jet> regs;
+    regs.reserve(program.code.size());
+    vector<Jet> args;
+
+    for(const BatchInstr& instr : program.code) {
+        switch(instr.op) {
+            case bo_const: regs.emplace_back(order, instr.val); break;
+            case bo_var: regs.push_back(Jet::variable(order, at)); break;
+            case bo_neg: regs.push_back(-regs[instr.a]); break;
+            case bo_add: regs.push_back(regs[instr.a] + regs[instr.b]); break;
+            case bo_sub: regs.push_back(regs[instr.a] - regs[instr.b]); break;
+            case bo_mul: regs.push_back(regs[instr.a] * regs[instr.b]); break;
+            case bo_div: regs.push_back(regs[instr.a] / regs[instr.b]); break;
+            case bo_pow: regs.push_back(pow(regs[instr.a], regs[instr.b])); break;
+            case bo_call: {
+                args.clear();
+                for(int k = 0; k < instr.num_args; k++) {
+                    args.push_back(regs[program.call_args[instr.first_arg + k]]);
+                }
+                if(instr.jet) {
+                    regs.push_back(instr.jet(args));
+                    break;
+                }
+
+                const double *arg_cols[BATCH_MAX_CALL_ARGS];
+                for(int k = 0; k < instr.num_args; k++) {
+                    if(!args[k].is_constant()) throw jet_unsupported_error("no series");
+                    arg_cols[k] = &args[k][0];
+                }
+                regs.emplace_back(order);
+                instr.fn->eval_batch(arg_cols, &regs.back()[0], 1);
+                break;
+            }
+            case bo_nderiv: throw jet_unsupported_error("derivative of a derivative");
+            case bo_poly: { // (by Horner's scheme)
+                const double *c = &program.poly_coefs[instr.first_arg];
+                Jet acc(order, c[instr.num_args - 1]);
+                for(int k = instr.num_args - 2; k >= 0; k--) acc = acc * regs[instr.a] + Jet(order, c[k]);
+                regs.push_back(acc);
+                break;
+            }
+            default: // comparisons and integer division are piecewise constant
+                regs.emplace_back(order, apply_op(instr.op, regs[instr.a][0], regs[instr.b][0]));
+                break;
+        }
+    }
+    return regs[program.result].derivative(order);
+}
+
+double DerivativeNode::nderiv(int n, double at) {
+    try {
+        vector<Jet> args {Jet::variable(n, at)};
+        JetEvaluator jets {n, nullptr, nullptr, false};
+        return jets.call(fn_id, args).derivative(n);
+    } catch(jet_unsupported_error& e) {
+        double error;
+        return ridders_derivative([this](double x) {
+            vector<unique_ptr<TreeNode>> arg_vec;
+            arg_vec.push_back(make_unique<NumberNode>(x));
+            return call_function(fn_id, arg_vec);
+        }, n, at, error);
+    }
+}
@@ -0,0 +1,58 @@
+#ifndef JET
+#define JET
+
+#include "batch.h"
+
+/* ~ ~ ~ ~ ~ Taylor Jets ~ ~ ~ ~ ~ */
+
+/*
+ * Jet: a truncated Taylor series of a function about a point, c[k] = f^(k)(at) / k! for k up to
+ * the jet's order. Arithmetic on jets is arithmetic on series, so evaluating a function's tree
+ * once on the jet of its variable, (at, 1, 0, ...), gives all of its derivatives up to that
+ * order, exact up to rounding. Finite differences take 2^n evaluations for an n'th derivative
+ * and lose digits with each order. f'(x) and nderiv differentiate on jets, and fall back to
+ * Ridders' method (see numdiff.h) when a tree has something jets don't support (assignments,
+ * derivatives of derivatives, and built-ins without a series, like gcd).
+ */
+constexpr int JET_INLINE_ORDER = 7; // jets up to this order don't allocate
+
+struct Jet {
+    int n; // order
+    double small[JET_INLINE_ORDER + 1]; // Taylor coefficients (if n <= JET_INLINE_ORDER)
+    vector<double> large; // (otherwise)
+
+    Jet(int order, double val = 0) : n(order) {
+        if(n > JET_INLINE_ORDER) large.resize(n + 1);
+        fill(data(), data() + n + 1, 0.0);
+        data()[0] = val;
+    }
+
+    static Jet variable(int order, double at);
+
+    double *data() { return n > JET_INLINE_ORDER ? large.data() : small; }
+    const double *data() const { return n > JET_INLINE_ORDER ? large.data() : small; }
+    double& operator[](int k) { return data()[k]; }
+    double operator[](int k) const { return data()[k]; }
+
+    int order() const { return n; }
+    int size() const { return n + 1; }
+    bool is_constant() const;
+    double derivative(int k) const; // k'th derivative at the point
+};
+
+// thrown while evaluating on jets by what they don't support (callers fall back to differences)
+struct jet_unsupported_error : public calculator_error {
+    jet_unsupported_error(const string& what) : calculator_error(what) { }
+};
+
+// the derivative of tree with respect to identifier id at %at%, with other identifiers evaluated
+// in the caller's scope (see nderiv)
+double taylor_derivative(TreeNode& tree, const string& id, double at);
+
+// the order'th derivative of a batch program (see batch.h) at %at%, on jets, without the context
+double jet_derivative(const BatchProgram& program, int order, double at);
+
+// the series of built-in fn_id called with num_args arguments, or nullptr if it has none
+jet_fn find_jet_kernel(const string& fn_id, int num_args);
+
+#endif // JET
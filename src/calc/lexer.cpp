@@ -43,6 +43,10 @@ const regex op_regex("^(\\+|-|\\*\\*|\\*|//|/|%|\\^|\\(|\\)|=|==|!=|>|<|>=|<=|,|
 
 vector<unique_ptr<Token>> tokenize(const string& expr_str) {
     vector<unique_ptr<Token>> token_vec;
+    const char *end = expr_str.data() + expr_str.size();
+    // each pattern is anchored at the current character; match_continuous keeps regex_search from
+    // retrying the (failing) match at every later position in the string
+    const regex_constants::match_flag_type anchored = regex_constants::match_continuous;
 
     for(int i = 0; i < expr_str.length();) {
         if(isspace(expr_str[i])) { // skip whitespace
@@ -52,10 +56,10 @@ vector<unique_ptr<Token>> tokenize(const string& expr_str) {
 
         cmatch match;
 
-        if(regex_search(&expr_str[i], match, var_regex)) { // matched a variable
+        if(regex_search(&expr_str[i], end, match, var_regex, anchored)) { // matched a variable
             string var_id = string(expr_str, i, match.length());
             token_vec.push_back(unique_ptr<Token> {new VarToken(var_id)});
-        } else if(regex_search(&expr_str[i], match, num_regex)) { // matched a numeric literal
+        } else if(regex_search(&expr_str[i], end, match, num_regex, anchored)) { // matched a numeric literal
             double num_val = 0;
             string match_str = string(expr_str, i, match.length());
 
@@ -74,7 +78,7 @@ vector<unique_ptr<Token>> tokenize(const string& expr_str) {
             }
 
             token_vec.push_back(unique_ptr<Token> {new NumToken(num_val)});
-        } else if(regex_search(&expr_str[i], match, op_regex)) { // matched an operator
+        } else if(regex_search(&expr_str[i], end, match, op_regex, anchored)) { // matched an operator
             string op = string(expr_str, i, match.length());
             token_vec.push_back(unique_ptr<Token> {new OpToken(op)});
         } else { // invalid token
@@ -1,4 +1,6 @@
-#include "cas.h"
+#include "rules.h"
+#include "roots.h"
+#include "cheb.h"
 
 unique_ptr<TreeNode> print_tree(unique_ptr<TreeNode>&& node);
 unique_ptr<TreeNode> get_last_answer(unique_ptr<TreeNode>&& node);
@@ -11,44 +13,64 @@ unique_ptr<TreeNode> ungraph_axes(unique_ptr<TreeNode>&& node);
 unique_ptr<TreeNode> set_graph_window(unique_ptr<TreeNode>&& node);
 
 unique_ptr<TreeNode> sqrt_macro(unique_ptr<TreeNode>&& node);
+unique_ptr<TreeNode> roots_macro(unique_ptr<TreeNode>&& node);
+unique_ptr<TreeNode> tabulate(unique_ptr<TreeNode>&& node);
 
 unique_ptr<TreeNode> deriv(unique_ptr<TreeNode>&& node);
 unique_ptr<TreeNode> simp(unique_ptr<TreeNode>&& node);
 unique_ptr<TreeNode> expand(unique_ptr<TreeNode>&& node);
+unique_ptr<TreeNode> grad(unique_ptr<TreeNode>&& node);
+unique_ptr<TreeNode> jacobian(unique_ptr<TreeNode>&& node);
+unique_ptr<TreeNode> add_simp_rule(unique_ptr<TreeNode>&& node);
+unique_ptr<TreeNode> add_deriv_rule(unique_ptr<TreeNode>&& node);
+unique_ptr<TreeNode> print_cas_cache_stats(unique_ptr<TreeNode>&& node);
 
 void init_macro_functions() {
     // debug/runtime:
-    macro_table["print_tree"] = make_unique<macro_fn>(print_tree);
-    macro_table["ans"] = make_unique<macro_fn>(get_last_answer);
-    macro_table["clear"] = make_unique<macro_fn>(clear_screen);
+    ctx->macro_table["print_tree"] = make_unique<macro_fn>(print_tree);
+    ctx->macro_table["ans"] = make_unique<macro_fn>(get_last_answer);
+    ctx->macro_table["clear"] = make_unique<macro_fn>(clear_screen);
 
     // graphing:
-    macro_table["graph"] = make_unique<macro_fn>(graph_expression);
-    macro_table["ungraph"] = make_unique<macro_fn>(ungraph_expression);
-    macro_table["graph_axes"] = make_unique<macro_fn>(graph_axes);
-    macro_table["ungraph_axes"] = make_unique<macro_fn>(ungraph_axes);
-    macro_table["set_graph_window"] = make_unique<macro_fn>(set_graph_window);
+    ctx->macro_table["graph"] = make_unique<macro_fn>(graph_expression);
+    ctx->macro_table["ungraph"] = make_unique<macro_fn>(ungraph_expression);
+    ctx->macro_table["graph_axes"] = make_unique<macro_fn>(graph_axes);
+    ctx->macro_table["ungraph_axes"] = make_unique<macro_fn>(ungraph_axes);
+    ctx->macro_table["set_graph_window"] = make_unique<macro_fn>(set_graph_window);
 
     // math:
-    macro_table["sqrt"] = make_unique<macro_fn>(sqrt_macro);
+    ctx->macro_table["sqrt"] = make_unique<macro_fn>(sqrt_macro);
+    ctx->macro_table["roots"] = make_unique<macro_fn>(roots_macro);
+    ctx->macro_table["tabulate"] = make_unique<macro_fn>(tabulate);
 
     // cas:
-    macro_table["deriv"] = make_unique<macro_fn>(deriv);
-    macro_table["simp"] = make_unique<macro_fn>(simp);
-    macro_table["expand"] = make_unique<macro_fn>(expand);
+    ctx->macro_table["deriv"] = make_unique<macro_fn>(deriv);
+    ctx->macro_table["simp"] = make_unique<macro_fn>(simp);
+    ctx->macro_table["expand"] = make_unique<macro_fn>(expand);
+    ctx->macro_table["grad"] = make_unique<macro_fn>(grad);
+    ctx->macro_table["jacobian"] = make_unique<macro_fn>(jacobian);
+    ctx->macro_table["rule"] = make_unique<macro_fn>(add_simp_rule);
+    ctx->macro_table["deriv_rule"] = make_unique<macro_fn>(add_deriv_rule);
+    ctx->macro_table["cas_cache_stats"] = make_unique<macro_fn>(print_cas_cache_stats);
 }
 
 void init_macro_constants() {
-    identifier_table["DERIV_STEP"] = DERIV_STEP;
-    identifier_table["INT_NUM_RECTS"] = 100;
-    identifier_table["TICS_ENABLED"] = 1;
-
-    identifier_table["ECHO_AUTO"] = 1;
-    identifier_table["ECHO_TREE"] = 0;
-    identifier_table["ECHO_ANS"] = 0;
-    identifier_table["PARTIAL"] = 1;
-    identifier_table["AUTO_SIMP"] = 1;
-    identifier_table["INT_POWER_EXPANSION_THRESHOLD"] = 3;
+    ctx->identifier_table["DERIV_ERROR"] = 0;
+    ctx->identifier_table["INT_ABS_TOL"] = 1e-10;
+    ctx->identifier_table["INT_REL_TOL"] = 1e-10;
+    ctx->identifier_table["INT_MAX_EVALS"] = 10000;
+    ctx->identifier_table["INT_ERROR"] = 0;
+    ctx->identifier_table["TABULATE_TOL"] = 1e-12;
+    ctx->identifier_table["TICS_ENABLED"] = 1;
+    ctx->identifier_table["PLOT_FAST_MATH"] = 1;
+
+    ctx->identifier_table["ECHO_AUTO"] = 1;
+    ctx->identifier_table["ECHO_TREE"] = 0;
+    ctx->identifier_table["ECHO_ANS"] = 0;
+    ctx->identifier_table["PARTIAL"] = 1;
+    ctx->identifier_table["AUTO_SIMP"] = 1;
+    ctx->identifier_table["INT_POWER_EXPANSION_THRESHOLD"] = 64;
+    ctx->identifier_table["POLY_EXPANSION_THRESHOLD"] = 50000;
 }
 
 unique_ptr<TreeNode> tree_node_exe_macro(unique_ptr<TreeNode>&& node) {
@@ -69,11 +91,11 @@ unique_ptr<TreeNode> print_tree(unique_ptr<TreeNode>&& node) {
 }
 
 unique_ptr<TreeNode> get_last_answer(unique_ptr<TreeNode>&& node) {
-    return make_unique<NumberNode>(last_answer);
+    return make_unique<NumberNode>(ctx->last_answer);
 }
 
 unique_ptr<TreeNode> clear_screen(unique_ptr<TreeNode>&& node) {
-    emscripten_run_script("clear_screen();");
+    platform_clear_screen();
     return make_unique<NumberNode>(NAN);
 }
 
@@ -93,7 +115,7 @@ unique_ptr<TreeNode> ungraph_expression(unique_ptr<TreeNode>&& node) {
     vector<unique_ptr<TreeNode>>& args = ((FunctionCallNode *)node.get())->args;
     int arg = args.size() ? args[0]->eval() : 0;
 
-    emscripten_run_script(("remove_graph_fn(" + to_string(arg) + ")").data());
+    platform_remove_graph_fn(arg);
 
     return make_unique<NumberNode>(NAN);
 }
@@ -120,11 +142,7 @@ unique_ptr<TreeNode> set_graph_window(unique_ptr<TreeNode>&& node) {
     double x_max = x_min + width;
     double y_max = y_min + height;
 
-    emscripten_run_script(("x_min = " + to_string(x_min) + ","
-                           "y_min = " + to_string(y_min) + ","
-                           "x_max = " + to_string(x_max) + ","
-                           "y_max = " + to_string(y_max) + ","
-                           "graph_dimensions_changed = true;").c_str());
+    platform_set_graph_window(x_min, y_min, x_max, y_max);
 
     return make_unique<NumberNode>(NAN);
 }
@@ -138,15 +156,61 @@ unique_ptr<TreeNode> sqrt_macro(unique_ptr<TreeNode>&& node) {
     return make_unique<BinaryOpNode>(std::move(args[0]), make_unique<NumberNode>(0.5), "^");
 }
 
-/* ~ ~ ~ ~ ~ Computer Algebra System Functions ~ ~ ~ ~ ~ */
+// roots(expr, var, a, b[, n]): the roots of expr in var over [a, b], as a tuple, from a scan of n
+// intervals (ROOT_SCAN_INTERVALS by default) for sign changes (see find_roots). A macro, as
+// functions evaluate to one number.
+unique_ptr<TreeNode> roots_macro(unique_ptr<TreeNode>&& node) {
+    vector<unique_ptr<TreeNode>>& args = ((FunctionCallNode *)node.get())->args;
+    if(args.size() != 4 && args.size() != 5) throw calculator_error("roots(...) accepts 4 or 5 "
+                                                                    "arguments: got " + to_string(args.size()));
+    if(args[1]->type() != nt_id) throw invalid_function_call_error("argument 2 of roots (" +
+                                       args[1]->to_string() + ") is not an identifier");
+
+    double intervals = args.size() == 5 ? args[4]->eval() : ROOT_SCAN_INTERVALS;
+    if(!(intervals >= 1 && intervals <= INT_MAX - 1))
+        throw invalid_argument_error("roots needs at least 1 interval: got " + args[4]->to_string());
+
+    string var_id = ((VariableNode *) args[1].get())->id;
+    vector<unique_ptr<TreeNode>> roots;
+    for(double root : expression_roots(*args[0], var_id, args[2]->eval(), args[3]->eval(), intervals))
+        roots.push_back(make_unique<NumberNode>(root));
+    return make_unique<FunctionCallNode>("tuple", std::move(roots));
+}
+
+// tabulate(f, a, b[, tol]): replaces user function f (of one argument) by a TabulatedFunction,
+// whose table on [a, b] is within tol (TABULATE_TOL by default) relative to f's largest value
+// there (see cheb.h). Its value is the number of pieces of the table.
+unique_ptr<TreeNode> tabulate(unique_ptr<TreeNode>&& node) {
+    vector<unique_ptr<TreeNode>>& args = ((FunctionCallNode *)node.get())->args;
+    if(args.size() != 3 && args.size() != 4) throw calculator_error("tabulate(...) accepts 3 or 4 "
+                                                                    "arguments: got " + to_string(args.size()));
+
+    string fn_id = args[0]->type() == nt_id ? ((VariableNode *) args[0].get())->id : "";
+    Function *fn = ctx->fn_table[fn_id].get();
+    if(fn == nullptr || !fn->is_user_fn() || ((UserFunction *) fn)->arg_ids.size() != 1)
+        throw invalid_function_call_error("argument 1 of tabulate (" + args[0]->to_string() +
+                                          ") is not a user function of 1 argument");
+
+    double a = args[1]->eval(), b = args[2]->eval();
+    double tol = args.size() == 4 ? args[3]->eval() : get_id_value("TABULATE_TOL");
+    if(!(isfinite(a) && isfinite(b) && a < b))
+        throw invalid_argument_error("tabulate needs finite bounds a < b: got " + args[1]->to_string() +
+                                     " and " + args[2]->to_string());
+    if(!(tol > 0)) throw invalid_argument_error("tabulate needs a tolerance > 0: got " + NumberNode(tol).to_string());
+
+    auto tabulated = make_unique<TabulatedFunction>(std::move(*(UserFunction *) fn), a, b, tol);
+    int num_pieces = tabulated->table.num_pieces();
+    ctx->fn_table[fn_id] = std::move(tabulated);
+    return make_unique<NumberNode>(num_pieces);
+}
 
-extern string diff_id;
+/* ~ ~ ~ ~ ~ Computer Algebra System Functions ~ ~ ~ ~ ~ */
 
 unique_ptr<TreeNode> deriv(unique_ptr<TreeNode>&& node) {
     vector<unique_ptr<TreeNode>>& args = ((FunctionCallNode *)node.get())->args;
 
     if(args.size() == 1) { // TODO differentiate w/r/t x by default
-        diff_id = "x";
+        ctx->diff_id = "x";
     } else if(args.size() != 2) {
         throw calculator_error("deriv(...) accepts exactly 2 argument; got " +
                                 to_string(args.size()) + " instead");
@@ -154,10 +218,10 @@ unique_ptr<TreeNode> deriv(unique_ptr<TreeNode>&& node) {
         if(args[1]->type() != nt_id) throw calculator_error("can't differentiate with respect to "
                                                             "non-identifier");
 
-        diff_id = ((VariableNode *)args[1].get())->id;
+        ctx->diff_id = ((VariableNode *)args[1].get())->id;
     }
 
-    is_partial = get_id_value("PARTIAL");
+    ctx->is_partial = get_id_value("PARTIAL");
 
     if(get_id_value("AUTO_SIMP")) return pretty_tree(binarize(symb_simp(symb_deriv(std::move(args[0])))));
     else return symb_deriv(std::move(args[0]));
@@ -182,3 +246,105 @@ unique_ptr<TreeNode> expand(unique_ptr<TreeNode>&& node) {
 
     return pretty_tree(binarize(symb_expand(std::move(args[0]))));
 }
+
+// the identifiers a grad or jacobian call differentiates with respect to (its args after the first)
+vector<string> gradient_ids(vector<unique_ptr<TreeNode>>& args, const string& macro) {
+    if(args.size() < 2)
+        throw calculator_error(macro + "(...) needs an expression and at least 1 variable; got " +
+                                to_string(args.size()) + " argument(s)");
+
+    vector<string> ids;
+    for(int i = 1; i < args.size(); i++) {
+        if(args[i]->type() != nt_id) throw calculator_error("can't differentiate with respect to "
+                                                            "non-identifier");
+        ids.push_back(((VariableNode *)args[i].get())->id);
+    }
+    return ids;
+}
+
+// a tuple of the partial derivatives, simplified if AUTO_SIMP is set
+unique_ptr<TreeNode> partials_tuple(vector<unique_ptr<TreeNode>>&& partials) {
+    if(get_id_value("AUTO_SIMP")) {
+        for(auto& partial : partials) partial = pretty_tree(binarize(symb_simp(std::move(partial))));
+    }
+    return make_unique<FunctionCallNode>("tuple", std::move(partials));
+}
+
+// grad(expr, x, y, ...): the gradient, tuple(d(expr)/dx, d(expr)/dy, ...), from one (reverse
+// mode) pass over the expression; other identifiers are treated as constants.
+unique_ptr<TreeNode> grad(unique_ptr<TreeNode>&& node) {
+    vector<unique_ptr<TreeNode>>& args = ((FunctionCallNode *)node.get())->args;
+    vector<string> ids = gradient_ids(args, "grad");
+
+    vector<unique_ptr<TreeNode>> trees;
+    trees.push_back(std::move(args[0]));
+    return partials_tuple(std::move(symb_jacobian(std::move(trees), ids)[0]));
+}
+
+// jacobian(tuple(f, g, ...), x, y, ...): the rows tuple(df/dx, df/dy, ...), tuple(dg/dx, ...), ...
+// of the jacobian matrix, as a tuple; the outputs share their common subexpressions.
+unique_ptr<TreeNode> jacobian(unique_ptr<TreeNode>&& node) {
+    vector<unique_ptr<TreeNode>>& args = ((FunctionCallNode *)node.get())->args;
+    vector<string> ids = gradient_ids(args, "jacobian");
+
+    vector<unique_ptr<TreeNode>> trees;
+    if(args[0]->type() == nt_fn_call && ((FunctionCallNode *)args[0].get())->fn_id == "tuple")
+        trees = std::move(((FunctionCallNode *)args[0].get())->args);
+    else trees.push_back(std::move(args[0]));
+
+    vector<unique_ptr<TreeNode>> rows;
+    for(auto& row : symb_jacobian(std::move(trees), ids)) rows.push_back(partials_tuple(std::move(row)));
+    return make_unique<FunctionCallNode>("tuple", std::move(rows));
+}
+
+// rule: adds a simplification rule: simp rewrites subtrees matching the pattern (once it's
+// simplified itself) to the replacement. Identifiers starting with '_' in the pattern match
+// any subtree, e.g. rule(sin(_x)^2 + cos(_x)^2, 1).
+unique_ptr<TreeNode> add_simp_rule(unique_ptr<TreeNode>&& node) {
+    vector<unique_ptr<TreeNode>>& args = ((FunctionCallNode *)node.get())->args;
+
+    if(args.size() != 2)
+        throw calculator_error("rule(...) accepts exactly 2 arguments; got " +
+                                to_string(args.size()) + " instead");
+
+    unique_ptr<TreeNode> pattern = symb_simp(std::move(args[0]));
+    if(is_pattern_var(*pattern)) throw calculator_error("rule pattern can't match every expression");
+
+    ctx->simp_rules->add(*pattern, *fold_constants(std::move(args[1])));
+    if(ctx->cas_cache) ctx->cas_cache->clear();
+    return make_unique<NumberNode>(NAN);
+}
+
+// deriv_rule: adds a differentiation rule, e.g. deriv_rule(log(_u), _du / (_u * ln(10))): in the
+// derivative, `_du` stands for the derivative of whatever `_u` matched.
+unique_ptr<TreeNode> add_deriv_rule(unique_ptr<TreeNode>&& node) {
+    vector<unique_ptr<TreeNode>>& args = ((FunctionCallNode *)node.get())->args;
+
+    if(args.size() != 2)
+        throw calculator_error("deriv_rule(...) accepts exactly 2 arguments; got " +
+                                to_string(args.size()) + " instead");
+
+    unique_ptr<TreeNode> pattern = fold_constants(std::move(args[0]));
+    if(is_pattern_var(*pattern)) throw calculator_error("rule pattern can't match every expression");
+
+    ctx->deriv_rules->add(*pattern, *fold_constants(std::move(args[1])));
+    if(ctx->cas_cache) ctx->cas_cache->clear();
+    return make_unique<NumberNode>(NAN);
+}
+
+// cas_cache_stats: prints the hits and misses of the CAS memo tables to the developer console;
+// returns the overall hit rate.
+unique_ptr<TreeNode> print_cas_cache_stats(unique_ptr<TreeNode>&& node) {
+    CasCacheStats stats = cas_cache_stats(*ctx);
+    const char *op_names[] = {"simp", "deriv", "expand"};
+    long hits = 0, lookups = 0;
+
+    for(int op = 0; op < 3; op++) {
+        cout << op_names[op] << ": " << stats.hits[op] << " hits, " << stats.misses[op] << " misses" << endl;
+        hits += stats.hits[op];
+        lookups += stats.hits[op] + stats.misses[op];
+    }
+    cout << stats.entries << " results memoized" << endl;
+
+    return make_unique<NumberNode>(lookups ? (double) hits / lookups : NAN);
+}
@@ -1,4 +1,8 @@
-#include "backend.h"
+#include "jet.h"
+#include "quad.h"
+#include "numdiff.h"
+#include "batch.h"
+#include "roots.h"
 
 /* ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ Math Functions and Constants ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ */
 
@@ -8,10 +12,14 @@
  * - E           =~ 2.718281...
  * - NAN         == NAN
  * - RAND_MAX    == RAND_MAX
+ * - INF         == infinity
  *
  * Math Variables:
- * - DERIV_STEP : step-size for nderiv function, = 1e-6 by default
- * - INT_NUM_RECTS : the default number of rectangles to use when calculating an integral
+ * - DERIV_ERROR : the error estimate of the last nderiv
+ * - INT_ABS_TOL, INT_REL_TOL : nintegral stops refining once its error estimate is within either
+ *                              tolerance (absolute, or relative to the integral), = 1e-10
+ * - INT_MAX_EVALS : the most evaluations of the integrand nintegral makes, = 10000
+ * - INT_ERROR : the error estimate of the last nintegral
  *
  * Math Functions:
  * - Debug Functions:
@@ -53,85 +61,93 @@
  *                         where f is an expression (the argument's tree is parsed and evaluated
  *                         directly); d is the differential identifier (variable whose identifier
  *                         should be shifted), and x is the x coordinate to evalate f'(x) at.
- *     - nintegral(f, d, s, e, r = INT_NUM_RECTS) : approximates the integral of f with respect
- *                                                  variable name d on the interval [s, e], with
- *                                                  r rectangles of equal width
+ *                         Computed on Taylor jets, or by Ridders' method (see numdiff.h) where
+ *                         f has a function jets don't support.
+ *     - nintegral(f, d, s, e) : approximates the integral of f with respect to variable name d on
+ *                               the interval [s, e] (either of which may be +/-INF) by adaptive
+ *                               Gauss-Kronrod quadrature (see quad.h)
+ *     - nintegral(f, d, s, e, r) : the same, by the midpoint rule with r rectangles of equal width
  */
 
 double vararg_max(vector<unique_ptr<TreeNode>>& args);
 double vararg_min(vector<unique_ptr<TreeNode>>& args);
 double vararg_gcd(vector<unique_ptr<TreeNode>>& args);
-
-double float_floor(vector<double>& args);
-double float_ceil(vector<double>& args);
-double int_cast(vector<double>& args);
-double power(vector<double>& args);
-double absolute_val(vector<double>& args);
-double random_int(vector<double>& args);
-double factorial(vector<double>& args);
-double permutation(vector<double>& args);
-double combination(vector<double>& args);
-double to_degrees(vector<double>& args);
-double to_radians(vector<double>& args);
-double sine(vector<double> & args);
-double cosine(vector<double> & args);
-double tangent(vector<double> & args);
-double cosecant(vector<double> & args);
-double secant(vector<double> & args);
-double cotangent(vector<double> & args);
-double arcsine(vector<double> & args);
-double arccosine(vector<double> & args);
-double arctangent(vector<double> & args);
-double natural_log(vector<double>& args);
-double log_2(vector<double>& args);
-double log_10(vector<double>& args);
-double log_b(vector<double>& args);
+double vararg_tuple(vector<unique_ptr<TreeNode>>& args);
+
+double float_floor(double n);
+double float_ceil(double n);
+double int_cast(double n);
+double power(double b, double e);
+double absolute_val(double n);
+double random_int();
+double factorial(double n);
+double permutation(double n, double r);
+double combination(double n, double r);
+double to_degrees(double r);
+double to_radians(double d);
+double sine(double x);
+double cosine(double x);
+double tangent(double x);
+double cosecant(double x);
+double secant(double x);
+double cotangent(double x);
+double arcsine(double x);
+double arccosine(double x);
+double arctangent(double x);
+double natural_log(double x);
+double log_2(double x);
+double log_10(double x);
+double log_b(double x, double b);
 
 double numeric_derivative(vector<unique_ptr<TreeNode>>& args);
 double numeric_integral(vector<unique_ptr<TreeNode>>& args);
+double solve(vector<unique_ptr<TreeNode>>& args);
 
 void init_math_constants() {
-    identifier_table["PI"] = M_PI;
-    identifier_table["E"] = M_E;
-    identifier_table["NAN"] = NAN;
-    identifier_table["RAND_MAX"] = RAND_MAX;
+    ctx->identifier_table["PI"] = M_PI;
+    ctx->identifier_table["E"] = M_E;
+    ctx->identifier_table["NAN"] = NAN;
+    ctx->identifier_table["RAND_MAX"] = RAND_MAX;
+    ctx->identifier_table["INF"] = INFINITY;
 }
 
 void init_math_functions() {
     // variadic:
-    fn_table["max"] = make_unique<RawFunction>(vararg_max);
-    fn_table["min"] = make_unique<RawFunction>(vararg_min);
-    fn_table["gcd"] = make_unique<RawFunction>(vararg_gcd);
+    ctx->fn_table["max"] = make_unique<RawFunction>(vararg_max);
+    ctx->fn_table["min"] = make_unique<RawFunction>(vararg_min);
+    ctx->fn_table["gcd"] = make_unique<RawFunction>(vararg_gcd);
+    ctx->fn_table["tuple"] = make_unique<RawFunction>(vararg_tuple);
 
     // fundamental:
-    fn_table["floor"] = make_unique<NDoubleFunction<1>>(float_floor);
-    fn_table["ceil"] = make_unique<NDoubleFunction<1>>(float_ceil);
-    fn_table["int"] = make_unique<NDoubleFunction<1>>(int_cast);
-    fn_table["abs"] = make_unique<NDoubleFunction<1>>(absolute_val);
-    fn_table["pow"] = make_unique<NDoubleFunction<2>>(power);
-    fn_table["rand"] = make_unique<NDoubleFunction<0>>(random_int);
-    fn_table["factorial"] = make_unique<NDoubleFunction<1>>(factorial);
-    fn_table["perm"] = make_unique<NDoubleFunction<2>>(permutation);
-    fn_table["comb"] = make_unique<NDoubleFunction<2>>(combination);
-    fn_table["deg"] = make_unique<NDoubleFunction<1>>(to_degrees);
-    fn_table["rad"] = make_unique<NDoubleFunction<1>>(to_radians);
-    fn_table["sin"] = make_unique<NDoubleFunction<1>>(sine);
-    fn_table["cos"] = make_unique<NDoubleFunction<1>>(cosine);
-    fn_table["tan"] = make_unique<NDoubleFunction<1>>(tangent);
-    fn_table["csc"] = make_unique<NDoubleFunction<1>>(cosecant);
-    fn_table["sec"] = make_unique<NDoubleFunction<1>>(secant);
-    fn_table["cot"] = make_unique<NDoubleFunction<1>>(cotangent);
-    fn_table["asin"] = make_unique<NDoubleFunction<1>>(arcsine);
-    fn_table["acos"] = make_unique<NDoubleFunction<1>>(arccosine);
-    fn_table["atan"] = make_unique<NDoubleFunction<1>>(arctangent);
-    fn_table["ln"] = make_unique<NDoubleFunction<1>>(natural_log);
-    fn_table["lg"] = make_unique<NDoubleFunction<1>>(log_2);
-    fn_table["log"] = make_unique<NDoubleFunction<1>>(log_10);
-    fn_table["logb"] = make_unique<NDoubleFunction<2>>(log_b);
+    ctx->fn_table["floor"] = make_unique<NDoubleFunction<1, float_floor>>();
+    ctx->fn_table["ceil"] = make_unique<NDoubleFunction<1, float_ceil>>();
+    ctx->fn_table["int"] = make_unique<NDoubleFunction<1, int_cast>>();
+    ctx->fn_table["abs"] = make_unique<NDoubleFunction<1, absolute_val>>();
+    ctx->fn_table["pow"] = make_unique<NDoubleFunction<2, power>>();
+    ctx->fn_table["rand"] = make_unique<NDoubleFunction<0, random_int>>();
+    ctx->fn_table["factorial"] = make_unique<NDoubleFunction<1, factorial>>();
+    ctx->fn_table["perm"] = make_unique<NDoubleFunction<2, permutation>>();
+    ctx->fn_table["comb"] = make_unique<NDoubleFunction<2, combination>>();
+    ctx->fn_table["deg"] = make_unique<NDoubleFunction<1, to_degrees>>();
+    ctx->fn_table["rad"] = make_unique<NDoubleFunction<1, to_radians>>();
+    ctx->fn_table["sin"] = make_unique<NDoubleFunction<1, sine>>();
+    ctx->fn_table["cos"] = make_unique<NDoubleFunction<1, cosine>>();
+    ctx->fn_table["tan"] = make_unique<NDoubleFunction<1, tangent>>();
+    ctx->fn_table["csc"] = make_unique<NDoubleFunction<1, cosecant>>();
+    ctx->fn_table["sec"] = make_unique<NDoubleFunction<1, secant>>();
+    ctx->fn_table["cot"] = make_unique<NDoubleFunction<1, cotangent>>();
+    ctx->fn_table["asin"] = make_unique<NDoubleFunction<1, arcsine>>();
+    ctx->fn_table["acos"] = make_unique<NDoubleFunction<1, arccosine>>();
+    ctx->fn_table["atan"] = make_unique<NDoubleFunction<1, arctangent>>();
+    ctx->fn_table["ln"] = make_unique<NDoubleFunction<1, natural_log>>();
+    ctx->fn_table["lg"] = make_unique<NDoubleFunction<1, log_2>>();
+    ctx->fn_table["log"] = make_unique<NDoubleFunction<1, log_10>>();
+    ctx->fn_table["logb"] = make_unique<NDoubleFunction<2, log_b>>();
 
     // specialized:
-    fn_table["nderiv"] = make_unique<RawFunction>(numeric_derivative);
-    fn_table["nintegral"] = make_unique<RawFunction>(numeric_integral);
+    ctx->fn_table["nderiv"] = make_unique<RawFunction>(numeric_derivative);
+    ctx->fn_table["nintegral"] = make_unique<RawFunction>(numeric_integral);
+    ctx->fn_table["solve"] = make_unique<RawFunction>(solve);
 }
 
 /* ~ ~ ~ ~ ~ Variadic Functions ~ ~ ~ ~ ~ */
@@ -161,45 +177,55 @@ double vararg_gcd(vector<unique_ptr<TreeNode>>& args) {
     return result;
 }
 
+// a tuple of values (e.g. from grad) evaluates to its euclidean length
+double vararg_tuple(vector<unique_ptr<TreeNode>>& args) {
+    double sum_sq = 0;
+    for(auto& arg : args) {
+        double val = arg->eval();
+        sum_sq += val * val;
+    }
+    return sqrt(sum_sq);
+}
+
 /* ~ ~ ~ ~ ~ Fundamental Math Functions ~ ~ ~ ~ ~ */
 
-double float_floor(vector<double>& args) {
-    return floor(args[0]);
+double float_floor(double n) {
+    return floor(n);
 }
 
-double float_ceil(vector<double>& args) {
-    return ceil(args[0]);
+double float_ceil(double n) {
+    return ceil(n);
 }
 
-double int_cast(vector<double>& args) {
-    return (double) (long long) args[0];
+double int_cast(double n) {
+    return (double) (long long) n;
 }
 
-double absolute_val(vector<double>& args) {
-    return abs(args[0]);
+double absolute_val(double n) {
+    return abs(n);
 }
 
-double power(vector<double>& args) {
-    return pow(args[0], args[1]);
+double power(double b, double e) {
+    return pow(b, e);
 }
 
-double random_int(vector<double>& args) {
+double random_int() {
     return (double) rand();
 }
 
-double factorial(long long arg) {
+double int_factorial(long long arg) {
     if(arg > 100) return NAN; // hard-coded upper-limit for unreasonable calculations
 
     if(arg <= 1) return 1.0;
-    return arg * factorial(arg - 1);
+    return arg * int_factorial(arg - 1);
 }
 
-double factorial(vector<double>& args) {
-    return factorial((long long)args[0]);
+double factorial(double n) {
+    return int_factorial((long long)n);
 }
 
-double permutation(vector<double>& args) {
-    long long n = args[0], r = args[1];
+double permutation(double _n, double _r) {
+    long long n = _n, r = _r;
     if(n - r > 100) return NAN; // hard-coded upper-limit for unreasonable calculations
 
     double result = 1;
@@ -207,69 +233,68 @@ double permutation(vector<double>& args) {
     return result;
 }
 
-double combination(vector<double>& args) {
-    double r = args[1];
-    return permutation(args) / factorial((long long)r);
+double combination(double n, double r) {
+    return permutation(n, r) / int_factorial((long long)r);
 }
 
-double to_degrees(vector<double>& args) {
-    return args[0] * 180 / M_PI;
+double to_degrees(double r) {
+    return r * 180 / M_PI;
 }
 
-double to_radians(vector<double>& args) {
-    return args[0] * M_PI / 180;
+double to_radians(double d) {
+    return d * M_PI / 180;
 }
 
-double sine(vector<double>& args) {
-    return sin(args[0]);
+double sine(double x) {
+    return sin(x);
 }
 
-double cosine(vector<double>& args) {
-    return cos(args[0]);
+double cosine(double x) {
+    return cos(x);
 }
 
-double tangent(vector<double>& args) {
-    return tan(args[0]);
+double tangent(double x) {
+    return tan(x);
 }
 
-double cosecant(vector<double>& args) {
-    return 1 / sin(args[0]);
+double cosecant(double x) {
+    return 1 / sin(x);
 }
 
-double secant(vector<double>& args) {
-    return 1 / cos(args[0]);
+double secant(double x) {
+    return 1 / cos(x);
 }
 
-double cotangent(vector<double>& args) {
-    return 1 / tan(args[0]);
+double cotangent(double x) {
+    return 1 / tan(x);
 }
 
-double arcsine(vector<double>& args) {
-    return asin(args[0]);
+double arcsine(double x) {
+    return asin(x);
 }
 
-double arccosine(vector<double>& args) {
-    return acos(args[0]);
+double arccosine(double x) {
+    return acos(x);
 }
 
-double arctangent(vector<double>& args) {
-    return atan(args[0]);
+double arctangent(double x) {
+    return atan(x);
 }
 
-double natural_log(vector<double>& args) {
-    return log(args[0]);
+double natural_log(double x) {
+    return log(x);
 }
 
-double log_2(vector<double>& args) {
-    return log2(args[0]);
+double log_2(double x) {
+    return log2(x);
 }
 
-double log_10(vector<double>& args) {
-    return log10(args[0]);
+double log_10(double x) {
+    return log10(x);
 }
 
-double log_b(vector<double>& args) {
-    return log(args[0]) / log(args[1]);
+double log_b(double x, double b) {
+    return log(x) / log(b);
 }
 
 /* ~ ~ ~ ~ ~ Specialized Math Functions ~ ~ ~ ~ ~ */
@@ -283,17 +308,67 @@ double numeric_derivative(vector<unique_ptr<TreeNode>>& args) {
     string diff_id = ((VariableNode *) args[1].get())->id; // differential's identifier
 
     double old_diff_value = get_id_value(diff_id); // store diff_id's old value (to restore)
-    double step = get_id_value("DERIV_STEP");
     double x = args[2]->eval();
 
-    set_id_value(diff_id, x - step);
-    double f_x_minus_step = args[0]->eval();
+    try {
+        double derivative = taylor_derivative(*args[0], diff_id, x);
+        ctx->identifier_table["DERIV_ERROR"] = 0; // (exact up to rounding)
+        return derivative;
+    } catch(jet_unsupported_error& e) { }
 
-    set_id_value(diff_id, x + step);
-    double f_x_plus_step = args[0]->eval();
+    double error;
+    double derivative = ridders_derivative([&](double at) {
+        set_id_value(diff_id, at);
+        return args[0]->eval();
+    }, 1, x, error);
 
     set_id_value(diff_id, old_diff_value);
-    return (f_x_plus_step - f_x_minus_step) / (2 * step);
+    ctx->identifier_table["DERIV_ERROR"] = error;
+    return derivative;
+}
+
+// a sum with Neumaier's compensation: its rounding error doesn't grow with the number of terms
+struct CompensatedSum {
+    double sum = 0, compensation = 0;
+
+    void add(double val) {
+        double t = sum + val;
+        if(abs(sum) >= abs(val)) compensation += (sum - t) + val;
+        else compensation += (val - t) + sum;
+        sum = t;
+    }
+
+    double total() { return sum + compensation; }
+};
+
+constexpr long INT_BLOCK_RECTS = 1 << 14; // rectangles per task of midpoint_sum
+
+// the midpoint rule by batches, with blocks of rectangles summed in parallel: the blocks don't
+// depend on the number of threads, and their sums are combined in order, so the result is the
+// same for any number of threads
+double midpoint_sum(BatchProgram& program, double s, double rect_width, long num_rects) {
+    long num_blocks = max(0l, (num_rects + INT_BLOCK_RECTS - 1) / INT_BLOCK_RECTS);
+    vector<CompensatedSum> block_sums(num_blocks);
+
+    platform_parallel_for(num_blocks, [&](int block) {
+        vector<double> regs = program.new_registers();
+        double x[BATCH_SIZE], y[BATCH_SIZE];
+        long end = min(num_rects, (block + 1) * INT_BLOCK_RECTS);
+
+        for(long i = block * INT_BLOCK_RECTS; i < end; i += BATCH_SIZE) {
+            int n = min<long>(BATCH_SIZE, end - i);
+            for(int j = 0; j < n; j++) x[j] = s + (i + j) * rect_width + rect_width / 2;
+            program.run(x, y, n, regs.data());
+            for(int j = 0; j < n; j++) block_sums[block].add(y[j] * rect_width);
+        }
+    });
+
+    CompensatedSum sum;
+    for(CompensatedSum& block_sum : block_sums) {
+        sum.add(block_sum.sum);
+        sum.add(block_sum.compensation);
+    }
+    return sum.total();
 }
 
 double numeric_integral(vector<unique_ptr<TreeNode>>& args) {
@@ -304,18 +379,51 @@ double numeric_integral(vector<unique_ptr<TreeNode>>& args) {
                                        args[1]->to_string() + ") is not an identifier");
 
     string diff_id = ((VariableNode *) args[1].get())->id; // differential's identifier
-    double num_rects = args.size() == 5 ? args[4]->eval() : get_id_value("INT_NUM_RECTS");
     double old_diff_value = get_id_value(diff_id); // store diff_id's old value (to restore)
     double s = args[2]->eval(), e = args[3]->eval();
-    double rect_width = (e - s)  / num_rects;
-    double sum = 0;
-
-    // for each rectangle
-    for(int i = 0; i < (int) num_rects; i++) {
-        set_id_value(diff_id, s + i * rect_width + rect_width / 2); // set x coord to center of rect
-        sum += args[0]->eval() * rect_width;
+    double& diff = ctx->identifier_table[diff_id]; // (references to map elements are stable)
+
+    if(args.size() == 5) { // midpoint rule, with the given number of rectangles
+        double num_rects = args[4]->eval();
+        double rect_width = (e - s)  / num_rects;
+        double sum = 0;
+
+        unique_ptr<BatchProgram> program = BatchProgram::compile(*args[0], diff_id);
+        if(program) {
+            ctx->identifier_table["INT_ERROR"] = NAN;
+            return midpoint_sum(*program, s, rect_width, (long) num_rects);
+        }
+
+        // for each rectangle
+        for(int i = 0; i < (int) num_rects; i++) {
+            diff = s + i * rect_width + rect_width / 2; // set x coord to center of rect
+            sum += args[0]->eval() * rect_width;
+        }
+
+        diff = old_diff_value;
+        ctx->identifier_table["INT_ERROR"] = NAN; // (no estimate)
+        return sum;
     }
 
-    set_id_value(diff_id, old_diff_value);
-    return sum;
+    QuadResult result = integrate_adaptive([&](double x) {
+        diff = x;
+        return args[0]->eval();
+    }, s, e, get_id_value("INT_ABS_TOL"), get_id_value("INT_REL_TOL"), (long) get_id_value("INT_MAX_EVALS"));
+
+    diff = old_diff_value;
+    ctx->identifier_table["INT_ERROR"] = result.error;
+    return result.integral;
+}
+
+// solve(f, d, a, b): a root of f in d, by Brent's method if f changes sign over [a, b], else the
+// first root roots(f, d, a, b) finds; NAN if there is none (see roots.h)
+double solve(vector<unique_ptr<TreeNode>>& args) {
+    if(args.size() != 4) throw invalid_function_call_error("solve takes exactly 4 arguments; " +
+                                                           to_string(args.size()) + " given");
+
+    if(args[1]->type() != nt_id) throw invalid_function_call_error("argument 2 of solve (" +
+                                       args[1]->to_string() + ") is not an identifier");
+
+    string var_id = ((VariableNode *) args[1].get())->id;
+    return solve_expression(*args[0], var_id, args[2]->eval(), args[3]->eval());
 }
@@ -0,0 +1,82 @@
+#include "numdiff.h"
+
+/* ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ Numeric Differentiation ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ */
+
+constexpr double RIDDERS_TOL = 1e-8; // relative error that needs no smaller first step
+
+void ridders_derivatives(const batch_fn& f, int order, const double *x, double *derivative,
+                         double *error, int n) {
+    // the order'th central difference is the sum of coefs[k] f(x + (order / 2 - k) h), over h^order
+    vector<double> coefs(order + 1, 1);
+    for(int k = 1; k <= order; k++) coefs[k] = -coefs[k - 1] * (order - k + 1) / k;
+
+    fill(derivative, derivative + n, NAN);
+    fill(error, error + n, INFINITY);
+
+    vector<int> pending(n); // points to (re)try
+    iota(pending.begin(), pending.end(), 0);
+
+    for(int attempt = 0; attempt < RIDDERS_TRIES && !pending.empty(); attempt++) {
+        int m = pending.size();
+        vector<double> h(m), best(m, NAN), best_error(m, INFINITY);
+        vector<double> prev(m * RIDDERS_STEPS), cur(m * RIDDERS_STEPS); // tableau columns
+        vector<char> running(m, true);
+        vector<int> active;
+        vector<double> xs, ys;
+
+        for(int p = 0; p < m; p++) h[p] = 0.1 * max(abs(x[pending[p]]), 1.0) * pow(0.01, attempt);
+
+        for(int level = 0; level < RIDDERS_STEPS; level++) {
+            active.clear();
+            xs.clear();
+            for(int p = 0; p < m; p++) {
+                if(!running[p]) continue;
+                active.push_back(p);
+                for(int k = 0; k <= order; k++) xs.push_back(x[pending[p]] + (order / 2.0 - k) * h[p]);
+            }
+            if(active.empty()) break;
+
+            ys.resize(xs.size());
+            f(xs.data(), ys.data(), xs.size());
+
+            for(int a = 0; a < active.size(); a++) {
+                int p = active[a];
+                double *c = &cur[p * RIDDERS_STEPS], *b = &prev[p * RIDDERS_STEPS];
+
+                double diff = 0;
+                for(int k = 0; k <= order; k++) diff += coefs[k] * ys[a * (order + 1) + k];
+                c[0] = diff / pow(h[p], order);
+
+                // extrapolates each entry from the one before it at this step and the last step
+                double factor = RIDDERS_SHRINK * RIDDERS_SHRINK;
+                for(int j = 1; j <= level; j++) {
+                    c[j] = (c[j - 1] * factor - b[j - 1]) / (factor - 1);
+                    factor *= RIDDERS_SHRINK * RIDDERS_SHRINK;
+
+                    double err = max(abs(c[j] - c[j - 1]), abs(c[j] - b[j - 1]));
+                    if(err <= best_error[p]) best_error[p] = err, best[p] = c[j];
+                }
+
+                if(level > 0 && abs(c[level] - b[level - 1]) >= RIDDERS_SAFE * best_error[p]) running[p] = false;
+                swap_ranges(c, c + level + 1, b);
+                h[p] /= RIDDERS_SHRINK;
+            }
+        }
+
+        vector<int> retry;
+        for(int p = 0; p < m; p++) {
+            int i = pending[p];
+            if(best_error[p] < error[i]) error[i] = best_error[p], derivative[i] = best[p];
+            if(!(error[i] <= RIDDERS_TOL * max(abs(derivative[i]), 1.0))) retry.push_back(i);
+        }
+        pending = std::move(retry);
+    }
+}
+
+double ridders_derivative(const function<double(double)>& f, int order, double x, double& error) {
+    double derivative;
+    ridders_derivatives([&f](const double *xs, double *ys, int n) {
+        for(int i = 0; i < n; i++) ys[i] = f(xs[i]);
+    }, order, &x, &derivative, &error, 1);
+    return derivative;
+}
@@ -0,0 +1,35 @@
+#ifndef NUMDIFF
+#define NUMDIFF
+
+#include "backend.h"
+
+/* ~ ~ ~ ~ ~ Numeric Differentiation ~ ~ ~ ~ ~ */
+
+/*
+ * ridders_derivatives: n'th derivatives by Ridders' method, for functions Taylor jets can't
+ * differentiate (see jet.h). The n'th central difference with step h has an error series in
+ * even powers of h, so differences at steps shrinking by RIDDERS_SHRINK are extrapolated to
+ * h = 0 (Richardson extrapolation, in a Neville tableau); the entry of the tableau that agrees
+ * best with its neighbours is the result, and their disagreement estimates its error. A point
+ * stops once the extrapolations start diverging (rounding has taken over). The first step is
+ * relative to the scale of x; if the error is still large, smaller first steps are tried, which
+ * suits functions that vary quickly. Points are differentiated together, so f evaluates a whole
+ * batch of points each time it's called.
+ */
+
+constexpr int RIDDERS_STEPS = 10;       // (size of the tableau)
+constexpr double RIDDERS_SHRINK = 1.4;  // ratio of successive steps
+constexpr double RIDDERS_SAFE = 2;      // growth of the error that stops a point
+constexpr int RIDDERS_TRIES = 3;        // first steps tried (each 100 times smaller)
+
+// f(x, y, n) sets y[i] to the function at x[i] for i < n
+typedef function<void(const double *, double *, int)> batch_fn;
+
+// derivative[i] and error[i] are the order'th derivative of f at x[i] and its error estimate
+void ridders_derivatives(const batch_fn& f, int order, const double *x, double *derivative,
+                         double *error, int n);
+
+// (one point)
+double ridders_derivative(const function<double(double)>& f, int order, double x, double& error);
+
+#endif // NUMDIFF
@@ -67,8 +67,9 @@
 
 // push/pop saves/restores the values of the following global variables
 // (just parsing_impl_mult for now...)
+// all parser state is thread-local, so that separate threads can parse at the same time
 
-bool parsing_impl_mult = false;
+thread_local bool parsing_impl_mult = false;
 
 struct parser_state {
     bool parsing_impl_mult;
@@ -77,7 +78,7 @@ struct parser_state {
         parsing_impl_mult(parsing_impl_mult) { }
 };
 
-vector<parser_state> state_stack;
+thread_local vector<parser_state> state_stack;
 
 void push_parser_state() {
     state_stack.push_back(parser_state(parsing_impl_mult));
@@ -102,8 +103,8 @@ void reset_state_stack() {
 
 /* ~ ~ ~ ~ ~ Token Fetching ~ ~ ~ ~ ~ */
 
-int i;
-vector<unique_ptr<Token>> tokens;
+thread_local int i;
+thread_local vector<unique_ptr<Token>> tokens;
 unique_ptr<Token> eos = unique_ptr<Token> {new NumToken(0)}; // dummy variable
 
 
@@ -51,30 +51,44 @@ bool is_binary_op(enum node_type type);
 bool is_unary_op(enum node_type type);
 bool is_nary_op(enum node_type type);
 
-struct NumberNode : TreeNode {
-    double val;
+// appends val as std::to_string would write it (six decimal places), without trailing
+// zeroes/decimal place
+inline void append_number(string& out, double val) {
+    char buf[400]; // fits any double in fixed notation
+    char *end = to_chars(buf, buf + sizeof(buf), val, chars_format::fixed, 6).ptr;
 
-    NumberNode(double v) : val(v) { }
+    // remove trailing zeroes/decimal place
+    char ch;
+    while((ch = end[-1]) == '0' || ch == '.') {
+        end--;
+        if(ch == '.') break;
+    }
 
-    string to_string(enum node_type parent_type = nt_none) override {
-        string result = std::to_string(val);
+    out.append(buf, end);
+}
 
-        // remove trailing zeroes/decimal place
-        int ch;
-        while((ch = result[result.size() - 1]) == '0' || ch == '.') {
-            result.pop_back();
-            if(ch == '.') break;
-        }
+// appends id, escaping '_' (which is a special character in LaTeX)
+inline void append_latex_id(string& out, const string& id) {
+    for(char ch : id) {
+        if(ch == '_') out += "\\_";
+        else out += ch;
+    }
+}
 
+struct NumberNode : TreeNode {
+    double val;
+
+    NumberNode(double v) : val(v) { }
 
-        return result;
+    void append_string(string& out, enum node_type parent_type = nt_none) override {
+        append_number(out, val);
     }
 
     double eval() override {
         return val;
     }
 
-    unique_ptr<TreeNode> copy() override {
+    unique_ptr<TreeNode> clone() override {
         return unique_ptr<TreeNode> {new NumberNode(val)};
     }
 
@@ -88,24 +102,19 @@ struct VariableNode : TreeNode {
 
     VariableNode(string i) : id(i) { }
 
-    string to_string(enum node_type parent_type = nt_none) override {
-        return id;
+    void append_string(string& out, enum node_type parent_type = nt_none) override {
+        out += id;
     }
 
-    string to_latex_string(enum node_type parent_type = nt_none) override {
-        string result = "";
-
-        // escape '_' (which is a spcial character in LaTeX)
-        for(int i = 0; i < id.size(); i++) result += id[i] == '_' ? "\\_" : string(1, id[i]);
-
-        return  result;
+    void append_latex_string(string& out, enum node_type parent_type = nt_none) override {
+        append_latex_id(out, id);
     }
 
     double eval() override {
         return get_id_value(id);
     }
 
-    unique_ptr<TreeNode> copy() override {
+    unique_ptr<TreeNode> clone() override {
         return unique_ptr<TreeNode> {new VariableNode(id)};
     }
 
@@ -122,30 +131,28 @@ struct FunctionCallNode : TreeNode {
         fn_id(i),
         args(std::move(a)) { }
 
-    string to_string(enum node_type parent_type = nt_none) override {
-        string s = fn_id + "(";
+    void append_string(string& out, enum node_type parent_type = nt_none) override {
+        out += fn_id;
+        out += '(';
 
         for(int i = 0; i < args.size(); i++) {
-            s += args[i]->to_string(nt_none);
-            if(i != args.size() - 1) s += ", ";
+            args[i]->append_string(out, nt_none);
+            if(i != args.size() - 1) out += ", ";
         }
 
-        s += ")";
-        return s;
+        out += ')';
     }
 
-    string to_latex_string(enum node_type parent_type = nt_none) override {
-        string s = "";
-        for(int i = 0; i < fn_id.size(); i++) s += fn_id[i] == '_' ? "\\_" : string(1, fn_id[i]);
-        s += "(";
+    void append_latex_string(string& out, enum node_type parent_type = nt_none) override {
+        append_latex_id(out, fn_id);
+        out += '(';
 
         for(int i = 0; i < args.size(); i++) {
-            s += args[i]->to_latex_string(nt_none);
-            if(i != args.size() - 1) s += ", ";
+            args[i]->append_latex_string(out, nt_none);
+            if(i != args.size() - 1) out += ", ";
         }
 
-        s += ")";
-        return s;
+        out += ')';
     }
 
     double eval() override {
@@ -157,7 +164,7 @@ struct FunctionCallNode : TreeNode {
         return fn(std::move(self));
     }
 
-    unique_ptr<TreeNode> copy() override {
+    unique_ptr<TreeNode> clone() override {
         vector<unique_ptr<TreeNode>> args_copy;
         for(int i = 0; i < args.size(); i++) args_copy.push_back(args[i]->copy());
 
@@ -169,6 +176,24 @@ struct FunctionCallNode : TreeNode {
     }
 };
 
+inline enum node_type binary_op_type(const string& op) {
+    if(op == "//") return nt_int_quotient;
+    else if(op == "%") return nt_modulus;
+    else if(op == "=") return nt_assignment;
+    else if(op == "+") return nt_sum;
+    else if(op == "-") return nt_difference;
+    else if(op == "*") return nt_product;
+    else if(op == "/") return nt_quotient;
+    else if(op == "^" || op == "**") return nt_exponentiation;
+    else if(op == "==") return nt_eq;
+    else if(op == "!=") return nt_ne;
+    else if(op == "<") return nt_lt;
+    else if(op == ">") return nt_gt;
+    else if(op == "<=") return nt_le;
+    else if(op == ">=") return nt_ge;
+    else assert(false);
+}
+
 struct BinaryOpNode : TreeNode {
     unique_ptr<TreeNode> left, right;
     string op;
@@ -178,56 +203,75 @@ struct BinaryOpNode : TreeNode {
         right(std::move(r)),
         op(o) { }
 
-    string to_string(enum node_type parent_type = nt_none) override {
-        if(precedence(parent_type) < precedence(type()) ||
-           precedence(parent_type) == precedence(type()) &&
-           (type() == nt_sum || type() == nt_difference || type() == nt_product)) // these are obvious enough
-            return left->to_string(type()) + ' ' + op + ' ' + right->to_string(type());
-        else
-            return '(' + left->to_string(type()) + ' ' + op + ' ' + right->to_string(type()) + ')';
-    }
-
-    string to_latex_string(enum node_type parent_type = nt_none) override {
-        bool add_parens = !(precedence(parent_type) < precedence(type()) ||
-                            precedence(parent_type) == precedence(type()) &&
-                            (type() == nt_sum || type() == nt_difference || type() == nt_product));
+    // whether this node needs parentheses when it's a child of a parent_type node
+    bool needs_parens(enum node_type parent_type) {
+        enum node_type t = type();
+        return !(precedence(parent_type) < precedence(t) ||
+                 precedence(parent_type) == precedence(t) &&
+                 (t == nt_sum || t == nt_difference || t == nt_product)); // these are obvious enough
+    }
+
+    void append_string(string& out, enum node_type parent_type = nt_none) override {
+        enum node_type t = type();
+        bool add_parens = needs_parens(parent_type);
+
+        if(add_parens) out += '(';
+        left->append_string(out, t);
+        out += ' ';
+        out += op;
+        out += ' ';
+        right->append_string(out, t);
+        if(add_parens) out += ')';
+    }
+
+    void append_latex_string(string& out, enum node_type parent_type = nt_none) override {
+        enum node_type t = type();
+
+        if(op == "//") { // floor brackets stand in for parentheses
+            out += "\\left\\lfloor\\frac{";
+            left->append_latex_string(out, nt_none);
+            out += "}{";
+            right->append_latex_string(out, nt_none);
+            out += "}\\right\\rfloor";
+            return;
+        }
 
-        string result;
+        bool add_parens = needs_parens(parent_type);
+        if(add_parens) out += '(';
 
         if(op == "/") {
-            result = "\\frac{" + left->to_latex_string(nt_none) + "}" +
-                                  "{" + right->to_latex_string(nt_none) + "}";
+            out += "\\frac{";
+            left->append_latex_string(out, nt_none);
+            out += "}{";
+            right->append_latex_string(out, nt_none);
+            out += '}';
         } else if(op == "*") {
-            if(left->type() == nt_num && right->type() != nt_num)
-                result = left->to_latex_string(type()) + " " + right->to_latex_string(type());
-            else
-                result = left->to_latex_string(type()) + " \\cdot " + right->to_latex_string(type());
+            left->append_latex_string(out, t);
+            out += left->type() == nt_num && right->type() != nt_num ? " " : " \\cdot ";
+            right->append_latex_string(out, t);
         } else if(op == "^") {
-            if(right->type() == nt_num && right->eval() == 0.5)
-                result = "\\sqrt{" + left->to_latex_string(nt_none) + "}";
-            else
-                result = left->to_latex_string(type()) + "^{" +
-                                right->to_latex_string(nt_none) + "}";
+            if(right->type() == nt_num && right->eval() == 0.5) {
+                out += "\\sqrt{";
+                left->append_latex_string(out, nt_none);
+                out += '}';
+            } else {
+                left->append_latex_string(out, t);
+                out += "^{";
+                right->append_latex_string(out, nt_none);
+                out += '}';
+            }
         } else if(op == "%") {
-            result = left->to_latex_string(type()) + "\\; mod \\;(" +
-                            right->to_latex_string(type()) + ")";
-        } else if(op == "//") {
-            result = "\\frac{" + left->to_latex_string(nt_none) + "}" +
-                                  "{" + right->to_latex_string(nt_none) + "}";
-            return "\\left\\lfloor" + result + "\\right\\rfloor";
-        } else if(op == "!=" || op == ">=" || op == "<=") {
-            string lop = op == "!=" ? "\\ne" : op == ">=" ? "\\ge" : "\\le";
-            result = left->to_latex_string(type()) + lop + right->to_latex_string(type());
+            left->append_latex_string(out, t);
+            out += "\\; mod \\;(";
+            right->append_latex_string(out, t);
+            out += ')';
         } else {
-            result = left->to_latex_string(type()) + op + right->to_latex_string(type());
+            left->append_latex_string(out, t);
+            out += op == "!=" ? "\\ne" : op == ">=" ? "\\ge" : op == "<=" ? "\\le" : op;
+            right->append_latex_string(out, t);
         }
 
-        if(precedence(parent_type) < precedence(type()) ||
-           precedence(parent_type) == precedence(type()) &&
-           (type() == nt_sum || type() == nt_difference || type() == nt_product)) // these are obvious enough
-            return result;
-        else
-            return '(' + result + ')';
+        if(add_parens) out += ')';
     }
 
     double eval() override {
@@ -252,7 +296,7 @@ struct BinaryOpNode : TreeNode {
                     arg_ids.push_back(((VariableNode *)arg_node.get())->id);
                 }
 
-                assign_function(fn_id, std::move(arg_ids), std::move(right->copy()));
+                assign_function(fn_id, std::move(arg_ids), persistent_copy(*right));
 
                 return NAN;
             } else {
@@ -280,27 +324,13 @@ struct BinaryOpNode : TreeNode {
         return fn(std::move(self));
     }
 
-    unique_ptr<TreeNode> copy() override {
+    unique_ptr<TreeNode> clone() override {
         return unique_ptr<TreeNode> {new BinaryOpNode(left->copy(), right->copy(), op)};
     }
 
 
     enum node_type type() override {
-        if(op == "//") return nt_int_quotient;
-        else if(op == "%") return nt_modulus;
-        else if(op == "=") return nt_assignment;
-        else if(op == "+") return nt_sum;
-        else if(op == "-") return nt_difference;
-        else if(op == "*") return nt_product;
-        else if(op == "/") return nt_quotient;
-        else if(op == "^" || op == "**") return nt_exponentiation;
-        else if(op == "==") return nt_eq;
-        else if(op == "!=") return nt_ne;
-        else if(op == "<") return nt_lt;
-        else if(op == ">") return nt_gt;
-        else if(op == "<=") return nt_le;
-        else if(op == ">=") return nt_ge;
-        else assert(false);
+        return binary_op_type(op);
     }
 };
 
@@ -312,19 +342,22 @@ struct UnaryOpNode : TreeNode {
         arg(std::move(a)),
         op(o) { }
 
-    string to_string(enum node_type parent_type = nt_none) override {
-        if(precedence(parent_type) < precedence(type()))
-            return op + arg->to_string(type());
-        else
-            return '(' + op + arg->to_string(type()) + ')';
+    void append_string(string& out, enum node_type parent_type = nt_none) override {
+        bool add_parens = precedence(parent_type) >= precedence(type());
+
+        if(add_parens) out += '(';
+        out += op;
+        arg->append_string(out, type());
+        if(add_parens) out += ')';
     }
 
+    void append_latex_string(string& out, enum node_type parent_type = nt_none) override {
+        bool add_parens = precedence(parent_type) >= precedence(type());
 
-    string to_latex_string(enum node_type parent_type = nt_none) override {
-        if(precedence(parent_type) < precedence(type()))
-            return op + arg->to_latex_string(type());
-        else
-            return '(' + op + arg->to_latex_string(type()) + ')';
+        if(add_parens) out += '(';
+        out += op;
+        arg->append_latex_string(out, type());
+        if(add_parens) out += ')';
     }
 
     double eval() override {
@@ -337,7 +370,7 @@ struct UnaryOpNode : TreeNode {
         return fn(std::move(self));
     }
 
-    unique_ptr<TreeNode> copy() override {
+    unique_ptr<TreeNode> clone() override {
         return unique_ptr<TreeNode> {new UnaryOpNode(arg->copy(), op)};
     }
 
@@ -359,35 +392,25 @@ struct DerivativeNode : TreeNode {
         args(std::move(a)),
         nth_deriv(n) { }
 
-    string to_string(enum node_type parent_type = nt_none) override {
-        string s = fn_id;
-        for(int i = 0; i < nth_deriv; i++) s += "'";
-        s += "(";
-        s += args.size() == 0 ? "" : args[0]->to_string(nt_none);
-        s += ")";
-        return s;
+    void append_string(string& out, enum node_type parent_type = nt_none) override {
+        out += fn_id;
+        out.append(max(nth_deriv, 0), '\'');
+        out += '(';
+        if(args.size()) args[0]->append_string(out, nt_none);
+        out += ')';
     }
 
-    string to_latex_string(enum node_type parent_type = nt_none) override {
-        string s = "";
-        for(int i = 0; i < fn_id.size(); i++) s += fn_id[i] == '_' ? "\\_" : string(1, fn_id[i]);
-
-        for(int i = 0; i < nth_deriv; i++) s += "'";
-        s += "(";
-        s += args.size() == 0 ? "" : args[0]->to_latex_string(nt_none);
-        s += ")";
-        return s;
+    void append_latex_string(string& out, enum node_type parent_type = nt_none) override {
+        append_latex_id(out, fn_id);
+        out.append(max(nth_deriv, 0), '\'');
+        out += '(';
+        if(args.size()) args[0]->append_latex_string(out, nt_none);
+        out += ')';
     }
 
-    // calculates the n'th derivative of fn_id at %at%
-    double nderiv(int n, double at) {
-        if(n == 0) {
-            vector<unique_ptr<TreeNode>> arg_vec;
-            arg_vec.push_back(make_unique<NumberNode>(at));
-            return call_function(fn_id, arg_vec);
-        }
-        return (nderiv(n - 1, at + DERIV_STEP) - nderiv(n - 1, at - DERIV_STEP)) / (2 * DERIV_STEP);
-    }
+    // calculates the n'th derivative of fn_id at %at% (on Taylor jets, see jet.h, or else by
+    // Ridders' method, see numdiff.h)
+    double nderiv(int n, double at);
 
     double eval() override {
         if(args.size() == 0) throw invalid_expression_error("can't implicitly differentiate a "
@@ -404,7 +427,7 @@ struct DerivativeNode : TreeNode {
         return fn(std::move(self));
     }
 
-    unique_ptr<TreeNode> copy() override {
+    unique_ptr<TreeNode> clone() override {
         vector<unique_ptr<TreeNode>> args_copy;
         for(int i = 0; i < args.size(); i++) args_copy.push_back(args[i]->copy());
 
@@ -0,0 +1,194 @@
+#include "poly.h"
+
+/* ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ Sparse Polynomials ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ */
+
+constexpr uint64_t POLY_LANE_SIGNS = 0x8000000080000000ull; // the top bit of each exponent
+
+// adds each exponent of b to the same exponent of a (with no carries between them)
+inline uint64_t add_lanes(uint64_t a, uint64_t b) {
+    return ((a & ~POLY_LANE_SIGNS) + (b & ~POLY_LANE_SIGNS)) ^ ((a ^ b) & POLY_LANE_SIGNS);
+}
+
+inline uint64_t lane_bits(long exponent, int gen) {
+    return (uint64_t) (uint32_t) exponent << (32 * (gen % POLY_LANES));
+}
+
+size_t hash_monomial(const uint64_t *exp, int num_words) {
+    uint64_t hash = 0x9e3779b97f4a7c15ull;
+    for(int i = 0; i < num_words; i++) {
+        hash = (hash ^ exp[i]) * 0xff51afd7ed558ccdull;
+        hash ^= hash >> 32;
+    }
+    return hash;
+}
+
+Poly Poly::constant(double c, int num_words) {
+    Poly p(num_words);
+    vector<uint64_t> exp(num_words, 0);
+    p.add_term(exp.data(), c);
+    return p;
+}
+
+Poly Poly::generator(int gen, int num_words) {
+    Poly p(num_words);
+    vector<uint64_t> exp(num_words, 0);
+    exp[gen / POLY_LANES] = lane_bits(1, gen);
+    p.add_term(exp.data(), 1);
+    p.max_degree = 1;
+    return p;
+}
+
+int Poly::num_nonzero_terms() const {
+    return count_if(coefs.begin(), coefs.end(), [](double c) { return c != 0; });
+}
+
+void Poly::reindex(size_t num_slots) {
+    slots.assign(num_slots, -1);
+    for(int t = 0; t < num_terms(); t++) {
+        size_t i = hash_monomial(exp(t), num_words) & (num_slots - 1);
+        while(slots[i] != -1) i = (i + 1) & (num_slots - 1);
+        slots[i] = t;
+    }
+}
+
+// pads every monomial to the given number of words (for generators added since it was built)
+void Poly::widen(int words) {
+    if(words <= num_words) return;
+
+    vector<uint64_t> wide(num_terms() * words, 0);
+    for(int t = 0; t < num_terms(); t++) copy(exp(t), exp(t) + num_words, wide.begin() + t * words);
+
+    exps = std::move(wide);
+    num_words = words;
+    if(slots.size()) reindex(slots.size());
+}
+
+void Poly::add_term(const uint64_t *exp, double coef) {
+    // keep the index at most half full
+    if(2 * (num_terms() + 1) > slots.size()) reindex(max<size_t>(16, 2 * slots.size()));
+
+    size_t mask = slots.size() - 1;
+    size_t i = hash_monomial(exp, num_words) & mask;
+    for(; slots[i] != -1; i = (i + 1) & mask) {
+        if(equal(exp, exp + num_words, this->exp(slots[i]))) {
+            coefs[slots[i]] += coef;
+            return;
+        }
+    }
+
+    if(coef == 0) return;
+    slots[i] = num_terms();
+    exps.insert(exps.end(), exp, exp + num_words);
+    coefs.push_back(coef);
+}
+
+Poly& Poly::operator+=(const Poly& p) {
+    assert(p.num_words == num_words && &p != this);
+    for(int t = 0; t < p.num_terms(); t++) {
+        if(p.coefs[t] != 0) add_term(p.exp(t), p.coefs[t]);
+    }
+    max_degree = std::max(max_degree, p.max_degree);
+    return *this;
+}
+
+Poly Poly::operator*(const Poly& p) const {
+    assert(p.num_words == num_words);
+    if(max_degree + p.max_degree > POLY_MAX_DEGREE)
+        throw invalid_expression_error("exponent too large to expand");
+
+    Poly result(num_words);
+    result.max_degree = max_degree + p.max_degree;
+    vector<uint64_t> exp(num_words);
+
+    for(int a = 0; a < num_terms(); a++) {
+        if(coefs[a] == 0) continue;
+        for(int b = 0; b < p.num_terms(); b++) {
+            if(p.coefs[b] == 0) continue;
+            for(int i = 0; i < num_words; i++) exp[i] = add_lanes(this->exp(a)[i], p.exp(b)[i]);
+            result.add_term(exp.data(), coefs[a] * p.coefs[b]);
+        }
+    }
+
+    return result;
+}
+
+// (c_1 m_1 + ... + c_k m_k)^n is expanded directly by the multinomial theorem: each way of
+// splitting n into powers j_1 + ... + j_k contributes n! / (j_1! ... j_k!) c_1^j_1 m_1^j_1 ...
+// c_k^j_k m_k^j_k, so there's no intermediate product to build and combine.
+Poly Poly::pow(int n) const {
+    if((long) max_degree * abs(n) > POLY_MAX_DEGREE)
+        throw invalid_expression_error("exponent too large to expand");
+
+    vector<int> terms;
+    for(int t = 0; t < num_terms(); t++) if(coefs[t] != 0) terms.push_back(t);
+
+    Poly result(num_words);
+    result.max_degree = max_degree * abs(n);
+
+    if(n == 0) return constant(1, num_words);
+    if(terms.empty()) return result;
+
+    if(terms.size() == 1) { // (c m)^n = c^n m^n, for any n
+        vector<uint64_t> exp(num_words, 0);
+        for(int gen = 0; gen < num_words * POLY_LANES; gen++) {
+            exp[gen / POLY_LANES] |= lane_bits((long) exponent(terms[0], gen) * n, gen);
+        }
+        result.add_term(exp.data(), std::pow(coefs[terms[0]], n));
+        return result;
+    }
+
+    assert(n > 0);
+    int k = terms.size(), w = num_words;
+
+    // powers[(i * (n + 1) + j) * w]: the j-th power of term i's monomial (and coefficient)
+    vector<uint64_t> powers(k * (n + 1) * w, 0);
+    vector<double> coef_powers(k * (n + 1), 1);
+    for(int i = 0; i < k; i++) {
+        for(int j = 1; j <= n; j++) {
+            uint64_t *prev = &powers[(i * (n + 1) + j - 1) * w], *cur = prev + w;
+            for(int x = 0; x < w; x++) cur[x] = add_lanes(prev[x], exp(terms[i])[x]);
+            coef_powers[i * (n + 1) + j] = coef_powers[i * (n + 1) + j - 1] * coefs[terms[i]];
+        }
+    }
+
+    // binomial[r * (n + 1) + j] = r choose j
+    vector<double> binomial((n + 1) * (n + 1), 0);
+    for(int r = 0; r <= n; r++) {
+        binomial[r * (n + 1)] = 1;
+        for(int j = 1; j <= r; j++) {
+            binomial[r * (n + 1) + j] = binomial[(r - 1) * (n + 1) + j - 1] +
+                                        (j < r ? binomial[(r - 1) * (n + 1) + j] : 0);
+        }
+    }
+
+    // partial[i * w]: the product of the powers chosen for terms before i
+    vector<uint64_t> partial((k + 1) * w, 0);
+
+    // chooses the power of term i, with r of the n left to split
+    function<void(int, int, double)> split = [&](int i, int r, double coef) {
+        uint64_t *acc = &partial[i * w], *next = acc + w;
+
+        if(i == k - 1) { // the last term takes the rest
+            const uint64_t *power = &powers[(i * (n + 1) + r) * w];
+            for(int x = 0; x < w; x++) next[x] = add_lanes(acc[x], power[x]);
+            result.add_term(next, coef * coef_powers[i * (n + 1) + r]);
+            return;
+        }
+
+        for(int j = 0; j <= r; j++) {
+            const uint64_t *power = &powers[(i * (n + 1) + j) * w];
+            for(int x = 0; x < w; x++) next[x] = add_lanes(acc[x], power[x]);
+            split(i + 1, r - j, coef * binomial[r * (n + 1) + j] * coef_powers[i * (n + 1) + j]);
+        }
+    };
+    split(0, n, 1);
+
+    return result;
+}
+
+double multinomial_size(int num_terms, int n) {
+    // (n + k - 1) choose (k - 1)
+    double size = 1;
+    for(int i = 1; i < num_terms; i++) size = size * (n + i) / i;
+    return size;
+}
@@ -0,0 +1,52 @@
+#ifndef POLY
+#define POLY
+
+#include "backend.h"
+
+/* ~ ~ ~ ~ ~ Sparse Polynomials ~ ~ ~ ~ ~ */
+
+/*
+ * Poly: a sparse multivariate polynomial with double coefficients, used by symb_expand. Its
+ * variables ("generators") are numbered; the CAS maps them to the subtrees it can't expand
+ * further. Exponents are signed (so x^-1 is a monomial too) and packed two to a 64-bit word,
+ * which lets monomials be multiplied with a few word additions, and hashed and compared as
+ * plain words. Terms are kept in insertion order with an open-addressed index by monomial, so
+ * like terms are combined as they are added; terms can cancel to a coefficient of 0.
+ */
+
+constexpr int POLY_LANES = 2; // exponents per word
+constexpr long POLY_MAX_DEGREE = INT32_MAX;
+
+struct Poly {
+    int num_words; // exponent words per monomial (every generator index must fit)
+    vector<uint64_t> exps; // num_words per term
+    vector<double> coefs;
+    vector<int> slots; // index of terms by monomial (size is a power of 2, -1 for empty slots)
+    long max_degree = 0; // largest absolute exponent of any generator
+
+    Poly(int num_words = 0): num_words(num_words) {}
+
+    static Poly constant(double c, int num_words);
+    static Poly generator(int gen, int num_words);
+
+    int num_terms() const { return coefs.size(); }
+    int num_nonzero_terms() const;
+    const uint64_t *exp(int term) const { return exps.data() + term * num_words; }
+    int exponent(int term, int gen) const {
+        return (int32_t) (exp(term)[gen / POLY_LANES] >> (32 * (gen % POLY_LANES)));
+    }
+
+    void widen(int words);
+    void add_term(const uint64_t *exp, double coef);
+
+    Poly& operator+=(const Poly& p);
+    Poly operator*(const Poly& p) const;
+    Poly pow(int n) const; // n must be >= 0 unless this is a single term
+
+    void reindex(size_t num_slots);
+};
+
+// the number of terms of an n-th power of a polynomial with num_terms (distinct) terms
+double multinomial_size(int num_terms, int n);
+
+#endif // POLY
@@ -0,0 +1,122 @@
+#include "quad.h"
+
+/* ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ Adaptive Quadrature ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ */
+
+/* ~ ~ ~ ~ ~ Gauss-Kronrod Rule ~ ~ ~ ~ ~ */
+
+// the nonnegative nodes of the 15-point Kronrod rule on [-1, 1] (the odd ones are the nodes of
+// the 7-point Gauss rule), and the weights of both rules at them
+const double KRONROD_NODES[8] = {
+    0.991455371120812639206854697526329, 0.949107912342758524526189684047851,
+    0.864864423359769072789712788640926, 0.741531185599394439863864773280788,
+    0.586087235467691130294144845693013, 0.405845151377397166906606412076961,
+    0.207784955007898467600689403773245, 0.000000000000000000000000000000000,
+};
+
+const double KRONROD_WEIGHTS[8] = {
+    0.022935322010529224963732008058970, 0.063092092629978553290700663189204,
+    0.104790010322250183839876322541518, 0.140653259715525918745189590510238,
+    0.169004726639267902826583426598550, 0.190350578064785409913256402421014,
+    0.204432940075298892414161999234649, 0.209482141084727828012999174891714,
+};
+
+const double GAUSS_WEIGHTS[4] = { // (at KRONROD_NODES[1], [3], [5] and [7])
+    0.129484966168869693270611432679082, 0.279705391489276667901467771423780,
+    0.381830050505118944950369775488975, 0.417959183673469387755102040816327,
+};
+
+struct QuadInterval {
+    double a, b;
+    double integral, error;
+
+    bool operator<(const QuadInterval& other) const { return error < other.error; }
+};
+
+QuadInterval gauss_kronrod(const function<double(double)>& f, double a, double b) {
+    double center = (a + b) / 2, half = (b - a) / 2;
+    double f_center = f(center);
+    double kronrod = f_center * KRONROD_WEIGHTS[7], gauss = f_center * GAUSS_WEIGHTS[3];
+    double abs_kronrod = abs(kronrod);
+
+    double vals[14];
+    for(int i = 0; i < 7; i++) {
+        double lo = f(center - half * KRONROD_NODES[i]), hi = f(center + half * KRONROD_NODES[i]);
+        vals[2 * i] = lo;
+        vals[2 * i + 1] = hi;
+
+        kronrod += (lo + hi) * KRONROD_WEIGHTS[i];
+        abs_kronrod += (abs(lo) + abs(hi)) * KRONROD_WEIGHTS[i];
+        if(i % 2 == 1) gauss += (lo + hi) * GAUSS_WEIGHTS[i / 2];
+    }
+
+    // the integral of |f - mean|, which scales the error estimate as in QUADPACK: the raw
+    // difference of the rules overestimates the error of the Kronrod rule on smooth integrands
+    double mean = kronrod / 2, spread = abs(f_center - mean) * KRONROD_WEIGHTS[7];
+    for(int i = 0; i < 7; i++) {
+        spread += (abs(vals[2 * i] - mean) + abs(vals[2 * i + 1] - mean)) * KRONROD_WEIGHTS[i];
+    }
+
+    double error = abs((kronrod - gauss) * half);
+    spread *= abs(half);
+    if(spread != 0 && error != 0) error = spread * min(1.0, pow(200 * error / spread, 1.5));
+    double round_off = 50 * numeric_limits<double>::epsilon() * abs_kronrod * abs(half);
+    if(round_off > numeric_limits<double>::min()) error = max(error, round_off);
+
+    return {a, b, kronrod * half, error};
+}
+
+/* ~ ~ ~ ~ ~ Adaptive Integration ~ ~ ~ ~ ~ */
+
+QuadResult integrate_adaptive(const function<double(double)>& f, double a, double b,
+                              double abs_tol, double rel_tol, long max_evals) {
+    if(a == b) return {0, 0, 0};
+    if(a > b) {
+        QuadResult result = integrate_adaptive(f, b, a, abs_tol, rel_tol, max_evals);
+        result.integral = -result.integral;
+        return result;
+    }
+
+    // maps infinite bounds onto t in (0, 1) or (-1, 1), where g(t) = f(x(t)) x'(t)
+    function<double(double)> g = f;
+    if(isinf(a) && isinf(b)) {
+        g = [&f](double t) { return f(t / (1 - t * t)) * (1 + t * t) / ((1 - t * t) * (1 - t * t)); };
+        a = -1, b = 1;
+    } else if(isinf(b)) {
+        g = [&f, a](double t) { return f(a + t / (1 - t)) / ((1 - t) * (1 - t)); };
+        a = 0, b = 1;
+    } else if(isinf(a)) {
+        g = [&f, b](double t) { return f(b - (1 - t) / t) / (t * t); };
+        a = 0, b = 1;
+    }
+
+    vector<QuadInterval> heap = {gauss_kronrod(g, a, b)}; // by error
+    long evals = 15;
+    double integral = heap[0].integral, error = heap[0].error;
+
+    while(error > max(abs_tol, rel_tol * abs(integral)) && evals + 30 <= max_evals) {
+        QuadInterval worst = heap.front();
+        double mid = (worst.a + worst.b) / 2;
+        if(mid <= worst.a || mid >= worst.b) break; // (no more precision to split it with)
+
+        pop_heap(heap.begin(), heap.end());
+        heap.pop_back();
+
+        QuadInterval left = gauss_kronrod(g, worst.a, mid), right = gauss_kronrod(g, mid, worst.b);
+        evals += 30;
+        integral += left.integral + right.integral - worst.integral;
+        error += left.error + right.error - worst.error;
+
+        heap.push_back(left);
+        push_heap(heap.begin(), heap.end());
+        heap.push_back(right);
+        push_heap(heap.begin(), heap.end());
+    }
+
+    // (summed again, without the running totals' cancellation)
+    integral = 0, error = 0;
+    for(QuadInterval& interval : heap) {
+        integral += interval.integral;
+        error += interval.error;
+    }
+    return {integral, error, evals};
+}
@@ -0,0 +1,27 @@
+#ifndef QUAD
+#define QUAD
+
+#include "backend.h"
+
+/* ~ ~ ~ ~ ~ Adaptive Quadrature ~ ~ ~ ~ ~ */
+
+/*
+ * integrate_adaptive: the integral of f over [a, b] by adaptive Gauss-Kronrod quadrature. Each
+ * subinterval is integrated by the 15-point Kronrod rule, and the difference from the 7-point
+ * Gauss rule embedded in it estimates the error. The subinterval with the largest error is
+ * bisected until the total error is within max(abs_tol, rel_tol * |integral|) or the next
+ * bisection would take more than max_evals evaluations of f. Infinite bounds are mapped to a
+ * finite interval by a change of variable; as the rule never evaluates f at the ends of an
+ * interval, integrable singularities at the bounds are handled too. a > b is allowed.
+ */
+
+struct QuadResult {
+    double integral;
+    double error; // estimate of the absolute error
+    long evals;   // evaluations of f
+};
+
+QuadResult integrate_adaptive(const function<double(double)>& f, double a, double b,
+                              double abs_tol, double rel_tol, long max_evals);
+
+#endif // QUAD
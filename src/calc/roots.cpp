@@ -0,0 +1,172 @@
+#include "roots.h"
+
+/* ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ Root Finding ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ */
+
+/* ~ ~ ~ ~ ~ Brent's Method ~ ~ ~ ~ ~ */
+
+double brent_root(const function<double(double)>& f, double a, double b, double fa, double fb) {
+    // b is the best guess, c the other end of the bracket, and a the previous guess; d is the
+    // last step and e the one before it
+    double c = b, fc = fb, d = b - a, e = d;
+
+    for(int i = 0; i < ROOT_MAX_ITERATIONS; i++) {
+        if((fb > 0) == (fc > 0)) c = a, fc = fa, d = e = b - a; // (keeps the root between b and c)
+        if(abs(fc) < abs(fb)) {
+            a = b, b = c, c = a;
+            fa = fb, fb = fc, fc = fa;
+        }
+
+        double tol = 2 * numeric_limits<double>::epsilon() * abs(b) + numeric_limits<double>::min();
+        double m = (c - b) / 2;
+        if(abs(m) <= tol || fb == 0) return b;
+
+        if(abs(e) >= tol && abs(fa) > abs(fb)) {
+            double s = fb / fa, p, q;
+            if(a == c) { // secant
+                p = 2 * m * s;
+                q = 1 - s;
+            } else { // inverse quadratic interpolation
+                double r = fb / fc;
+                q = fa / fc;
+                p = s * (2 * m * q * (q - r) - (b - a) * (r - 1));
+                q = (q - 1) * (r - 1) * (s - 1);
+            }
+            if(p > 0) q = -q;
+            else p = -p;
+
+            // (interpolates only while the step stays in the bracket and shrinks quickly enough)
+            if(2 * p < min(3 * m * q - abs(tol * q), abs(e * q))) e = d, d = p / q;
+            else d = e = m;
+        } else d = e = m;
+
+        a = b, fa = fb;
+        b += abs(d) > tol ? d : (m > 0 ? tol : -tol);
+        fb = f(b);
+    }
+    return b;
+}
+
+/* ~ ~ ~ ~ ~ Scanning ~ ~ ~ ~ ~ */
+
+struct RootBracket {
+    double a, b, fa, fb; // (a == b for a sample that is a root)
+};
+
+// do finite values fa and fb have opposite signs? (a sample on a pole is never a bracket's end)
+bool changes_sign(double fa, double fb) {
+    return isfinite(fa) && isfinite(fb) && (fa < 0 && fb > 0 || fa > 0 && fb < 0);
+}
+
+// the brackets of the samples' sign changes and zeros, in increasing order
+vector<RootBracket> bracket_roots(const vector<double>& x, const vector<double>& y) {
+    vector<RootBracket> brackets;
+    for(int i = 0; i < x.size(); i++) {
+        if(y[i] == 0) brackets.push_back({x[i], x[i], 0, 0});
+        else if(i + 1 < x.size() && changes_sign(y[i], y[i + 1]))
+            brackets.push_back({x[i], x[i + 1], y[i], y[i + 1]});
+    }
+    return brackets;
+}
+
+// the bracket's root, or NAN if it brackets a pole (where |f| grows past both ends' values)
+double refine_bracket(const function<double(double)>& f, const RootBracket& bracket) {
+    if(bracket.a == bracket.b) return bracket.a;
+
+    double root = brent_root(f, bracket.a, bracket.b, bracket.fa, bracket.fb);
+    return abs(f(root)) <= min(abs(bracket.fa), abs(bracket.fb)) ? root : NAN;
+}
+
+// the evenly spaced samples of find_roots' scan
+vector<double> scan_points(double a, double b, int intervals) {
+    if(a > b) swap(a, b);
+    vector<double> x(intervals + 1);
+    for(int i = 0; i <= intervals; i++) x[i] = a + (b - a) * i / intervals;
+    return x;
+}
+
+vector<double> found_roots(const vector<double>& roots) {
+    vector<double> found;
+    for(double root : roots) if(!isnan(root)) found.push_back(root);
+    return found;
+}
+
+vector<double> find_roots(const function<double(double)>& f, double a, double b, int intervals) {
+    vector<double> x = scan_points(a, b, intervals), y(x.size());
+    for(int i = 0; i < x.size(); i++) y[i] = f(x[i]);
+
+    vector<RootBracket> brackets = bracket_roots(x, y);
+    vector<double> roots(brackets.size());
+    for(int i = 0; i < brackets.size(); i++) roots[i] = refine_bracket(f, brackets[i]);
+    return found_roots(roots);
+}
+
+vector<double> find_roots(const BatchProgram& program, double a, double b, int intervals) {
+    vector<double> x = scan_points(a, b, intervals), y(x.size());
+    int n = x.size();
+
+    platform_parallel_for((n + BATCH_SIZE - 1) / BATCH_SIZE, [&](int batch) {
+        vector<double> regs = program.new_registers();
+        int start = batch * BATCH_SIZE;
+        program.run(&x[start], &y[start], min(BATCH_SIZE, n - start), regs.data());
+    });
+
+    // (each root is refined on its own; Brent's method evaluates one point at a time)
+    vector<RootBracket> brackets = bracket_roots(x, y);
+    vector<double> roots(brackets.size());
+    platform_parallel_for(brackets.size(), [&](int i) {
+        vector<double> regs = program.new_registers();
+        roots[i] = refine_bracket([&](double at) {
+            double val;
+            program.run(&at, &val, 1, regs.data());
+            return val;
+        }, brackets[i]);
+    });
+    return found_roots(roots);
+}
+
+double solve_root(const function<double(double)>& f, double a, double b) {
+    double fa = f(a), fb = f(b);
+    if(fa == 0) return a;
+    if(fb == 0) return b;
+    if(changes_sign(fa, fb)) return refine_bracket(f, {a, b, fa, fb});
+
+    vector<double> roots = find_roots(f, a, b, ROOT_SCAN_INTERVALS);
+    return roots.empty() ? NAN : roots[0];
+}
+
+/* ~ ~ ~ ~ ~ Expressions ~ ~ ~ ~ ~ */
+
+vector<double> expression_roots(TreeNode& expr, const string& var_id, double a, double b, int intervals) {
+    unique_ptr<BatchProgram> program = BatchProgram::compile(expr, var_id);
+    if(program) return find_roots(*program, a, b, intervals);
+
+    double old_value = get_id_value(var_id);
+    double& var = ctx->identifier_table[var_id]; // (references to map elements are stable)
+    vector<double> roots = find_roots([&](double x) {
+        var = x;
+        return expr.eval();
+    }, a, b, intervals);
+    var = old_value;
+    return roots;
+}
+
+double solve_expression(TreeNode& expr, const string& var_id, double a, double b) {
+    unique_ptr<BatchProgram> program = BatchProgram::compile(expr, var_id);
+    if(program) {
+        vector<double> regs = program->new_registers();
+        return solve_root([&](double x) {
+            double val;
+            program->run(&x, &val, 1, regs.data());
+            return val;
+        }, a, b);
+    }
+
+    double old_value = get_id_value(var_id);
+    double& var = ctx->identifier_table[var_id];
+    double root = solve_root([&](double x) {
+        var = x;
+        return expr.eval();
+    }, a, b);
+    var = old_value;
+    return root;
+}
@@ -0,0 +1,42 @@
+#ifndef ROOTS
+#define ROOTS
+
+#include "batch.h"
+
+/* ~ ~ ~ ~ ~ Root Finding ~ ~ ~ ~ ~ */
+
+/*
+ * brent_root: a root of f in [a, b], where fa = f(a) and fb = f(b) have opposite signs, by Brent's
+ * method: inverse quadratic interpolation (or the secant method) while it makes progress, and
+ * bisection when it doesn't, so it converges superlinearly on smooth functions and is never much
+ * slower than bisection. The bracket is shrunk to a few ulps around the root.
+ *
+ * find_roots: the roots of f in [a, b], found by sampling f at intervals + 1 evenly spaced points
+ * to bracket its sign changes, then refining each bracket by Brent's method. Roots of even
+ * multiplicity (like x^2's) and pairs of roots closer than the sample spacing have no sign change
+ * between samples, so they're missed. A sign change across a pole (like tan's) converges to the
+ * pole, where |f| grows rather than shrinks, and is discarded; a sample that lands on a pole (where
+ * f is infinite or NAN) ends no bracket. Given a BatchProgram, the samples
+ * are evaluated by batches and the brackets are refined in parallel.
+ *
+ * solve_root: Brent's method on [a, b] if f changes sign over it, else the first root
+ * find_roots finds; NAN if there is none.
+ */
+
+constexpr int ROOT_MAX_ITERATIONS = 200;   // (of Brent's method; bisection alone needs < 100)
+constexpr int ROOT_SCAN_INTERVALS = 1000;  // default intervals of find_roots' scan
+
+double brent_root(const function<double(double)>& f, double a, double b, double fa, double fb);
+
+// the roots, in increasing order
+vector<double> find_roots(const function<double(double)>& f, double a, double b, int intervals);
+vector<double> find_roots(const BatchProgram& program, double a, double b, int intervals);
+
+double solve_root(const function<double(double)>& f, double a, double b);
+
+// (of expr in the identifier var_id: by a BatchProgram if expr has a batch form, else by setting
+// var_id to each point, as nintegral does)
+vector<double> expression_roots(TreeNode& expr, const string& var_id, double a, double b, int intervals);
+double solve_expression(TreeNode& expr, const string& var_id, double a, double b);
+
+#endif // ROOTS
@@ -0,0 +1,182 @@
+#include "rules.h"
+
+/* ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ Rewrite Rules ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ */
+
+/* ~ ~ ~ ~ ~ Node Accessors ~ ~ ~ ~ ~ */
+
+// A node is its type, name (as in Expr), value (numbers and derivative orders) and operands; the
+// tree overloads are for folding constants in rules before they're added.
+
+int node_arity(TreeNode *node) {
+    switch(node->type()) {
+        case nt_fn_call: return ((FunctionCallNode *) node)->args.size();
+        case nt_deriv: return ((DerivativeNode *) node)->args.size();
+        case nt_negation: return 1;
+        case nt_nary_sum:
+        case nt_nary_product: return ((NaryOpNode *) node)->args.size();
+        default: return is_binary_op(node->type()) ? 2 : 0;
+    }
+}
+
+TreeNode *node_child(TreeNode *node, int i) {
+    switch(node->type()) {
+        case nt_fn_call: return ((FunctionCallNode *) node)->args[i].get();
+        case nt_deriv: return ((DerivativeNode *) node)->args[i].get();
+        case nt_negation: return ((UnaryOpNode *) node)->arg.get();
+        case nt_nary_sum:
+        case nt_nary_product: return ((NaryOpNode *) node)->args[i].get();
+        default: return i == 0 ? ((BinaryOpNode *) node)->left.get() : ((BinaryOpNode *) node)->right.get();
+    }
+}
+
+enum node_type node_type_of(const Expr *e) { return e->type; }
+const string& node_name(const Expr *e) { return e->name; }
+double node_val(const Expr *e) { return e->val; }
+int node_arity(const Expr *e) { return e->num_args; }
+const Expr *node_child(const Expr *e, int i) { return e->arg(i); }
+bool same_subtree(const Expr *a, const Expr *b) { return a == b; } // (hash-consed)
+
+// the key of a node in the index
+template<typename Node>
+string node_symbol(Node node) {
+    enum node_type type = node_type_of(node);
+    int arity = node_arity(node);
+
+    string symbol(1, (char) type);
+    symbol += node_name(node);
+    if(type == nt_num || type == nt_deriv) {
+        double val = node_val(node);
+        if(val == 0) val = 0; // -0 matches 0
+        symbol.append((const char *) &val, sizeof(double));
+    }
+    symbol.append((const char *) &arity, sizeof(int));
+    return symbol;
+}
+
+bool is_pattern_var(TreeNode& node) {
+    return node.type() == nt_id && ((VariableNode&) node).id[0] == '_';
+}
+
+/* ~ ~ ~ ~ ~ Rule Index ~ ~ ~ ~ ~ */
+
+void RuleSet::add(TreeNode& pattern, TreeNode& replacement) {
+    Rule rule {table.from_tree(pattern), table.from_tree(replacement)};
+
+    RuleIndexNode *at = &index;
+    vector<const Expr *> pending = {rule.pattern}; // preorder: the next node is at the back
+
+    while(!pending.empty()) {
+        const Expr *node = pending.back();
+        pending.pop_back();
+
+        if(is_pattern_var(node)) {
+            if(!at->wildcard) at->wildcard = make_unique<RuleIndexNode>();
+            at = at->wildcard.get();
+            continue;
+        }
+
+        unique_ptr<RuleIndexNode>& child = at->children[node_symbol(node)];
+        if(!child) child = make_unique<RuleIndexNode>();
+        at = child.get();
+        for(int i = node->num_args - 1; i >= 0; i--) pending.push_back(node->arg(i));
+    }
+
+    at->rules.push_back(rules.size());
+    root_types |= is_pattern_var(rule.pattern) ? ~0ull : 1ull << rule.pattern->type;
+    rules.push_back(rule);
+}
+
+// adds the rules whose patterns match the pending subtrees (up to variable bindings) to out;
+// pending is left as it was given
+template<typename Node>
+void find_candidates(RuleIndexNode& at, vector<Node>& pending, vector<int>& out) {
+    if(pending.empty()) {
+        out.insert(out.end(), at.rules.begin(), at.rules.end());
+        return;
+    }
+
+    Node node = pending.back();
+    pending.pop_back();
+
+    if(at.wildcard) find_candidates(*at.wildcard, pending, out); // skips the whole subtree
+
+    auto child = at.children.empty() ? at.children.end() : at.children.find(node_symbol(node));
+    if(child != at.children.end()) {
+        size_t num_pending = pending.size();
+        for(int i = node_arity(node) - 1; i >= 0; i--) pending.push_back(node_child(node, i));
+        find_candidates(*child->second, pending, out);
+        pending.resize(num_pending);
+    }
+
+    pending.push_back(node);
+}
+
+template<typename Node>
+bool match_pattern(const Expr *pattern, Node node, vector<pair<const string *, Node>>& bindings) {
+    if(is_pattern_var(pattern)) {
+        Node bound = find_binding(bindings, pattern->name);
+        if(bound != nullptr) return same_subtree(bound, node);
+
+        bindings.emplace_back(&pattern->name, node);
+        return true;
+    }
+
+    if(pattern->type != node_type_of(node) || pattern->num_args != node_arity(node) ||
+       pattern->name != node_name(node)) return false;
+
+    double val = node_val(node);
+    if(pattern->val != val && !(isnan(pattern->val) && isnan(val))) return false;
+
+    for(int i = 0; i < pattern->num_args; i++) {
+        if(!match_pattern(pattern->arg(i), node_child(node, i), bindings)) return false;
+    }
+    return true;
+}
+
+template<typename Node>
+const Rule *match_rules(RuleSet& set, Node node, vector<pair<const string *, Node>>& bindings) {
+    // (matching never recurses into another match, so the buffers are reused)
+    thread_local vector<Node> pending;
+    thread_local vector<int> candidates;
+    pending.assign(1, node);
+    candidates.clear();
+    find_candidates(set.index, pending, candidates);
+
+    sort(candidates.rbegin(), candidates.rend()); // later rules first
+    for(int rule : candidates) {
+        bindings.clear();
+        if(match_pattern(set.rules[rule].pattern, node, bindings)) return &set.rules[rule];
+    }
+    return nullptr;
+}
+
+const Rule *RuleSet::match(const Expr *e, ExprBindings& bindings) {
+    if(!(root_types >> e->type & 1)) return nullptr;
+    return match_rules(*this, e, bindings);
+}
+
+/* ~ ~ ~ ~ ~ Constant Folding ~ ~ ~ ~ ~ */
+
+unique_ptr<TreeNode> fold_constants(unique_ptr<TreeNode>&& tree) {
+    return tree->exe_on_children(std::move(tree), [](unique_ptr<TreeNode>&& node) -> unique_ptr<TreeNode> {
+        switch(node->type()) {
+            case nt_negation:
+            case nt_sum:
+            case nt_difference:
+            case nt_product:
+            case nt_quotient:
+            case nt_exponentiation: break;
+            default: return std::move(node);
+        }
+
+        for(int i = 0; i < node_arity(node.get()); i++) {
+            if(node_child(node.get(), i)->type() != nt_num) return std::move(node);
+        }
+        return make_unique<NumberNode>(node->eval());
+    });
+}
+
+void add_rule(RuleSet& set, const string& pattern, const string& replacement) {
+    unique_ptr<TreeNode> pattern_tree = fold_constants(parseS(tokenize(pattern)));
+    set.add(*pattern_tree, *fold_constants(parseS(tokenize(replacement))));
+}
@@ -0,0 +1,58 @@
+#ifndef RULES
+#define RULES
+
+#include "expr.h"
+
+/* ~ ~ ~ ~ ~ Rewrite Rules ~ ~ ~ ~ ~ */
+
+/*
+ * RuleSet: rewrite rules (pattern => replacement) for the CAS. Identifiers starting with '_' in
+ * a pattern are pattern variables: each matches any subtree, and a variable that appears twice
+ * must match equal subtrees. Patterns are indexed by a discrimination tree, keyed by the symbols
+ * (operator, function, identifier or number, and arity) of their preorder traversal with
+ * variables as wildcards: the rules that might match a tree are found by walking the index along
+ * the tree's own symbols, instead of trying every rule. The candidates are then matched in full;
+ * rules added later take precedence. Rules match expression DAGs (see symb_simp and symb_deriv).
+ */
+
+struct Rule {
+    const Expr *pattern, *replacement; // (nodes of the rule set's table)
+};
+
+struct RuleIndexNode {
+    unordered_map<string, unique_ptr<RuleIndexNode>> children; // by symbol
+    unique_ptr<RuleIndexNode> wildcard; // for pattern variables
+    vector<int> rules; // rules whose patterns end here
+};
+
+// pattern variables' ids (owned by the rule's pattern) and the subexpressions they matched
+typedef vector<pair<const string *, const Expr *>> ExprBindings;
+
+struct RuleSet {
+    ExprTable table; // rules are kept as DAGs, so they're cheap to walk while matching
+    vector<Rule> rules;
+    RuleIndexNode index;
+    uint64_t root_types = 0; // bit t is set if a pattern's root may have node type t
+
+    void add(TreeNode& pattern, TreeNode& replacement);
+
+    // the matching rule that takes precedence (nullptr if none), with its variables bound
+    const Rule *match(const Expr *e, ExprBindings& bindings);
+};
+
+bool is_pattern_var(TreeNode& node);
+inline bool is_pattern_var(const Expr *e) { return e->type == nt_id && e->name[0] == '_'; }
+
+template<typename Node>
+Node find_binding(const vector<pair<const string *, Node>>& bindings, const string& id) {
+    for(auto& binding : bindings) if(*binding.first == id) return binding.second;
+    return nullptr;
+}
+
+// evaluates the subtrees of a rule that are arithmetic on numbers (so -1/2 becomes -0.5)
+unique_ptr<TreeNode> fold_constants(unique_ptr<TreeNode>&& tree);
+
+// parses a rule's pattern and replacement, folding constants, and adds it to the set
+void add_rule(RuleSet& set, const string& pattern, const string& replacement);
+
+#endif // RULES
@@ -2,6 +2,8 @@
 #define CALCULATOR
 
 #include <vector>
+#include <array>
+#include <tuple>
 #include <regex>
 #include <cmath>
 #include <iostream>
@@ -10,13 +12,18 @@
 #include <utility>
 #include <cstring>
 #include <cstdlib>
-#include <emscripten.h>
+#include <string>
+#include <unordered_map>
+#include <functional>
+#include <deque>
+#include <list>
+#include <string_view>
+#include <charconv>
 #include <cassert>
+#include <limits>
 
 using namespace std;
 
-extern double last_answer; // holds result of last computation
-
 /* ~ ~ ~ ~ ~ Parsing Tree Class ~ ~ ~ ~ ~ */
 
 enum node_type {
@@ -46,16 +53,127 @@ enum node_type {
 };
 
 struct TreeNode { // Abstract superclass for all other node types
-    virtual string to_string(enum node_type parent_type = nt_none) = 0;
-    virtual string to_latex_string(enum node_type parent_type = nt_none) { return to_string(parent_type); }
+    // nodes serialize themselves by appending to a single output string, so that a whole tree
+    // is written in one pass (to_string/to_latex_string are the convenient entry points)
+    virtual void append_string(string& out, enum node_type parent_type = nt_none) = 0;
+    virtual void append_latex_string(string& out, enum node_type parent_type = nt_none) {
+        append_string(out, parent_type);
+    }
+
+    string to_string(enum node_type parent_type = nt_none) {
+        string out;
+        append_string(out, parent_type);
+        return out;
+    }
+
+    string to_latex_string(enum node_type parent_type = nt_none) {
+        string out;
+        append_latex_string(out, parent_type);
+        return out;
+    }
+
     virtual double eval() = 0;
     virtual unique_ptr<TreeNode> exe_on_children(unique_ptr<TreeNode>&& self,
             function<unique_ptr<TreeNode>(unique_ptr<TreeNode>&&)> fn) { return fn(std::move(self)); }
-    virtual unique_ptr<TreeNode> copy() = 0;
+    virtual unique_ptr<TreeNode> clone() = 0; // deep copy (use copy)
     virtual enum node_type type() = 0;
     virtual ~TreeNode() { }
+
+    unique_ptr<TreeNode> copy() { return clone(); }
+
+    // nodes are allocated out of per-thread arena blocks (see arena.cpp)
+    static void *operator new(size_t size);
+    static void operator delete(void *ptr);
+};
+
+/* ~ ~ ~ ~ ~ Tree Allocation ~ ~ ~ ~ ~ */
+
+// while one of these is alive, new nodes on this thread are allocated on the heap rather than
+// in an arena block: for trees that are kept after the command that made them
+struct PersistentAllocScope {
+    PersistentAllocScope();
+    ~PersistentAllocScope();
+};
+
+unique_ptr<TreeNode> persistent_copy(TreeNode& node); // copy of node, allocated on the heap
+
+struct TreeAllocStats {
+    long arena_nodes = 0;      // nodes allocated from arena blocks
+    long heap_nodes = 0;       // nodes allocated on the heap (persistent or oversized)
+    long blocks_allocated = 0; // arena blocks obtained with malloc
+    size_t peak_bytes = 0;     // peak memory held in arena blocks
+};
+
+TreeAllocStats tree_alloc_stats();
+
+
+/* ~ ~ ~ ~ ~ Calculator Context ~ ~ ~ ~ ~ */
+
+struct Function;
+struct CasCache;
+struct RuleSet;
+
+// hits and misses of a context's CAS memo tables, indexed by operation: simp, deriv, expand
+struct CasCacheStats {
+    long hits[3] = {0, 0, 0};
+    long misses[3] = {0, 0, 0};
+    int entries = 0; // results currently memoized
+};
+typedef function<unique_ptr<TreeNode>(unique_ptr<TreeNode>&&)> macro_fn;
+
+constexpr int MAX_GRAPH_FUNCTIONS = 30; // limit to 30 because bitset is used when drawing
+
+/*
+ * CalcContext: all of the state of one calculator session (variables, functions, macros,
+ * results, cas options and the graph). Independent contexts can be evaluated on different
+ * threads in parallel; a context itself must only be used by one thread at a time.
+ */
+struct CalcContext {
+    unordered_map<string, double> identifier_table; // stores values of all variables
+    unordered_map<string, unique_ptr<Function>> fn_table; // stores all functions
+    unordered_map<string, unique_ptr<macro_fn>> macro_table;
+
+    bool param_override = false; // set to true during function calls for name substitution
+    unordered_map<string, double> param_id; // names to substitute w/ (index to substitute + 1)
+    vector<double> params; // values to substitute
+
+    double last_answer = NAN; // holds result of last computation
+    string latex_result = ""; // rendered from the trees below when get_latex_result is called
+    unique_ptr<TreeNode> latex_before_macros; // last command before macros (nullptr if none ran)
+    unique_ptr<TreeNode> latex_after_macros;  // last command after macros (nullptr once rendered)
+    deque<string> batch_pending; // results of the last calculate_batch not yet delivered
+
+    // symbolic derivative options
+    string diff_id;
+    bool is_partial = true;
+    unique_ptr<CasCache> cas_cache; // memoized CAS results (allocated on first use)
+    unique_ptr<RuleSet> simp_rules, deriv_rules; // rewrite rules (see rules.h)
+
+    // graph
+    vector<unique_ptr<TreeNode>> graphed_functions; // index corresponds to id
+    vector<int> graph_buffer; // contains bitsets, each bit corresponding to a function/axis
+                              // (0th bit is axis, nth bit is graphed_functions[n - 1]);
+                              // allocated on first use
+    int graph_height = 1000, graph_width = 1000; // changed dynamically on browser resize
+    double x_min = -10, x_max = 10, y_min = -10, y_max = 10; // changed dynamically on browser resize
+    bool axes_enabled = true;
+    int tic_px = 2;
+
+    CalcContext();
+    ~CalcContext();
+};
+
+extern thread_local CalcContext *ctx; // context being evaluated on this thread
+
+// makes c the current context of this thread for the lifetime of the scope
+struct ContextScope {
+    CalcContext *prev;
+    ContextScope(CalcContext& c) : prev(ctx) { ctx = &c; }
+    ~ContextScope() { ctx = prev; }
 };
 
+CalcContext& default_context(); // the context used by the exported (webpage) functions
+CasCacheStats cas_cache_stats(CalcContext& c);
 
 /* ~ ~ ~ ~ ~ Calculator Backend ~ ~ ~ ~ ~ */
 
@@ -71,10 +189,6 @@ void init_functions();
 void init_math_functions();
 void init_macro_functions();
 
-typedef function<unique_ptr<TreeNode>(unique_ptr<TreeNode>&&)> macro_fn;
-
-const double DERIV_STEP = 1e-6;
-
 /* ~ ~ ~ ~ ~ Calculator Errors ~ ~ ~ ~ ~ */
 
 struct calculator_error : public runtime_error {
@@ -112,12 +226,50 @@ bool add_to_graph(unique_ptr<TreeNode>&& expr);
 void draw_axes();
 void undraw_axes();
 
+/* ~ ~ ~ ~ ~ Platform Callbacks ~ ~ ~ ~ ~ */
+
+// UI notifications from the engine, implemented once per build target:
+// src/platform/wasm.cpp (calls into the page's scripts) or src/platform/native.cpp
+void platform_clear_screen();
+void platform_add_graph_fn(const string& name, int id);
+void platform_remove_graph_fn(int index);
+void platform_set_graph_window(double x_min, double y_min, double x_max, double y_max);
+
+// runs task(0), ..., task(num_tasks - 1), spread over threads where the target has them (tasks
+// mustn't use the context)
+void platform_parallel_for(int num_tasks, const function<void(int)>& task);
+
+/* ~ ~ ~ ~ ~ Context Interface ~ ~ ~ ~ ~ */
+
+void init(CalcContext& c);
+string calculate_text(CalcContext& c, string text, bool just_numeric_result);
+
+// calculate_text, split into its two stages (parse_command doesn't touch any context)
+struct ParsedCommand {
+    unique_ptr<TreeNode> tree; // nullptr if the text couldn't be parsed
+    string error;              // the error message, when tree is nullptr
+};
+
+ParsedCommand parse_command(const string& text);
+string evaluate_command(CalcContext& c, ParsedCommand&& cmd, bool just_numeric_result);
+
+int calculate_batch(CalcContext& c, const char *commands, int count, bool just_numeric_result,
+                    char *out, int out_capacity, int *offsets, int offsets_capacity);
+string get_latex_result(CalcContext& c);
+
+int *get_graph_buffer(CalcContext& c);
+bool remove_from_graph(CalcContext& c, int index);
+void resize_graph(CalcContext& c, int new_height, int new_width, double new_x_min,
+                  double new_x_max, double new_y_min, double new_y_max);
+void draw_trace_line(CalcContext& c, int x_c);
+
 /* ~ ~ ~ ~ ~ Exported Functions ~ ~ ~ ~ ~ */
 
 extern "C" {
     /* ~ Calculator ~ */
     void init();
     char *calculate_text(const char *, bool);
+    int calculate_batch(const char *, int, bool, char *, int, int *, int);
     char *get_latex_result();
 
     /* ~ Graphing ~ */
@@ -0,0 +1,302 @@
+#include "../calculator.h"
+#include <iostream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <chrono>
+#include <string_view>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ Command-Line Calculator ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ */
+
+/*
+ * graphcalc: a native read-eval-print loop over the calculator engine.
+ *
+ * Reads one command per line from stdin and prints each result, exactly as the
+ * webpage's terminal would. With -n only the numeric result is printed; with -l
+ * the LaTeX of each command is printed after its result.
+ *
+ * With -b, runs a script in batch mode instead (see below).
+ *
+ * usage: graphcalc [-n] [-l]
+ *        graphcalc -b [-n] [script_path | -]
+ */
+
+using namespace std::chrono;
+
+/* ~ ~ ~ ~ ~ Batch Mode ~ ~ ~ ~ ~ */
+
+// Batch mode evaluates a whole script, one command per line, in two pipelined stages: a
+// parser thread lexes and parses lines ahead of the main thread, which evaluates them in
+// order (evaluation must stay in order on one context, since commands depend on earlier
+// assignments). A regular script file is memory-mapped; anything else, like "-" (or no path)
+// for stdin, is read as it arrives, so a pipe's lines are evaluated (and answered) while its
+// producer is still writing.
+//
+// Output is compact: exactly one line per script line, so output line N answers script
+// line N. Multi-line results are joined with tabs, and blank script lines give blank
+// output lines. Throughput and tree allocation statistics are reported on stderr at the end.
+
+constexpr size_t BATCH_CHUNK_LINES = 256;   // lines handed between the stages at a time
+constexpr size_t BATCH_MAX_CHUNKS = 64;     // parsed chunks allowed to wait for evaluation
+constexpr size_t BATCH_READ_SIZE = 1 << 16; // bytes read from a stream at a time
+
+struct BatchChunk {
+    vector<ParsedCommand> commands; // a default (empty) command stands for a blank line
+    bool last = false;
+};
+
+// bounded single-producer/single-consumer queue of parsed chunks
+struct ChunkQueue {
+    mutex lock;
+    condition_variable changed;
+    deque<BatchChunk> chunks;
+
+    void push(BatchChunk&& chunk) {
+        unique_lock<mutex> guard(lock);
+        changed.wait(guard, [&] { return chunks.size() < BATCH_MAX_CHUNKS; });
+        chunks.push_back(std::move(chunk));
+        changed.notify_all();
+    }
+
+    BatchChunk pop() {
+        unique_lock<mutex> guard(lock);
+        changed.wait(guard, [&] { return !chunks.empty(); });
+        BatchChunk chunk = std::move(chunks.front());
+        chunks.pop_front();
+        changed.notify_all();
+        return chunk;
+    }
+
+    bool empty() {
+        lock_guard<mutex> guard(lock);
+        return chunks.empty();
+    }
+};
+
+// the script: memory-mapped contents of a regular file, or a stream (stdin, a pipe) to read
+struct Script {
+    const char *data = nullptr;
+    size_t size = 0;
+    void *mapping = nullptr;
+    int stream_fd = -1; // (>= 0 when the script is read as a stream)
+
+    bool open(const string& path) {
+        int fd = path == "-" ? STDIN_FILENO : ::open(path.c_str(), O_RDONLY);
+        struct stat info;
+        if(fd < 0 || fstat(fd, &info) < 0) {
+            if(fd > STDIN_FILENO) close(fd);
+            return false;
+        }
+
+        if(!S_ISREG(info.st_mode)) {
+            stream_fd = fd;
+            return true;
+        }
+
+        size = info.st_size;
+        if(size) {
+            mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if(mapping == MAP_FAILED) mapping = nullptr;
+            else madvise(mapping, size, MADV_SEQUENTIAL);
+        }
+        if(fd > STDIN_FILENO) close(fd);
+
+        data = (const char *) mapping;
+        return size == 0 || mapping != nullptr;
+    }
+
+    ~Script() {
+        if(mapping) munmap(mapping, size);
+        if(stream_fd > STDIN_FILENO) close(stream_fd);
+    }
+};
+
+// parses lines into chunks, handing each full chunk to the queue
+struct ChunkBuilder {
+    ChunkQueue& queue;
+    BatchChunk chunk;
+
+    ChunkBuilder(ChunkQueue& q) : queue(q) { }
+
+    void add(string_view line) {
+        if(line.size() && line.back() == '\r') line.remove_suffix(1);
+
+        if(line.empty()) chunk.commands.emplace_back();
+        else chunk.commands.push_back(parse_command(string(line)));
+
+        if(chunk.commands.size() == BATCH_CHUNK_LINES) flush();
+    }
+
+    // hands over the lines parsed so far, even if they don't fill a chunk
+    void flush() {
+        if(chunk.commands.empty()) return;
+        queue.push(std::move(chunk));
+        chunk = BatchChunk();
+    }
+
+    void finish() {
+        chunk.last = true;
+        queue.push(std::move(chunk));
+    }
+};
+
+// adds each complete line of text[0, size) to chunks; returns the length of the lines added
+size_t add_lines(ChunkBuilder& chunks, const char *text, size_t size) {
+    size_t pos = 0;
+    while(const char *newline = (const char *) memchr(text + pos, '\n', size - pos)) {
+        size_t end = newline - text;
+        chunks.add(string_view(text + pos, end - pos));
+        pos = end + 1;
+    }
+    return pos;
+}
+
+void parse_script(const Script& script, ChunkQueue& queue, double& parse_seconds) {
+    ChunkBuilder chunks(queue);
+
+    if(script.stream_fd < 0) {
+        steady_clock::time_point start = steady_clock::now();
+        size_t pos = add_lines(chunks, script.data, script.size);
+        if(pos < script.size) chunks.add(string_view(script.data + pos, script.size - pos));
+        parse_seconds = duration<double>(steady_clock::now() - start).count();
+        chunks.finish();
+        return;
+    }
+
+    // (parse_seconds doesn't count waiting on the stream)
+    string pending; // read text past the last complete line
+    vector<char> buffer(BATCH_READ_SIZE);
+
+    while(true) {
+        ssize_t n = read(script.stream_fd, buffer.data(), buffer.size());
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) break;
+
+        steady_clock::time_point start = steady_clock::now();
+        pending.append(buffer.data(), n);
+        pending.erase(0, add_lines(chunks, pending.data(), pending.size()));
+        chunks.flush(); // (so the lines read are evaluated without waiting for more)
+        parse_seconds += duration<double>(steady_clock::now() - start).count();
+    }
+
+    if(pending.size()) chunks.add(pending); // (a last line without a newline)
+    chunks.finish();
+}
+
+int run_batch(const string& path, bool just_numeric) {
+    Script script;
+    if(!script.open(path)) {
+        cerr << "graphcalc: can't read " << path << endl;
+        return 1;
+    }
+
+    CalcContext& c = default_context();
+    init(c);
+
+    steady_clock::time_point start = steady_clock::now();
+    ChunkQueue queue;
+    double parse_seconds = 0;
+    thread parser(parse_script, cref(script), ref(queue), ref(parse_seconds));
+
+    string out;
+    size_t num_lines = 0, num_commands = 0;
+    double eval_seconds = 0;
+
+    for(bool last = false; !last;) {
+        BatchChunk chunk = queue.pop();
+        last = chunk.last;
+
+        steady_clock::time_point eval_start = steady_clock::now();
+        for(ParsedCommand& cmd : chunk.commands) {
+            num_lines++;
+            if(cmd.tree != nullptr || cmd.error.size()) {
+                num_commands++;
+                string result = evaluate_command(c, std::move(cmd), just_numeric);
+                if(result.size() && result.back() == '\n') result.pop_back();
+                for(char& ch : result) if(ch == '\n') ch = '\t';
+                out += result;
+            }
+            out += '\n';
+        }
+        eval_seconds += duration<double>(steady_clock::now() - eval_start).count();
+
+        if(out.size() >= (1 << 16) || last || queue.empty()) { // (nothing else ready to evaluate)
+            fwrite(out.data(), 1, out.size(), stdout);
+            fflush(stdout);
+            out.clear();
+        }
+    }
+
+    parser.join();
+    fflush(stdout);
+
+    double seconds = duration<double>(steady_clock::now() - start).count();
+    fprintf(stderr, "graphcalc: %zu commands (%zu lines) in %.3f s: %.0f commands/s "
+                    "(parse %.3f s, evaluate %.3f s)\n",
+            num_commands, num_lines, seconds, num_commands / seconds, parse_seconds, eval_seconds);
+
+    TreeAllocStats alloc = tree_alloc_stats();
+    fprintf(stderr, "graphcalc: %ld tree nodes from arenas, %ld on the heap; %ld arena blocks "
+                    "allocated, peak arena memory %zu KiB\n",
+            alloc.arena_nodes, alloc.heap_nodes, alloc.blocks_allocated, alloc.peak_bytes / 1024);
+
+    CasCacheStats cas = cas_cache_stats(c);
+    long hits = cas.hits[0] + cas.hits[1] + cas.hits[2];
+    long lookups = hits + cas.misses[0] + cas.misses[1] + cas.misses[2];
+    fprintf(stderr, "graphcalc: CAS memo tables: %ld of %ld results reused (simp %ld/%ld, "
+                    "deriv %ld/%ld, expand %ld/%ld)\n",
+            hits, lookups, cas.hits[0], cas.hits[0] + cas.misses[0], cas.hits[1],
+            cas.hits[1] + cas.misses[1], cas.hits[2], cas.hits[2] + cas.misses[2]);
+    return 0;
+}
+
+/* ~ ~ ~ ~ ~ Interactive Mode ~ ~ ~ ~ ~ */
+
+int run_repl(bool just_numeric, bool print_latex) {
+    CalcContext& c = default_context();
+    init(c);
+
+    bool interactive = isatty(STDIN_FILENO);
+    string line;
+
+    while(true) {
+        if(interactive) cout << "> " << flush;
+        if(!getline(cin, line)) break;
+        if(line.empty()) continue;
+
+        string result = calculate_text(c, line, just_numeric);
+        cout << result;
+        if(result.size() && result.back() != '\n') cout << '\n';
+        if(print_latex) cout << get_latex_result(c) << '\n';
+    }
+
+    if(interactive) cout << endl;
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    bool just_numeric = false, print_latex = false, batch = false;
+    string script_path = "-";
+
+    for(int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if(arg == "-n") just_numeric = true;
+        else if(arg == "-l") print_latex = true;
+        else if(arg == "-b") batch = true;
+        else if(batch && (arg == "-" || arg[0] != '-')) script_path = arg;
+        else {
+            cerr << "usage: " << argv[0] << " [-n] [-l]\n"
+                 << "       " << argv[0] << " -b [-n] [script_path | -]" << endl;
+            return 1;
+        }
+    }
+
+    ios::sync_with_stdio(false);
+    return batch ? run_batch(script_path, just_numeric) : run_repl(just_numeric, print_latex);
+}
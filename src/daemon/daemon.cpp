@@ -0,0 +1,441 @@
+#include "../calculator.h"
+#include "protocol.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <csignal>
+#include <cerrno>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/* ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ Evaluation Daemon ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ */
+
+/*
+ * graphcalcd: serves calculator sessions over a unix domain socket (see protocol.h).
+ *
+ * Each connection has a reader thread that parses request lines and hands them to the
+ * session they name. Every session owns one CalcContext and a queue of pending jobs; a session
+ * with pending jobs is scheduled onto the worker pool, where one worker at a time drains its
+ * queue. This keeps each context single-threaded while different sessions run in parallel.
+ * Responses are written back in request order per connection, regardless of which worker
+ * finishes first, by the connection's writer thread: a client that doesn't read its responses
+ * only stalls its own connection, never a worker.
+ *
+ * usage: graphcalcd [-s socket_path] [-j worker_threads]
+ */
+
+constexpr int JOBS_PER_TURN = 64; // jobs a worker runs for one session before yielding
+constexpr int MAX_RENDER_DIM = 4096;
+constexpr size_t MAX_UNSENT_BYTES = 64 << 20; // responses queued on a connection before reading pauses
+constexpr size_t MAX_REQUEST_LINE = 1 << 20; // longer requests close their connection
+
+// graph colors (same defaults as the webpage, see graph/graphing.js)
+const uint8_t DEFAULT_COLORS[][4] = {
+    {36, 36, 255, 255}, {255, 0, 0, 255}, {0, 0, 0, 255}, {255, 0, 255, 255},
+    {45, 200, 45, 255}, {255, 160, 25, 255}, {165, 42, 42, 255}
+};
+const uint8_t AXIS_COLOR[4] = {0, 0, 0, 255};
+
+/* ~ ~ ~ ~ ~ Connections ~ ~ ~ ~ ~ */
+
+struct Response {
+    bool done = false;
+    string line;
+};
+
+struct Connection {
+    int fd;
+    mutex lock; // guards everything below
+    condition_variable changed; // (of out, reading, or the room left in out)
+    deque<shared_ptr<Response>> pending; // responses in request order
+    string out; // completed responses, in order, not yet written
+    bool reading = true; // false once the reader has dispatched its last request
+    bool broken = false; // the client went away: responses are dropped
+
+    Connection(int f) : fd(f) { }
+    ~Connection() { close(fd); }
+
+    // reserves the next response slot (called by the reader, in request order)
+    shared_ptr<Response> reserve() {
+        lock_guard<mutex> guard(lock);
+        pending.push_back(make_shared<Response>());
+        return pending.back();
+    }
+
+    // fills the given slot, then queues every completed response at the front for the writer
+    // (workers never block on the socket)
+    void complete(const shared_ptr<Response>& response, string&& line) {
+        lock_guard<mutex> guard(lock);
+        response->line = std::move(line);
+        response->done = true;
+
+        while(pending.size() && pending.front()->done) {
+            if(!broken) out += pending.front()->line;
+            pending.pop_front();
+        }
+        changed.notify_all();
+    }
+
+    // blocks the reader while a client that doesn't read its responses has MAX_UNSENT_BYTES of
+    // them queued, so it's paced by its own socket
+    void wait_for_room() {
+        unique_lock<mutex> guard(lock);
+        changed.wait(guard, [&] { return out.size() < MAX_UNSENT_BYTES; });
+    }
+
+    void finish_reading() {
+        lock_guard<mutex> guard(lock);
+        reading = false;
+        changed.notify_all();
+    }
+
+    // writes queued responses as they complete (on the connection's own thread), until the
+    // reader is done and every response is written
+    void write_responses() {
+        unique_lock<mutex> guard(lock);
+        while(true) {
+            changed.wait(guard, [&] { return out.size() || (!reading && pending.empty()); });
+            if(out.empty()) return;
+
+            string chunk = std::move(out);
+            out.clear();
+            changed.notify_all(); // (room for the reader)
+            guard.unlock();
+
+            bool failed = false;
+            for(size_t written = 0; written < chunk.size();) {
+                ssize_t n = send(fd, chunk.data() + written, chunk.size() - written, MSG_NOSIGNAL);
+                if(n < 0 && errno == EINTR) continue;
+                if(n <= 0) { // client went away: drop the rest
+                    failed = true;
+                    break;
+                }
+                written += n;
+            }
+
+            guard.lock();
+            if(failed) broken = true, out.clear();
+        }
+    }
+};
+
+/* ~ ~ ~ ~ ~ Sessions and Scheduling ~ ~ ~ ~ ~ */
+
+struct Job {
+    JsonObject request;
+    shared_ptr<Connection> conn;
+    shared_ptr<Response> response;
+};
+
+struct Session {
+    string name;
+    CalcContext context;
+    bool initialized = false;
+
+    mutex lock; // guards jobs and scheduled
+    deque<Job> jobs;
+    bool scheduled = false; // true while the session is in the ready queue or being run
+};
+
+mutex sessions_lock;
+unordered_map<string, shared_ptr<Session>> sessions;
+
+mutex ready_lock;
+condition_variable ready_cv;
+deque<shared_ptr<Session>> ready; // sessions with pending jobs, waiting for a worker
+
+void schedule(const shared_ptr<Session>& session) {
+    lock_guard<mutex> guard(ready_lock);
+    ready.push_back(session);
+    ready_cv.notify_one();
+}
+
+void submit(const shared_ptr<Session>& session, Job&& job) {
+    bool needs_scheduling;
+    {
+        lock_guard<mutex> guard(session->lock);
+        session->jobs.push_back(std::move(job));
+        needs_scheduling = !session->scheduled;
+        session->scheduled = true;
+    }
+
+    if(needs_scheduling) schedule(session);
+}
+
+shared_ptr<Session> find_or_create_session(const string& name) {
+    lock_guard<mutex> guard(sessions_lock);
+    shared_ptr<Session>& session = sessions[name];
+    if(session == nullptr) {
+        session = make_shared<Session>();
+        session->name = name;
+    }
+    return session;
+}
+
+/* ~ ~ ~ ~ ~ Request Handling ~ ~ ~ ~ ~ */
+
+void append_number(string& out, double num) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.17g", num);
+    out += buf;
+}
+
+// starts a response object, echoing the request's id and session
+string response_head(const JsonObject& request) {
+    string out = "{";
+    auto id = request.find("id");
+    if(id != request.end() && id->second.type == JsonValue::number_value) {
+        out += "\"id\":";
+        append_number(out, id->second.num);
+        out += ",";
+    } else if(id != request.end() && id->second.type == JsonValue::string_value) {
+        out += "\"id\":";
+        json_append_string(out, id->second.str);
+        out += ",";
+    }
+
+    auto session = request.find("session");
+    if(session != request.end()) {
+        out += "\"session\":";
+        json_append_string(out, session->second.str);
+        out += ",";
+    }
+    return out;
+}
+
+string error_response(const JsonObject& request, const string& message) {
+    string out = response_head(request);
+    out += "\"error\":";
+    json_append_string(out, message);
+    out += "}\n";
+    return out;
+}
+
+// rasterizes the session's graphed functions into a w x h RGBA image
+void render_rgba(CalcContext& c, int w, int h, const vector<double>& window, vector<uint8_t>& rgba) {
+    resize_graph(c, h, w, window[0], window[1], window[2], window[3]);
+    int *buffer = get_graph_buffer(c);
+
+    rgba.assign((size_t) w * h * 4, 0);
+    for(int i = 0; i < w * h; i++) {
+        if(buffer[i] == 0) continue;
+
+        const uint8_t *color = AXIS_COLOR;
+        for(int id = 0; id < MAX_GRAPH_FUNCTIONS; id++) {
+            if(buffer[i] & (2 << id)) {
+                color = DEFAULT_COLORS[id % 7];
+                break;
+            }
+        }
+
+        for(int k = 0; k < 4; k++) rgba[i * 4 + k] = color[k];
+    }
+}
+
+string run_request(Session& session, const JsonObject& request) {
+    auto field = [&](const string& key) -> const JsonValue * {
+        auto it = request.find(key);
+        return it == request.end() ? nullptr : &it->second;
+    };
+
+    if(!session.initialized) {
+        init(session.context);
+        session.initialized = true;
+    }
+
+    const JsonValue *close_flag = field("close"), *expr = field("expr"), *render_flag = field("render");
+
+    if(close_flag && close_flag->b) {
+        lock_guard<mutex> guard(sessions_lock);
+        sessions.erase(session.name);
+        return response_head(request) + "\"closed\":true}\n";
+    } else if(expr && expr->type == JsonValue::string_value) {
+        const JsonValue *numeric = field("numeric");
+        string result = calculate_text(session.context, expr->str, numeric && numeric->b);
+
+        string out = response_head(request);
+        out += "\"result\":";
+        json_append_string(out, result);
+        out += "}\n";
+        return out;
+    } else if(render_flag && render_flag->b) {
+        const JsonValue *w = field("w"), *h = field("h"), *window = field("window");
+        auto is_dimension = [](const JsonValue *v) { // (so the casts below are defined)
+            return v && v->type == JsonValue::number_value && isfinite(v->num) && v->num == floor(v->num) &&
+                   v->num >= 1 && v->num <= MAX_RENDER_DIM;
+        };
+        if(!is_dimension(w) || !is_dimension(h))
+            return error_response(request, "render requires integers 1 <= w, h <= " + to_string(MAX_RENDER_DIM));
+
+        vector<double> bounds = {-10, 10, -10, 10};
+        if(window) {
+            const vector<double>& arr = window->arr;
+            if(window->type != JsonValue::array_value || arr.size() != 4 || !all_of(arr.begin(), arr.end(), [](double v) { return isfinite(v); }) ||
+               !(arr[0] < arr[1] && arr[2] < arr[3]))
+                return error_response(request, "window must be finite [x_min, x_max, y_min, y_max], "
+                                               "with x_min < x_max and y_min < y_max");
+            bounds = arr;
+        }
+
+        vector<uint8_t> rgba;
+        render_rgba(session.context, (int) w->num, (int) h->num, bounds, rgba);
+
+        string out = response_head(request);
+        out += "\"w\":" + to_string((int) w->num) + ",\"h\":" + to_string((int) h->num) + ",\"rgba\":\"";
+        base64_append(out, rgba.data(), rgba.size());
+        out += "\"}\n";
+        return out;
+    }
+
+    return error_response(request, "request needs one of: expr, render, close");
+}
+
+void worker() {
+    while(true) {
+        shared_ptr<Session> session;
+        {
+            unique_lock<mutex> guard(ready_lock);
+            ready_cv.wait(guard, [] { return ready.size() > 0; });
+            session = std::move(ready.front());
+            ready.pop_front();
+        }
+
+        bool yielded = false;
+        for(int n = 0;; n++) {
+            Job job;
+            {
+                lock_guard<mutex> guard(session->lock);
+                if(session->jobs.empty()) {
+                    session->scheduled = false;
+                    break;
+                } else if(n == JOBS_PER_TURN) { // let other sessions run
+                    yielded = true;
+                    break;
+                }
+                job = std::move(session->jobs.front());
+                session->jobs.pop_front();
+            }
+
+            string line;
+            try {
+                line = run_request(*session, job.request);
+            } catch(exception& err) {
+                line = error_response(job.request, string("internal error: ") + err.what());
+            }
+            job.conn->complete(job.response, std::move(line));
+        }
+
+        if(yielded) schedule(session);
+    }
+}
+
+/* ~ ~ ~ ~ ~ Connection Handling ~ ~ ~ ~ ~ */
+
+void dispatch(const shared_ptr<Connection>& conn, const string& line) {
+    Job job;
+    job.conn = conn;
+    job.response = conn->reserve();
+
+    if(!json_parse_object(line, job.request)) {
+        conn->complete(job.response, error_response(job.request, "malformed request"));
+        return;
+    }
+
+    auto session = job.request.find("session");
+    if(session == job.request.end() || session->second.type != JsonValue::string_value) {
+        conn->complete(job.response, error_response(job.request, "missing session"));
+        return;
+    }
+
+    submit(find_or_create_session(session->second.str), std::move(job));
+}
+
+void serve_connection(int fd) {
+    shared_ptr<Connection> conn = make_shared<Connection>(fd);
+    thread writer([conn] { conn->write_responses(); });
+    string buffer;
+    char chunk[1 << 16];
+    bool too_long = false;
+
+    while(true) {
+        ssize_t n = read(fd, chunk, sizeof(chunk));
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) break;
+        buffer.append(chunk, n);
+
+        size_t start = 0, newline;
+        while((newline = buffer.find('\n', start)) != string::npos) {
+            if(newline > start) dispatch(conn, buffer.substr(start, newline - start));
+            start = newline + 1;
+        }
+        buffer.erase(0, start);
+
+        if(buffer.size() > MAX_REQUEST_LINE) { // (answered after the requests before it, then closed)
+            conn->complete(conn->reserve(), error_response(JsonObject(), "request line longer than " +
+                                                           to_string(MAX_REQUEST_LINE) + " bytes"));
+            too_long = true;
+            break;
+        }
+        conn->wait_for_room();
+    }
+
+    // (the writer finishes once every pending job's response is written)
+    conn->finish_reading();
+    writer.join();
+
+    // discards the rest of an overlong request until the client hangs up, since closing with
+    // unread input resets the connection and loses the error
+    if(too_long) {
+        shutdown(fd, SHUT_WR);
+        ssize_t n;
+        while((n = read(fd, chunk, sizeof(chunk))) > 0 || (n < 0 && errno == EINTR));
+    }
+}
+
+int main(int argc, char **argv) {
+    string socket_path = "/tmp/graphcalcd.sock";
+    int num_workers = max(1u, thread::hardware_concurrency());
+
+    for(int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if(arg == "-s" && i + 1 < argc) socket_path = argv[++i];
+        else if(arg == "-j" && i + 1 < argc) num_workers = max(1, atoi(argv[++i]));
+        else {
+            fprintf(stderr, "usage: %s [-s socket_path] [-j worker_threads]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    if(socket_path.size() >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "socket path too long: %s\n", socket_path.c_str());
+        return 1;
+    }
+    strcpy(addr.sun_path, socket_path.c_str());
+    unlink(socket_path.c_str());
+
+    if(listen_fd < 0 || bind(listen_fd, (sockaddr *) &addr, sizeof(addr)) < 0 ||
+       listen(listen_fd, 128) < 0) {
+        perror("graphcalcd");
+        return 1;
+    }
+
+    for(int i = 0; i < num_workers; i++) thread(worker).detach();
+    fprintf(stderr, "graphcalcd: listening on %s with %d workers\n", socket_path.c_str(), num_workers);
+
+    while(true) {
+        int fd = accept(listen_fd, nullptr, nullptr);
+        if(fd < 0) {
+            if(errno == EINTR) continue;
+            perror("graphcalcd: accept");
+            continue;
+        }
+        thread(serve_connection, fd).detach();
+    }
+}
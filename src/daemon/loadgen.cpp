@@ -0,0 +1,206 @@
+#include "protocol.h"
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/* ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ Daemon Load Generator ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ */
+
+/*
+ * graphcalc-load: measures graphcalcd throughput and latency.
+ *
+ * Each client opens its own connection, spreads its requests over its own sessions, and keeps
+ * up to `depth` requests in flight (pipelined). Every `render_every`'th request is a render of
+ * the session's graph; the rest cycle through a mix of numeric and CAS commands.
+ *
+ * usage: graphcalc-load [-s socket_path] [-c clients] [-n requests_per_client] [-d depth]
+ *                       [-S sessions_per_client] [-r render_every] [-w render_width]
+ */
+
+using namespace std::chrono;
+
+const char *EXPRESSIONS[] = {
+    "x = 3",
+    "x ^ 2 + 3 * x - 1",
+    "sin(x) * cos(x) + ln(x)",
+    "f(t) = t ^ 3 - 2 * t",
+    "f(x) + f'(x)",
+    "deriv(x ^ 3 * sin(x))",
+    "simp(x + x + 2 * x * y + y * x)",
+    "expand((x + 1) ^ 3)",
+    "nintegral(x ^ 2, x, 0, 1)",
+    "max(1, x, 7) + gcd(12, 18)",
+};
+constexpr int NUM_EXPRESSIONS = sizeof(EXPRESSIONS) / sizeof(EXPRESSIONS[0]);
+
+struct Options {
+    string socket_path = "/tmp/graphcalcd.sock";
+    int clients = 4;
+    int requests = 10000;
+    int depth = 16;
+    int sessions = 4;
+    int render_every = 0; // 0 = never
+    int render_width = 200;
+};
+
+struct ClientResult {
+    vector<double> latencies_us;
+    int errors = 0;
+    bool failed = false;
+};
+
+int connect_to(const string& path) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    if(fd < 0 || connect(fd, (sockaddr *) &addr, sizeof(addr)) < 0) {
+        if(fd >= 0) close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+bool write_all(int fd, const string& data) {
+    for(size_t written = 0; written < data.size();) {
+        ssize_t n = send(fd, data.data() + written, data.size() - written, MSG_NOSIGNAL);
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) return false;
+        written += n;
+    }
+    return true;
+}
+
+string make_request(const Options& opt, int client, int i) {
+    string out = "{\"id\":" + to_string(i) + ",\"session\":";
+    json_append_string(out, "load-" + to_string(client) + "-" + to_string(i % opt.sessions));
+
+    if(i < opt.sessions) { // first request of each session: give it something to render
+        out += ",\"expr\":\"graph(sin(x) * x)\"}\n";
+    } else if(opt.render_every && i % opt.render_every == 0) {
+        out += ",\"render\":true,\"w\":" + to_string(opt.render_width) +
+               ",\"h\":" + to_string(opt.render_width * 3 / 4) + ",\"window\":[-10,10,-10,10]}\n";
+    } else {
+        out += ",\"expr\":";
+        json_append_string(out, EXPRESSIONS[i % NUM_EXPRESSIONS]);
+        out += "}\n";
+    }
+    return out;
+}
+
+void run_client(const Options& opt, int client, ClientResult& result) {
+    int fd = connect_to(opt.socket_path);
+    if(fd < 0) {
+        result.failed = true;
+        return;
+    }
+
+    vector<steady_clock::time_point> sent(opt.requests);
+    result.latencies_us.reserve(opt.requests);
+    string buffer;
+    char chunk[1 << 16];
+    int next = 0, received = 0;
+
+    while(received < opt.requests) {
+        // fill the pipeline
+        string batch;
+        while(next < opt.requests && next - received < opt.depth) {
+            sent[next] = steady_clock::now();
+            batch += make_request(opt, client, next++);
+        }
+        if(batch.size() && !write_all(fd, batch)) {
+            result.failed = true;
+            break;
+        }
+
+        // read at least one response
+        ssize_t n = read(fd, chunk, sizeof(chunk));
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) {
+            result.failed = true;
+            break;
+        }
+        buffer.append(chunk, n);
+
+        size_t start = 0, newline;
+        while((newline = buffer.find('\n', start)) != string::npos) {
+            JsonObject response;
+            string line = buffer.substr(start, newline - start);
+            start = newline + 1;
+
+            if(!json_parse_object(line, response) || !response.count("id")) {
+                result.errors++;
+                received++;
+                continue;
+            }
+
+            int id = (int) response["id"].num;
+            if(response.count("error")) result.errors++;
+            if(id >= 0 && id < opt.requests)
+                result.latencies_us.push_back(duration<double, micro>(steady_clock::now() - sent[id]).count());
+            received++;
+        }
+        buffer.erase(0, start);
+    }
+
+    close(fd);
+}
+
+double percentile(const vector<double>& sorted, double p) {
+    if(sorted.empty()) return 0;
+    return sorted[min(sorted.size() - 1, (size_t) (p * sorted.size()))];
+}
+
+int main(int argc, char **argv) {
+    Options opt;
+
+    for(int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if(i + 1 >= argc) arg = "";
+
+        if(arg == "-s") opt.socket_path = argv[++i];
+        else if(arg == "-c") opt.clients = max(1, atoi(argv[++i]));
+        else if(arg == "-n") opt.requests = max(1, atoi(argv[++i]));
+        else if(arg == "-d") opt.depth = max(1, atoi(argv[++i]));
+        else if(arg == "-S") opt.sessions = max(1, atoi(argv[++i]));
+        else if(arg == "-r") opt.render_every = max(0, atoi(argv[++i]));
+        else if(arg == "-w") opt.render_width = max(4, atoi(argv[++i]));
+        else {
+            fprintf(stderr, "usage: %s [-s socket_path] [-c clients] [-n requests_per_client] "
+                            "[-d depth] [-S sessions_per_client] [-r render_every] "
+                            "[-w render_width]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    vector<ClientResult> results(opt.clients);
+    vector<thread> threads;
+
+    steady_clock::time_point start = steady_clock::now();
+    for(int c = 0; c < opt.clients; c++) threads.emplace_back(run_client, cref(opt), c, ref(results[c]));
+    for(thread& t : threads) t.join();
+    double seconds = duration<double>(steady_clock::now() - start).count();
+
+    vector<double> latencies;
+    int errors = 0, failed = 0;
+    for(ClientResult& r : results) {
+        latencies.insert(latencies.end(), r.latencies_us.begin(), r.latencies_us.end());
+        errors += r.errors;
+        failed += r.failed;
+    }
+    sort(latencies.begin(), latencies.end());
+
+    printf("clients %d, depth %d, sessions/client %d, render every %d\n",
+           opt.clients, opt.depth, opt.sessions, opt.render_every);
+    printf("responses %zu in %.3f s: %.0f req/s (%d error responses, %d failed clients)\n",
+           latencies.size(), seconds, latencies.size() / seconds, errors, failed);
+    printf("latency us: p50 %.1f  p90 %.1f  p99 %.1f  max %.1f\n",
+           percentile(latencies, 0.50), percentile(latencies, 0.90),
+           percentile(latencies, 0.99), latencies.size() ? latencies.back() : 0.0);
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,262 @@
+#ifndef PROTOCOL
+#define PROTOCOL
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <cstdlib>
+#include <cstdio>
+#include <cstdint>
+#include <cctype>
+
+using namespace std;
+
+/* ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ Daemon Wire Protocol ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ */
+
+/*
+ * Requests and responses are newline-delimited JSON objects, one per line. Only flat objects
+ * are used: values are strings, numbers, booleans, null, or arrays of numbers.
+ *
+ * Requests:
+ *     {"id": 1, "session": "s", "expr": "x = 3"}            evaluate a command
+ *     {"id": 2, "session": "s", "expr": "x", "numeric": true} evaluate, numeric result only
+ *     {"id": 3, "session": "s", "render": true, "w": 320, "h": 240,
+ *      "window": [x_min, x_max, y_min, y_max]}               rasterize the session's graph
+ *     {"id": 4, "session": "s", "close": true}               destroy the session
+ *
+ * Responses echo "id" and "session", and carry one of:
+ *     "result": "<text>"                                    (expr)
+ *     "w": w, "h": h, "rgba": "<base64 of w * h * 4 bytes>"  (render)
+ *     "closed": true                                        (close)
+ *     "error": "<message>"
+ *
+ * Responses on a connection are always written in the order the requests were received, so
+ * clients may pipeline any number of requests. A request line over 1 MiB gets an error
+ * response (without "id") and ends the connection.
+ */
+
+/* ~ ~ ~ ~ ~ JSON Values ~ ~ ~ ~ ~ */
+
+struct JsonValue {
+    enum { null_value, bool_value, number_value, string_value, array_value } type = null_value;
+    bool b = false;
+    double num = 0;
+    string str;
+    vector<double> arr;
+};
+
+typedef unordered_map<string, JsonValue> JsonObject;
+
+/* ~ ~ ~ ~ ~ Parsing ~ ~ ~ ~ ~ */
+
+inline void json_skip_ws(const string& s, size_t& i) {
+    while(i < s.size() && (s[i] == ' ' || s[i] == '\t' || s[i] == '\r' || s[i] == '\n')) i++;
+}
+
+// the code point of the 4 hex digits at s[i] (of a \u escape), or -1
+inline int json_parse_hex4(const string& s, size_t i) {
+    if(i + 4 > s.size()) return -1;
+    int cp = 0;
+    for(size_t k = i; k < i + 4; k++) {
+        char ch = s[k];
+        int digit = ch >= '0' && ch <= '9' ? ch - '0' : ch >= 'a' && ch <= 'f' ? ch - 'a' + 10 :
+                    ch >= 'A' && ch <= 'F' ? ch - 'A' + 10 : -1;
+        if(digit < 0) return -1;
+        cp = cp << 4 | digit;
+    }
+    return cp;
+}
+
+inline void utf8_append(string& out, uint32_t cp) {
+    if(cp < 0x80) out += (char) cp;
+    else if(cp < 0x800) {
+        out += (char) (0xC0 | cp >> 6);
+        out += (char) (0x80 | (cp & 0x3F));
+    } else if(cp < 0x10000) {
+        out += (char) (0xE0 | cp >> 12);
+        out += (char) (0x80 | (cp >> 6 & 0x3F));
+        out += (char) (0x80 | (cp & 0x3F));
+    } else {
+        out += (char) (0xF0 | cp >> 18);
+        out += (char) (0x80 | (cp >> 12 & 0x3F));
+        out += (char) (0x80 | (cp >> 6 & 0x3F));
+        out += (char) (0x80 | (cp & 0x3F));
+    }
+}
+
+inline bool json_parse_string(const string& s, size_t& i, string& out) {
+    if(i >= s.size() || s[i] != '"') return false;
+    i++;
+
+    while(i < s.size() && s[i] != '"') {
+        if(s[i] != '\\') {
+            out += s[i++];
+            continue;
+        }
+
+        if(++i >= s.size()) return false;
+        switch(s[i++]) {
+            case '"': out += '"'; break;
+            case '\\': out += '\\'; break;
+            case '/': out += '/'; break;
+            case 'b': out += '\b'; break;
+            case 'f': out += '\f'; break;
+            case 'n': out += '\n'; break;
+            case 'r': out += '\r'; break;
+            case 't': out += '\t'; break;
+            case 'u': {
+                int cp = json_parse_hex4(s, i);
+                if(cp < 0) return false;
+                i += 4;
+                if(cp >= 0xD800 && cp < 0xDC00) { // a high surrogate, which a low one must follow
+                    if(s.compare(i, 2, "\\u") != 0) return false;
+                    int low = json_parse_hex4(s, i + 2);
+                    if(low < 0xDC00 || low >= 0xE000) return false;
+                    i += 6;
+                    cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                } else if(cp >= 0xDC00 && cp < 0xE000) return false; // (a lone low surrogate)
+                utf8_append(out, cp);
+                break;
+            }
+            default: return false;
+        }
+    }
+
+    if(i >= s.size()) return false;
+    i++; // closing quote
+    return true;
+}
+
+// parses a number in JSON's grammar: -?(0|[1-9][0-9]*)(.[0-9]+)?([eE][+-]?[0-9]+)? (so no nan, inf,
+// hex or leading '+', all of which strtod would accept); too large a number parses as +-inf
+inline bool json_parse_number(const string& s, size_t& i, double& out) {
+    auto digits = [&](size_t& j) { // (skips one or more digits)
+        size_t start = j;
+        while(j < s.size() && isdigit((unsigned char) s[j])) j++;
+        return j > start;
+    };
+
+    size_t j = i;
+    if(j < s.size() && s[j] == '-') j++;
+    if(j < s.size() && s[j] == '0') j++;
+    else if(!digits(j)) return false;
+
+    if(j < s.size() && s[j] == '.' && !digits(++j)) return false;
+    if(j < s.size() && (s[j] == 'e' || s[j] == 'E')) {
+        j++;
+        if(j < s.size() && (s[j] == '+' || s[j] == '-')) j++;
+        if(!digits(j)) return false;
+    }
+
+    out = strtod(s.c_str() + i, nullptr); // (of a validated number, so it reads exactly s[i, j))
+    i = j;
+    return true;
+}
+
+inline bool json_parse_value(const string& s, size_t& i, JsonValue& out) {
+    json_skip_ws(s, i);
+    if(i >= s.size()) return false;
+
+    if(s[i] == '"') {
+        out.type = JsonValue::string_value;
+        return json_parse_string(s, i, out.str);
+    } else if(s.compare(i, 4, "true") == 0) {
+        out.type = JsonValue::bool_value, out.b = true, i += 4;
+    } else if(s.compare(i, 5, "false") == 0) {
+        out.type = JsonValue::bool_value, out.b = false, i += 5;
+    } else if(s.compare(i, 4, "null") == 0) {
+        out.type = JsonValue::null_value, i += 4;
+    } else if(s[i] == '[') {
+        out.type = JsonValue::array_value;
+        i++;
+        json_skip_ws(s, i);
+        if(i < s.size() && s[i] == ']') return ++i, true;
+
+        while(true) {
+            double num;
+            json_skip_ws(s, i);
+            if(!json_parse_number(s, i, num)) return false;
+            out.arr.push_back(num);
+            json_skip_ws(s, i);
+            if(i < s.size() && s[i] == ',') i++;
+            else if(i < s.size() && s[i] == ']') return ++i, true;
+            else return false;
+        }
+    } else {
+        out.type = JsonValue::number_value;
+        return json_parse_number(s, i, out.num);
+    }
+
+    return true;
+}
+
+// parses a flat JSON object; returns false on malformed input
+inline bool json_parse_object(const string& s, JsonObject& out) {
+    size_t i = 0;
+    json_skip_ws(s, i);
+    if(i >= s.size() || s[i++] != '{') return false;
+
+    json_skip_ws(s, i);
+    if(i < s.size() && s[i] == '}') return true;
+
+    while(true) {
+        string key;
+        json_skip_ws(s, i);
+        if(!json_parse_string(s, i, key)) return false;
+        json_skip_ws(s, i);
+        if(i >= s.size() || s[i++] != ':') return false;
+        if(!json_parse_value(s, i, out[key])) return false;
+        json_skip_ws(s, i);
+        if(i < s.size() && s[i] == ',') i++;
+        else if(i < s.size() && s[i] == '}') return true;
+        else return false;
+    }
+}
+
+/* ~ ~ ~ ~ ~ Serialization ~ ~ ~ ~ ~ */
+
+inline void json_append_string(string& out, const string& s) {
+    out += '"';
+    for(unsigned char ch : s) {
+        if(ch == '"') out += "\\\"";
+        else if(ch == '\\') out += "\\\\";
+        else if(ch == '\n') out += "\\n";
+        else if(ch == '\r') out += "\\r";
+        else if(ch == '\t') out += "\\t";
+        else if(ch < 0x20) {
+            char esc[8];
+            snprintf(esc, sizeof(esc), "\\u%04x", ch);
+            out += esc;
+        } else out += (char) ch;
+    }
+    out += '"';
+}
+
+inline void base64_append(string& out, const uint8_t *data, size_t len) {
+    static const char digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+    out.reserve(out.size() + (len + 2) / 3 * 4);
+    size_t i = 0;
+    for(; i + 2 < len; i += 3) {
+        uint32_t v = data[i] << 16 | data[i + 1] << 8 | data[i + 2];
+        out += digits[v >> 18 & 63];
+        out += digits[v >> 12 & 63];
+        out += digits[v >> 6 & 63];
+        out += digits[v & 63];
+    }
+
+    if(i + 1 == len) {
+        uint32_t v = data[i] << 16;
+        out += digits[v >> 18 & 63];
+        out += digits[v >> 12 & 63];
+        out += "==";
+    } else if(i + 2 == len) {
+        uint32_t v = data[i] << 16 | data[i + 1] << 8;
+        out += digits[v >> 18 & 63];
+        out += digits[v >> 12 & 63];
+        out += digits[v >> 6 & 63];
+        out += '=';
+    }
+}
+
+#endif // PROTOCOL
@@ -1,26 +1,35 @@
 #include "../calculator.h"
+#include "../calc/batch.h"
+#include "../calc/interval.h"
 
 /* ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ Graphing Backend ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ */
 
-constexpr int MAX_GRAPH_FUNCTIONS = 30; // limit to 30 because bitset is used when drawing
 constexpr int MIN_TICS = 3, MAX_TICS = 30;
-vector<unique_ptr<TreeNode>> graphed_functions(MAX_GRAPH_FUNCTIONS); // index corresponds to id
-int graph_buffer[1000 * 1000] = {0}; // contains bitsets, each bit corresponding to a function/axis
-                                     // (0th bit is axis, nth bit is graphed_functions[n - 1])
-int graph_height = 1000, graph_width = 1000; // changed dynamically on browser resize
-double x_min = -10, x_max = 10, y_min = -10, y_max = 10; // changed dynamically on browser resize
-bool axes_enabled = true;
-int tic_px = 2;
+constexpr int CULL_TILE = 64; // columns bounded by each enclosure when culling (see draw)
+
+// all graph state (graphed functions, buffer, dimensions and window) is owned by the current
+// context (see CalcContext in calculator.h).
+
+// returns the current context's graph buffer, allocating it on first use
+int *graph_buffer() {
+    if(ctx->graph_buffer.size() < ctx->graph_width * ctx->graph_height)
+        ctx->graph_buffer.resize(ctx->graph_width * ctx->graph_height, 0);
+    return ctx->graph_buffer.data();
+}
 
 /* ~ ~ ~ ~ ~ Backend Graphing Functions ~ ~ ~ ~ ~ */
 
-// generates a set evenly-spaced of tic-marks on powers of 10 on the range [min, max]
+// generates a set evenly-spaced of tic-marks on powers of 10 on the range [min, max] (none if
+// the range isn't positive and finite, or is too narrow for its tics to be counted in long longs)
 vector<double> get_tic_coords(double min, double max) {
+    vector<double> tics;
+    if(!(max - min > 0 && isfinite(max - min))) return tics;
+
     double factor = 1;
-    while((max - min) * factor < MIN_TICS) factor *= 10;
+    while((max - min) * factor < MIN_TICS && isfinite(factor)) factor *= 10;
+    if(!isfinite(factor)) return tics;
     while((max - min) * factor > MAX_TICS) factor /= 10;
-
-    vector<double> tics;
+    if(!(abs(min * factor) < 0x1p62 && abs(max * factor) < 0x1p62)) return tics;
 
     for(long long p = min * factor; p <= max * factor; p++) {
         if((p / factor) < min || (p / factor) > max) continue;
@@ -30,19 +39,21 @@ vector<double> get_tic_coords(double min, double max) {
     return tics;
 }
 
-// connects the points in the vector (if possible) according to the graph size,
-// and draws them onto the graph_buffer
-void draw_point_vector(const vector<int>& vec, int index) {
+// connects the points in the vector (if possible, and if joined to the next) according to the
+// graph size, and draws them onto the graph_buffer
+void draw_point_vector(const vector<int>& vec, const vector<char>& joined, int index) {
+    int *buffer = graph_buffer();
+
     for(int j = 0; j < vec.size(); j++) {
         if(vec[j] == INT_MAX) continue; // never draw NAN
-        if(vec[j] >= 0 && vec[j] < graph_height) // draw the point if it is on the canvas
-            graph_buffer[vec[j] * graph_width + j] |= 2 << index;
+        if(vec[j] >= 0 && vec[j] < ctx->graph_height) // draw the point if it is on the canvas
+            buffer[vec[j] * ctx->graph_width + j] |= 2 << index;
 
         // draw vertical line between this and next column if possible
-        if(j < vec.size() - 1 && abs(vec[j] - vec[j + 1]) > 1) {
+        if(j < vec.size() - 1 && joined[j] && abs((long long) vec[j] - vec[j + 1]) > 1) {
             int low = min(vec[j], vec[j + 1]), high = max(vec[j], vec[j + 1]);
-            for(int i = max(0, low); i < min(graph_height, high); i++) {
-                graph_buffer[i * graph_width + (j + 1)] |= 2 << index;
+            for(int i = max(0, low); i < min(ctx->graph_height, high); i++) {
+                buffer[i * ctx->graph_width + (j + 1)] |= 2 << index;
             }
         }
     }
@@ -50,112 +61,193 @@ void draw_point_vector(const vector<int>& vec, int index) {
 
 // draws a vertical line across the whole screen on the axis layer at x_c
 // this line is only drawn once: it isn't redrawn with the axes
-void draw_trace_line(int x_c) {
-    if(x_c < 0 || x_c >= graph_width) return;
+void draw_trace_line(CalcContext& c, int x_c) {
+    ContextScope scope(c);
+    if(x_c < 0 || x_c >= ctx->graph_width) return;
+    int *buffer = graph_buffer();
 
-    for(int y_c = 0; y_c < graph_height; y_c++) graph_buffer[y_c * graph_width + x_c] |= 1;
+    for(int y_c = 0; y_c < ctx->graph_height; y_c++) buffer[y_c * ctx->graph_width + x_c] |= 1;
 }
 
-// draws graphed_functions[index] to graph_buffer
-void draw(int index) {
+// the function's value at each of the n x values in x_p, evaluated by batches when the tree
+// compiles to a BatchProgram (see batch.h), else point by point with x set to each value
+vector<double> eval_columns(TreeNode& tree, const BatchProgram *program, const vector<double>& x_p) {
+    int n = x_p.size();
+    vector<double> y_p(n);
+
+    if(program) {
+        platform_parallel_for((n + BATCH_SIZE - 1) / BATCH_SIZE, [&](int batch) {
+            vector<double> regs = program->new_registers();
+            int start = batch * BATCH_SIZE;
+            program->run(&x_p[start], &y_p[start], min(BATCH_SIZE, n - start), regs.data());
+        });
+        return y_p;
+    }
+
     double old_x_value = get_id_value("x"); // x is used as the drawing variable - save its old val
+    for(int i = 0; i < n; i++) {
+        set_id_value("x", x_p[i]);
+        y_p[i] = tree.eval();
+    }
+    set_id_value("x", old_x_value);
+    return y_p;
+}
+
+// y_c of y_p (INT_MAX for NAN and infinities), clamped to just off the canvas (see enclose_tiles)
+// so that it fits in an int
+int canvas_y(double y_p, double y_ratio) {
+    double y_c = (y_p - ctx->y_min) * y_ratio; // (NAN too for windows too narrow for doubles)
+    if(isinf(y_p) || isnan(y_c)) return INT_MAX;
+    y_c = min(max(y_c, -2.0), ctx->graph_height + 2.0);
+    return ctx->graph_height - (int) y_c; // 0 = bottom => 0 = top
+}
+
+// encloses the function over each tile of CULL_TILE columns (and the gap to the next tile), and
+// culls the tiles that are all above or all below the canvas (by more than a pixel, for the
+// rounding of y_c and of fast math) with a y_c that draws like theirs. Returns whether the
+// function is continuous over each tile.
+vector<char> enclose_tiles(const BatchProgram& program, const vector<double>& x_p, double y_ratio,
+                           vector<int>& y_c_vec, vector<char>& culled) {
+    int n = x_p.size(), num_tiles = (n + CULL_TILE - 1) / CULL_TILE;
+    double above = ctx->y_max + 2 / y_ratio, below = ctx->y_min - 2 / y_ratio;
+    vector<char> tile_cont(num_tiles);
+
+    platform_parallel_for(num_tiles, [&](int tile) {
+        int start = tile * CULL_TILE, end = min(n, start + CULL_TILE);
+        Interval y = interval_eval(program, {x_p[start], x_p[min(end, n - 1)]});
+        tile_cont[tile] = y.cont;
+        if(!y.def || !(y.lo > above || y.hi < below)) return;
+
+        // (every y_c < 0 draws the same, as does every y_c > graph_height)
+        int y_c = y.lo > above ? -2 : ctx->graph_height + 2;
+        for(int x_c = start; x_c < end; x_c++) y_c_vec[x_c] = y_c, culled[x_c] = true;
+    });
+    return tile_cont;
+}
+
+// unjoins the columns that would be connected by a line, but between which the function isn't
+// continuous (at poles, jumps and the ends of its domain), in the tiles it isn't continuous over
+void find_breaks(const BatchProgram& program, const vector<double>& x_p, const vector<int>& y_c_vec,
+                 const vector<char>& tile_cont, vector<char>& joined) {
+    for(int x_c = 0; x_c + 1 < x_p.size(); x_c++) {
+        if(tile_cont[x_c / CULL_TILE]) continue;
+        int y_c = y_c_vec[x_c], next = y_c_vec[x_c + 1];
+        if(y_c == INT_MAX || abs((long long) y_c - next) <= 1) continue; // (no line)
+        if(min(y_c, next) >= ctx->graph_height || max(y_c, next) <= 0) continue; // (off the canvas)
+        if(!interval_eval(program, {x_p[x_c], x_p[x_c + 1]}).cont) joined[x_c] = false;
+    }
+}
 
+// draws graphed_functions[index] to the graph buffer. When its program has an interval form (see
+// interval.h), the tiles of columns that are provably off the canvas aren't evaluated, and columns
+// aren't connected across a discontinuity (the vertical lines of tan's poles or floor's steps)
+void draw(int index) {
     // x_c means "x on canvas" (uses int units), x_p means "x on plane" (uses float units)
 
-    double x_ratio = (x_max - x_min) / (graph_width);
-    double y_ratio = (graph_height) / (y_max - y_min);
-    vector<int> y_c_vec; // holds the value of y_c at each x_c.
-
-    for(int x_c = 0; x_c < graph_width; x_c++) {
-        double x_p = x_min + (x_c * x_ratio);
-        set_id_value("x", x_p);
-        double y_p = graphed_functions[index]->eval();
-        int y_c;
-        if(isinf(y_p) || isnan(y_p)) y_c = INT_MAX;
-        else {
-            y_c = (y_p - y_min) * y_ratio; // TODO join this line and below
-            y_c = graph_height - y_c; // 0 = bottom => 0 = top
-        }
+    double x_ratio = (ctx->x_max - ctx->x_min) / (ctx->graph_width);
+    double y_ratio = (ctx->graph_height) / (ctx->y_max - ctx->y_min);
 
-        y_c_vec.push_back(y_c);
-        draw_point_vector(y_c_vec, index);
+    vector<double> x_p(ctx->graph_width);
+    for(int x_c = 0; x_c < ctx->graph_width; x_c++) x_p[x_c] = ctx->x_min + (x_c * x_ratio);
+
+    TreeNode& tree = *ctx->graphed_functions[index];
+    unique_ptr<BatchProgram> program = BatchProgram::compile(tree, "x", get_id_value("PLOT_FAST_MATH"));
+    bool enclosed = program && has_interval_form(*program);
+
+    vector<int> y_c_vec(ctx->graph_width); // holds the value of y_c at each x_c.
+    vector<char> culled(ctx->graph_width, false), joined(ctx->graph_width, true), tile_cont;
+    if(enclosed) tile_cont = enclose_tiles(*program, x_p, y_ratio, y_c_vec, culled);
+
+    vector<double> x_eval;
+    for(int x_c = 0; x_c < ctx->graph_width; x_c++) if(!culled[x_c]) x_eval.push_back(x_p[x_c]);
+    vector<double> y_p = eval_columns(tree, program.get(), x_eval);
+    for(int x_c = 0, k = 0; x_c < ctx->graph_width; x_c++) {
+        if(!culled[x_c]) y_c_vec[x_c] = canvas_y(y_p[k++], y_ratio);
     }
 
-    set_id_value("x", old_x_value);
+    if(enclosed) find_breaks(*program, x_p, y_c_vec, tile_cont, joined);
+    draw_point_vector(y_c_vec, joined, index);
 }
 
-// entirely removes graphed_functions[index] from graph_buffer
+// entirely removes graphed_functions[index] from the graph buffer
 void undraw(int index) {
-    for(int i = 0; i < graph_height; i++) {
-        for(int j = 0; j < graph_width; j++) {
-            graph_buffer[i * graph_width + j] &= ~(2 << index);
+    int *buffer = graph_buffer();
+
+    for(int i = 0; i < ctx->graph_height; i++) {
+        for(int j = 0; j < ctx->graph_width; j++) {
+            buffer[i * ctx->graph_width + j] &= ~(2 << index);
         }
     }
 }
 
 void draw_axes() {
-    double x_ratio = (graph_width) / (x_max - x_min) ;
-    double y_ratio = (graph_height) / (y_max - y_min);
+    int *buffer = graph_buffer();
+    double x_ratio = (ctx->graph_width) / (ctx->x_max - ctx->x_min) ;
+    double y_ratio = (ctx->graph_height) / (ctx->y_max - ctx->y_min);
 
-    int x_0_c = -x_min * x_ratio; // x = 0 on canvas pixel
-    int y_0_c = y_min * y_ratio + graph_height; // y = 0 on canvas pixel
+    // (positions far off the canvas, which don't fit in an int, are -1)
+    auto to_canvas = [](double c) { return c >= 0 && c < INT_MAX ? (int) c : -1; };
+    int x_0_c = to_canvas(-ctx->x_min * x_ratio); // x = 0 on canvas pixel
+    int y_0_c = to_canvas(ctx->y_min * y_ratio + ctx->graph_height); // y = 0 on canvas pixel
 
-    vector<double> x_tics = get_tic_coords(x_min, x_max);
-    vector<double> y_tics = get_tic_coords(y_min, y_max);
+    vector<double> x_tics = get_tic_coords(ctx->x_min, ctx->x_max);
+    vector<double> y_tics = get_tic_coords(ctx->y_min, ctx->y_max);
 
     // x axis
-    if(y_0_c >= 0 && y_0_c < graph_height) {
-        for(int j = 0; j < graph_width; j++) graph_buffer[y_0_c * graph_width + j] |= 1; // axis
+    if(y_0_c >= 0 && y_0_c < ctx->graph_height) {
+        for(int j = 0; j < ctx->graph_width; j++) buffer[y_0_c * ctx->graph_width + j] |= 1; // axis
 
         if(get_id_value("TICS_ENABLED"))
         for(double& x_p : x_tics) { // tics
-            int x_c = (x_p - x_min) * x_ratio;
-            if(x_c < 0 || x_c >= graph_width) continue;
-            for(int y_c = y_0_c - tic_px; y_c <= y_0_c + tic_px; y_c++) {
-                if(y_c < 0 || y_c >= graph_height) continue;
-                graph_buffer[y_c * graph_width + x_c] |= 1;
+            int x_c = (x_p - ctx->x_min) * x_ratio;
+            if(x_c < 0 || x_c >= ctx->graph_width) continue;
+            for(int y_c = y_0_c - ctx->tic_px; y_c <= y_0_c + ctx->tic_px; y_c++) {
+                if(y_c < 0 || y_c >= ctx->graph_height) continue;
+                buffer[y_c * ctx->graph_width + x_c] |= 1;
             }
         }
     }
 
     // y axis
-    if(x_0_c >= 0 && x_0_c < graph_width) {
-        for(int i = 0; i < graph_height; i++) graph_buffer[i * graph_width + x_0_c] |= 1; // axis
+    if(x_0_c >= 0 && x_0_c < ctx->graph_width) {
+        for(int i = 0; i < ctx->graph_height; i++) buffer[i * ctx->graph_width + x_0_c] |= 1; // axis
 
         if(get_id_value("TICS_ENABLED"))
         for(double& y_p : y_tics) { // tics
-            int y_c = (y_min - y_p) * y_ratio + graph_height;
-            if(y_c < 0 || y_c >= graph_height) continue;
-            for(int x_c = x_0_c - tic_px; x_c <= x_0_c + tic_px; x_c++) {
-                if(x_c < 0 || x_c >= graph_width) continue;
-                graph_buffer[y_c * graph_width + x_c] |= 1;
+            int y_c = (ctx->y_min - y_p) * y_ratio + ctx->graph_height;
+            if(y_c < 0 || y_c >= ctx->graph_height) continue;
+            for(int x_c = x_0_c - ctx->tic_px; x_c <= x_0_c + ctx->tic_px; x_c++) {
+                if(x_c < 0 || x_c >= ctx->graph_width) continue;
+                buffer[y_c * ctx->graph_width + x_c] |= 1;
             }
         }
     }
 }
 
 void undraw_axes() {
-    for(int i = 0; i < graph_height; i++) {
-        for(int j = 0; j < graph_width; j++) {
-            graph_buffer[i * graph_width + j] &= ~1;
+    int *buffer = graph_buffer();
+
+    for(int i = 0; i < ctx->graph_height; i++) {
+        for(int j = 0; j < ctx->graph_width; j++) {
+            buffer[i * ctx->graph_width + j] &= ~1;
         }
     }
 }
 
 /* ~ ~ ~ ~ ~ Frontend Graphing Functions ~ ~ ~ ~ ~ */
 
-int *get_graph_buffer() {
-    return graph_buffer;
+int *get_graph_buffer(CalcContext& c) {
+    ContextScope scope(c);
+    return graph_buffer();
 }
 
 // attempts to add the given parsing-tree-node-expression to the graph;
 // return false if graph is full (graphed_functions has no nullptr elements)
 bool add_to_graph(unique_ptr<TreeNode>&& expr) {
     for(int i = 0; i < MAX_GRAPH_FUNCTIONS; i++) {
-        if(graphed_functions[i] == nullptr) {
-            emscripten_run_script(("add_graph_fn(\"" + expr->to_string() +
-                                   "\", " + to_string(i) + ")").data());
-            graphed_functions[i] = std::move(expr);
+        if(ctx->graphed_functions[i] == nullptr) {
+            platform_add_graph_fn(expr->to_string(), i);
+            ctx->graphed_functions[i] = persistent_copy(*expr); // kept until ungraphed
             draw(i);
             return true;
         }
@@ -165,30 +257,52 @@ bool add_to_graph(unique_ptr<TreeNode>&& expr) {
 }
 
 // ungraphs and erases graphed_functions[index]
-bool remove_from_graph(int index) {
-    if(graphed_functions[index] == nullptr) return false;
+bool remove_from_graph(CalcContext& c, int index) {
+    ContextScope scope(c);
+    if(ctx->graphed_functions[index] == nullptr) return false;
 
     undraw(index);
-    graphed_functions[index].reset(); // destruct graphed_functions[index]; set it to nullptr
+    ctx->graphed_functions[index].reset(); // destruct graphed_functions[index]; set it to nullptr
     return true;
 }
 
 // undraws all functions, resizes the graph, then draws the functions again.
-void resize_graph(int new_height, int new_width, double new_x_min, double new_x_max,
-                                                 double new_y_min, double new_y_max) {
-    for(int i = 0; i < MAX_GRAPH_FUNCTIONS; i++) if(graphed_functions[i] != nullptr) undraw(i);
-    if(axes_enabled) undraw_axes();
+void resize_graph(CalcContext& c, int new_height, int new_width, double new_x_min,
+                  double new_x_max, double new_y_min, double new_y_max) {
+    ContextScope scope(c);
+    for(int i = 0; i < MAX_GRAPH_FUNCTIONS; i++) if(ctx->graphed_functions[i] != nullptr) undraw(i);
+    if(ctx->axes_enabled) undraw_axes();
 
-    graph_height = new_height, graph_width = new_width;
-    x_min = new_x_min, x_max = new_x_max, y_min = new_y_min, y_max = new_y_max;
+    ctx->graph_height = new_height, ctx->graph_width = new_width;
+    ctx->x_min = new_x_min, ctx->x_max = new_x_max, ctx->y_min = new_y_min, ctx->y_max = new_y_max;
 
-    if(axes_enabled) draw_axes();
-    for(int i = 0; i < MAX_GRAPH_FUNCTIONS; i++) if(graphed_functions[i] != nullptr) draw(i);
+    if(ctx->axes_enabled) draw_axes();
+    for(int i = 0; i < MAX_GRAPH_FUNCTIONS; i++) if(ctx->graphed_functions[i] != nullptr) draw(i);
 }
 
 void toggle_axes() {
-    axes_enabled = !axes_enabled;
+    ctx->axes_enabled = !ctx->axes_enabled;
 
-    if(axes_enabled) draw_axes();
+    if(ctx->axes_enabled) draw_axes();
     else undraw_axes();
 }
+
+/* ~ ~ ~ ~ ~ Exported Functions (default context) ~ ~ ~ ~ ~ */
+
+int *get_graph_buffer() {
+    return get_graph_buffer(default_context());
+}
+
+bool remove_from_graph(int index) {
+    return remove_from_graph(default_context(), index);
+}
+
+void resize_graph(int new_height, int new_width, double new_x_min, double new_x_max,
+                                                 double new_y_min, double new_y_max) {
+    resize_graph(default_context(), new_height, new_width, new_x_min, new_x_max,
+                 new_y_min, new_y_max);
+}
+
+void draw_trace_line(int x_c) {
+    draw_trace_line(default_context(), x_c);
+}
@@ -20,6 +20,58 @@ function calculate_text(text, just_number = false) {
     return result;
 }
 
+// evaluates many commands with one call into WASM (see calculate_batch in frontend.cpp),
+// then decodes all of their results at once; returns the results in order.
+function calculate_batch(commands, just_number = false) {
+    let input = new TextEncoder().encode(commands.join("\0") + "\0");
+    let in_ptr = _malloc(input.length);
+    Module.HEAPU8.set(input, in_ptr);
+
+    let capacity = Math.max(1 << 16, 4 * input.length); // output arena size (grown if needed)
+    let out_ptr = _malloc(capacity);
+    let offsets_capacity = commands.length + 1;
+    let offsets_ptr = _malloc(4 * offsets_capacity);
+    let decoder = new TextDecoder();
+    let results = [];
+
+    let n = _calculate_batch(in_ptr, commands.length, just_number, out_ptr, capacity,
+                             offsets_ptr, offsets_capacity);
+    while(true) {
+        if(n) {
+            let end = Module.HEAP32[(offsets_ptr >> 2) + n]; // one past the last result's NUL
+            let text = decoder.decode(Module.HEAPU8.subarray(out_ptr, out_ptr + end - 1));
+            results = results.concat(text.split("\0"));
+        }
+        if(results.length >= commands.length) break;
+
+        if(n == 0) { // the next result doesn't fit in the arena
+            _free(out_ptr);
+            capacity *= 2;
+            out_ptr = _malloc(capacity);
+        }
+        n = _calculate_batch(0, 0, just_number, out_ptr, capacity, offsets_ptr, offsets_capacity); // the rest
+    }
+
+    _free(in_ptr);
+    _free(out_ptr);
+    _free(offsets_ptr);
+    return results;
+}
+
+// runs a list of saved commands (e.g. a notebook) as if each had been typed into the terminal
+function replay_commands(commands) {
+    let results = calculate_batch(commands);
+    let text = "";
+    for(let i = 0; i < commands.length; i++) text += commands[i] + "\n" + results[i] + "\n";
+
+    screen_is_cleared = false;
+    TEXT_OUTPUT_ELEMENT.textContent += text;
+    TEXT_OUTPUT_ELEMENT.scrollTop = TEXT_OUTPUT_ELEMENT.scrollHeight;
+    past_commands = past_commands.concat(commands);
+    past_command_index = past_commands.length;
+    update_latex_result();
+}
+
 function update_latex_result() {
     LATEX_TEXT_ELEMENT.innerHTML = "$$\\displaylines{" + decode_cstr(_get_latex_result()) + "}$$";
     MathJax.typeset();
@@ -53,6 +105,17 @@ function handle_text_input_keypress(e) {
 }
 TEXT_INPUT_ELEMENT.addEventListener("keydown", handle_text_input_keypress);
 
+// pasting several lines into the input runs each as a command (in one batch), rather than
+// joining them into one line
+function handle_text_input_paste(e) {
+    let lines = e.clipboardData.getData("text").split(/\r?\n/).filter(line => line.trim() != "");
+    if(lines.length < 2) return;
+
+    e.preventDefault();
+    replay_commands(lines);
+}
+TEXT_INPUT_ELEMENT.addEventListener("paste", handle_text_input_paste);
+
 /* ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ Runtime ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ */
 
 var screen_is_cleared = false; // this flag is set after clearing the screen so that the clear()
@@ -0,0 +1,100 @@
+#include "../calculator.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+/* ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ Platform Callbacks (Native) ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ */
+
+// there is no page to notify natively, so graph changes are applied directly
+// to the active context (the page would otherwise call back into the engine)
+
+void platform_clear_screen() { }
+
+void platform_add_graph_fn(const string& name, int id) { }
+
+// the page indexes its list of graphed functions; natively that list is
+// graphed_functions itself, skipping empty slots
+void platform_remove_graph_fn(int index) {
+    for(int i = 0; i < MAX_GRAPH_FUNCTIONS; i++) {
+        if(ctx->graphed_functions[i] != nullptr && index-- == 0) {
+            remove_from_graph(*ctx, i);
+            return;
+        }
+    }
+}
+
+void platform_set_graph_window(double x_min, double y_min, double x_max, double y_max) {
+    resize_graph(*ctx, ctx->graph_height, ctx->graph_width, x_min, x_max, y_min, y_max);
+}
+
+/* ~ ~ ~ ~ ~ Worker Threads ~ ~ ~ ~ ~ */
+
+// A parallel_for hands out its tasks by an atomic counter, to the calling thread and to as many
+// pool threads as pick it up: so the caller never waits on a pool busy with other contexts'
+// work, and pool threads that get to a finished parallel_for just drop it.
+struct ParallelFor {
+    const function<void(int)> *task; // (only used while tasks are left)
+    int num_tasks;
+    atomic<int> next {0}, done {0};
+    mutex m;
+    condition_variable finished;
+
+    void work() {
+        for(int i = next++; i < num_tasks; i = next++) {
+            (*task)(i);
+            if(++done == num_tasks) {
+                lock_guard<mutex> lock(m);
+                finished.notify_all();
+            }
+        }
+    }
+};
+
+struct WorkerPool {
+    int num_threads;
+    mutex m;
+    condition_variable available;
+    deque<shared_ptr<ParallelFor>> jobs;
+
+    WorkerPool(int n) : num_threads(n) {
+        for(int i = 0; i < n; i++) thread([this] { serve(); }).detach();
+    }
+
+    void serve() {
+        while(true) {
+            shared_ptr<ParallelFor> job;
+            {
+                unique_lock<mutex> lock(m);
+                available.wait(lock, [this] { return !jobs.empty(); });
+                job = std::move(jobs.front());
+                jobs.pop_front();
+            }
+            job->work();
+        }
+    }
+};
+
+void platform_parallel_for(int num_tasks, const function<void(int)>& task) {
+    // (never destroyed, as its threads are never joined)
+    static WorkerPool *pool = new WorkerPool(max(1u, thread::hardware_concurrency()) - 1);
+
+    int num_helpers = min(pool->num_threads, num_tasks - 1);
+    if(num_helpers <= 0) {
+        for(int i = 0; i < num_tasks; i++) task(i);
+        return;
+    }
+
+    auto job = make_shared<ParallelFor>();
+    job->task = &task;
+    job->num_tasks = num_tasks;
+    {
+        lock_guard<mutex> lock(pool->m);
+        for(int i = 0; i < num_helpers; i++) pool->jobs.push_back(job);
+    }
+    pool->available.notify_all();
+
+    job->work();
+    unique_lock<mutex> lock(job->m);
+    job->finished.wait(lock, [&] { return job->done == num_tasks; });
+}
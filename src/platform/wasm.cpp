@@ -0,0 +1,31 @@
+#include "../calculator.h"
+#include <emscripten.h>
+
+/* ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ Platform Callbacks (WASM) ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ */
+
+// forwards engine notifications to the page's scripts (src/page, src/graph/*.js)
+
+void platform_clear_screen() {
+    emscripten_run_script("clear_screen();");
+}
+
+void platform_add_graph_fn(const string& name, int id) {
+    emscripten_run_script(("add_graph_fn(\"" + name + "\", " + to_string(id) + ")").data());
+}
+
+void platform_remove_graph_fn(int index) {
+    emscripten_run_script(("remove_graph_fn(" + to_string(index) + ")").data());
+}
+
+void platform_set_graph_window(double x_min, double y_min, double x_max, double y_max) {
+    emscripten_run_script(("x_min = " + to_string(x_min) + ","
+                           "y_min = " + to_string(y_min) + ","
+                           "x_max = " + to_string(x_max) + ","
+                           "y_max = " + to_string(y_max) + ","
+                           "graph_dimensions_changed = true;").c_str());
+}
+
+// (the module is built without threads)
+void platform_parallel_for(int num_tasks, const function<void(int)>& task) {
+    for(int i = 0; i < num_tasks; i++) task(i);
+}